@@ -0,0 +1,34 @@
+#ifndef FILE_READER_HPP
+#define FILE_READER_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace mattersim {
+
+    /**
+     * Read a whole file into memory.
+     * @throws std::invalid_argument if the file could not be read
+     */
+    void readFile(const std::string& filename, std::vector<unsigned char>& data);
+
+    /**
+     * Read a batch of files into memory. When built with liburing, all the reads are submitted
+     * together through io_uring, otherwise (or if io_uring can't be set up at runtime) they are 
+     * issued from a pool of OpenMP threads.
+     * The callback is invoked with the index of each file as soon as it has been read, possibly
+     * from several threads at once, so files can be processed while other reads are in flight.
+     * @param filenames - files to read
+     * @param data - output, contents of each file
+     * @param callback - called once for each file after it has been read
+     * @throws std::invalid_argument if a file could not be read. Any exception is only rethrown
+     *         after all other files have been read and processed.
+     * @throws std::runtime_error if io_uring fails while reads are in flight
+     */
+    void readFiles(const std::vector<std::string>& filenames, std::vector<std::vector<unsigned char> >& data,
+                   const std::function<void(size_t)>& callback);
+
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <vector>
+#include <functional>
+#include <unordered_map>
 #include <random>
 #include <cmath>
 #include <stdexcept>
@@ -28,11 +30,12 @@
 
 #include "Benchmark.hpp"
 #include "NavGraph.hpp"
+#include "Navigator.hpp"
 
 namespace mattersim {
 
     struct Viewpoint: std::enable_shared_from_this<Viewpoint> {
-        Viewpoint(std::string viewpointId, unsigned int ix, double x, double y, double z,
+        Viewpoint(const std::string& viewpointId, unsigned int ix, double x, double y, double z,
           double rel_heading, double rel_elevation, double rel_distance) : 
             viewpointId(viewpointId), ix(ix), x(x), y(y), z(z), rel_heading(rel_heading),
             rel_elevation(rel_elevation), rel_distance(rel_distance)  
@@ -68,6 +71,8 @@ namespace mattersim {
     struct SimState: std::enable_shared_from_this<SimState>{
         //! Building / scan environment identifier
         std::string scanId;
+        //! Interned integer handle of scanId (see Simulator::scanHandle)
+        unsigned int scanHandle = 0;
         //! Number of frames since the last newEpisode() call
         unsigned int step = 0;
         //! RGB image (in BGR channel order) from the agent's current viewpoint
@@ -83,14 +88,60 @@ namespace mattersim {
         //! Agent's current view [0-35] (set only when viewing angles are discretized)
         //! [0-11] looking down, [12-23] looking at horizon, [24-35] looking up
         unsigned int viewIndex = 0;
+        //! True if the images were rendered from the low resolution cubemap tier
+        //! (see Simulator::setLowResolutionFaceSize)
+        bool lowResolution = false;
+        //! True if the images are blank because, in deadline mode, the low resolution tier of the scan
+        //! was still loading (see Simulator::setDeadlineModeEnabled)
+        bool placeholder = false;
         //! Vector of nearby navigable locations representing state-dependent action candidates, i.e.
         //! viewpoints you can move to. Index 0 is always to remain at the current viewpoint.
         //! The remaining viewpoints are sorted by their angular distance from the centre of the image.
         std::vector<ViewpointPtr> navigableLocations;
+        //! Navigable locations by value, in the same order. navigableLocations and location point into
+        //! this storage, which is reused by the next action unless they are still referenced elsewhere.
+        std::shared_ptr<std::vector<Viewpoint> > candidates;
     };
 
     typedef std::shared_ptr<SimState> SimStatePtr;
 
+    /**
+     * Arguments for Simulator::makeAction, with one entry per environment in the batch.
+     */
+    struct Actions {
+        //! Index into each environment's navigableLocations, 0 to stay at the current viewpoint
+        std::vector<unsigned int> index;
+        //! Heading change in radians
+        std::vector<double> heading;
+        //! Elevation change in radians
+        std::vector<double> elevation;
+    };
+
+    /**
+     * Poses, and images if rendering is enabled, of every step taken by Simulator::executeSequence or
+     * Simulator::executePath. Steps are grouped by environment, and each environment's steps begin 
+     * with its state before the first action.
+     */
+    struct TrajectoryLog {
+        //! Index of the first step of each environment, plus the total number of steps
+        std::vector<size_t> offsets;
+        //! Viewpoint index of each step, as in Viewpoint::ix
+        std::vector<unsigned int> viewpointIx;
+        //! Camera heading of each step in radians
+        std::vector<double> heading;
+        //! Camera elevation of each step in radians
+        std::vector<double> elevation;
+        //! View of each step [0-35] (set only when viewing angles are discretized)
+        std::vector<unsigned int> viewIndex;
+        //! Size of the images
+        int width = 0;
+        int height = 0;
+        //! RGB image (in BGR channel order) of each step, one after another with height*width*3 bytes each
+        std::vector<unsigned char> rgb;
+        //! Depth image of each step, one after another with height*width values each (if depth is enabled)
+        std::vector<unsigned short> depth;
+    };
+
 
     /**
      * Main class for accessing an instance of the simulator environment.
@@ -165,6 +216,48 @@ namespace mattersim {
          */
         void setDepthEnabled(bool value);
 
+        /**
+         * Enable or disable lazy loading of cubemap faces. When enabled, only the cubemap faces
+         * touched by the camera frustum are decoded from disk and uploaded to the GPU. The remaining
+         * faces are filled in on demand when the camera turns towards them. Default is false (disabled).
+         */
+        void setLazyLoadingEnabled(bool value);
+
+        /**
+         * Set the face size in pixels of a low resolution cubemap tier, e.g. 32 or 64. When set, a low 
+         * resolution cubemap of every viewpoint in a scan is loaded onto the GPU the first time the scan
+         * is used, and kept there outside of the texture cache. If the camera resolution and field of 
+         * view need no more detail than this, all rendering uses the low resolution tier and full 
+         * resolution images are never loaded. Default is 0 (disabled).
+         */
+        void setLowResolutionFaceSize(unsigned int size);
+
+        /**
+         * Enable or disable deadline mode. When enabled, rendering never waits for full resolution images
+         * to be read from disk. Viewpoints whose images are not yet in CPU memory are rendered from the 
+         * low resolution tier while their images are loaded in the background. The low resolution tier 
+         * of each scan is also loaded in the background, and until it is ready blank images are returned.
+         * Check SimState::lowResolution to see which tier was used, and SimState::placeholder for blank 
+         * images. If no low resolution face size has been set, 64 pixels is used. Default is false (disabled).
+         */
+        void setDeadlineModeEnabled(bool value);
+
+        /**
+         * Enable or disable background texture uploads. When enabled, textures are uploaded to the GPU
+         * by a loader thread with its own OpenGL context, so that uploads for the rest of the batch 
+         * overlap with rendering. Only supported with EGL rendering, other backends always upload from
+         * the rendering thread. Default is false (disabled).
+         */
+        void setBackgroundUploadEnabled(bool value);
+
+        /**
+         * Enable or disable candidate tables, which only apply with discretized viewing angles. Navigable
+         * locations then only depend on the viewpoint and viewIndex, so when a scan is first used they are
+         * computed for all 36 views of each of its viewpoints, and every action becomes a table lookup.
+         * Default is false (disabled).
+         */
+        void setCandidateTablesEnabled(bool value);
+
         /**
          * Set the number of environments in the batch. Default is 1.
          */
@@ -176,6 +269,20 @@ namespace mattersim {
          */
         void setCacheSize(unsigned int size);
 
+        /**
+         * Set the eviction policy of the texture cache. CachePolicy::TwoQueue keeps viewpoints that are
+         * revisited when many others are only seen once, and CachePolicy::ScanAffinity stops one scan from
+         * flushing the textures of other scans in a mixed batch. Default is CachePolicy::LRU.
+         */
+        void setCachePolicy(CachePolicy policy);
+
+        /**
+         * Set the GPU memory in bytes for caching pano textures. Default is 0, which converts cacheSize 
+         * to bytes using the average pano texture size measured (this depends on the face resolution 
+         * and whether depth is enabled).
+         */
+        void setCacheCapacity(size_t bytes);
+
         /**
          * Set the random seed for episodes where viewpoint is not provided.
          */
@@ -186,6 +293,29 @@ namespace mattersim {
          */
         void initialize();
 
+        /**
+         * Warm up the image cache for a known set of episodes. The given viewpoints and their 
+         * neighbourhoods in the navigation graph are loaded from disk into CPU memory in parallel, 
+         * most frequently visited first, until the memory budget is used. This gives most of the
+         * benefit of setPreloadingEnabled at a fraction of the memory and start-up cost.
+         * @param scanId - scan of each viewpoint, e.g. "2t7WUuJeko7"
+         * @param viewpointId - viewpoints the episodes will visit, repeats raise their priority
+         * @param hops - also load viewpoints up to this many steps away from each viewpoint
+         * @param memoryBudget - maximum CPU memory in bytes to use for the newly loaded images
+         * @return number of viewpoints loaded, not counting those that were already in memory
+         */
+        unsigned int warmCache(const std::vector<std::string>& scanId, const std::vector<std::string>& viewpointId,
+              unsigned int hops, size_t memoryBudget);
+
+        /**
+         * Warm up the image cache from an R2R-format episode file, e.g. "tasks/R2R/data/R2R_train.json".
+         * The file must contain a json list of episodes, each with a "scan" and a "path" of viewpointIds.
+         * @param hops - also load viewpoints up to this many steps away from each path
+         * @param memoryBudget - maximum CPU memory in bytes to use for the loaded images
+         * @return number of viewpoints loaded
+         */
+        unsigned int warmCacheFromFile(const std::string& episodeFile, unsigned int hops, size_t memoryBudget);
+
         /**
          * Starts a new episode. If a viewpoint is not provided initialization will be random.
          * @param scanId - sets which scene is used, e.g. "2t7WUuJeko7"
@@ -198,6 +328,113 @@ namespace mattersim {
         void newEpisode(const std::vector<std::string>& scanId, const std::vector<std::string>& viewpointId,
               const std::vector<double>& heading, const std::vector<double>& elevation);
 
+        /**
+         * Starts a new episode from integer handles, without any string lookups.
+         * @param scanHandle - scan handles returned by scanHandle()
+         * @param viewpointIx - viewpoint indices into the scan's navigation graph, as in Viewpoint::ix
+         *                      or returned by viewpointIndex()
+         * @param heading, elevation - as for newEpisode with string ids
+         */
+        void newEpisode(const std::vector<unsigned int>& scanHandle, const std::vector<unsigned int>& viewpointIx,
+              const std::vector<double>& heading, const std::vector<double>& elevation);
+
+        /**
+         * Starts new episodes in some environments, leaving the rest of the batch unchanged, e.g. when
+         * episodes finish at different times. Only these environments are rendered.
+         * @param envIndex - environments to reset
+         * @param scanId, viewpointId, heading, elevation - new episode of each environment, as for newEpisode
+         */
+        void resetEnvs(const std::vector<unsigned int>& envIndex, const std::vector<std::string>& scanId,
+              const std::vector<std::string>& viewpointId, const std::vector<double>& heading,
+              const std::vector<double>& elevation);
+        void resetEnvs(const std::vector<unsigned int>& envIndex, const std::vector<unsigned int>& scanHandle,
+              const std::vector<unsigned int>& viewpointIx, const std::vector<double>& heading,
+              const std::vector<double>& elevation);
+
+        /**
+         * Interned integer handle of a scan, e.g. "2t7WUuJeko7". Handles are stable for the lifetime
+         * of the process, so they can be looked up once and reused for every episode.
+         */
+        unsigned int scanHandle(const std::string& scanId);
+
+        /**
+         * Index of a viewpoint in its scan's navigation graph, as in Viewpoint::ix
+         */
+        unsigned int viewpointIndex(unsigned int scanHandle, const std::string& viewpointId);
+
+        /**
+         * Indices of a batch of viewpoints in their scans' navigation graphs, as in Viewpoint::ix. 
+         * Each lookup takes constant time, so this is suitable for validating many trajectories.
+         * @param scanId - scan of each viewpoint, e.g. "2t7WUuJeko7"
+         * @param viewpointId - viewpoints to look up
+         * @throws std::invalid_argument if any viewpoint is not in its scan or is excluded
+         */
+        std::vector<unsigned int> viewpointIndices(const std::vector<std::string>& scanId,
+              const std::vector<std::string>& viewpointId);
+
+        /**
+         * Geodesic distances in metres along the navigation graph between pairs of viewpoints, or
+         * infinity where there is no path. Shortest paths are computed natively for each scan the first
+         * time it is queried, and cached on disk next to the connectivity graphs, after which each 
+         * query takes constant time.
+         * @param scanHandle - scan of each pair, as returned by scanHandle()
+         * @param from, to - viewpoint indices, as in Viewpoint::ix
+         */
+        std::vector<float> shortestPathDistances(const std::vector<unsigned int>& scanHandle,
+              const std::vector<unsigned int>& from, const std::vector<unsigned int>& to);
+        std::vector<float> shortestPathDistances(const std::vector<std::string>& scanId,
+              const std::vector<std::string>& from, const std::vector<std::string>& to);
+
+        /**
+         * First viewpoint after 'from' on a shortest path to 'to' for pairs of viewpoints. This is 
+         * 'from' itself if the viewpoints are the same, and mattersim::noNextHop (or an empty
+         * viewpointId) if there is no path.
+         */
+        std::vector<unsigned int> shortestPathNextHops(const std::vector<unsigned int>& scanHandle,
+              const std::vector<unsigned int>& from, const std::vector<unsigned int>& to);
+        std::vector<std::string> shortestPathNextHops(const std::vector<std::string>& scanId,
+              const std::vector<std::string>& from, const std::vector<std::string>& to);
+
+        /**
+         * ViewpointIds along a shortest path, including both ends, or empty if there is no path
+         */
+        std::vector<std::string> shortestPath(const std::string& scanId, const std::string& from,
+              const std::string& to);
+
+        /**
+         * Teacher actions that follow a shortest path from each environment's current state to a
+         * goal viewpoint, as in R2RBatch._shortest_path_action. If the next viewpoint on the path 
+         * is navigable the camera first turns towards it (by 30 degrees whenever it is more than
+         * 30 degrees away) and then moves there; otherwise the camera levels out and turns towards
+         * it. All changes are zero at the goal. Turns are the size of one discretized step, which
+         * also applies with continuous viewing angles, where levelling out returns the camera 
+         * exactly to the horizon. The camera doesn't tilt where the elevation limits stop it.
+         * @param goalViewpointIx - goal viewpoint index for each environment, as in Viewpoint::ix
+         * @throws std::invalid_argument if a goal can't be reached from the current viewpoint
+         */
+        Actions shortestPathActions(const std::vector<unsigned int>& goalViewpointIx);
+        Actions shortestPathActions(const std::vector<std::string>& goalViewpointId);
+
+        /**
+         * Nearest viewpoints to a batch of points in world coordinates, e.g. to snap the positions of
+         * agents moving continuously to the navigation graph. Each scan has a kd-tree of its camera
+         * positions, so each query takes logarithmic time.
+         * @param scanHandle - scan of each point, as returned by scanHandle()
+         * @param x, y, z - coordinates of each point
+         * @return viewpoint indices, as in Viewpoint::ix
+         */
+        std::vector<unsigned int> nearestViewpoints(const std::vector<unsigned int>& scanHandle,
+              const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z);
+
+        /**
+         * Viewpoints within a radius of each of a batch of points in world coordinates, nearest first
+         * @param radius - in metres
+         * @return viewpoint indices for each point, as in Viewpoint::ix
+         */
+        std::vector<std::vector<unsigned int> > viewpointsWithin(const std::vector<unsigned int>& scanHandle,
+              const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z,
+              double radius);
+
         /**
          * Starts a new episode at a random viewpoint.
          * @param scanId - sets which scene is used, e.g. "2t7WUuJeko7" 
@@ -209,6 +446,12 @@ namespace mattersim {
          */
         const std::vector<SimStatePtr>& getState();
 
+        /**
+         * Returns the states of the active environments, in batch order, e.g. to skip finished episodes.
+         * @param active - a flag for each environment in the batch
+         */
+        std::vector<SimStatePtr> getState(const std::vector<bool>& active);
+
         /** @brief Select an action.
          *
          * An RL agent will sample an action here. A task-specific reward can be determined
@@ -222,6 +465,85 @@ namespace mattersim {
         void makeAction(const std::vector<unsigned int>& index, const std::vector<double>& heading, 
                         const std::vector<double>& elevation);
 
+        /**
+         * Select an action in the active environments only. Inactive environments, e.g. whose episodes
+         * have finished, are skipped entirely: their actions are ignored, and their states (including 
+         * step) are left as they are without finding navigable locations or rendering.
+         * @param active - a flag for each environment in the batch
+         */
+        void makeAction(const std::vector<unsigned int>& index, const std::vector<double>& heading, 
+                        const std::vector<double>& elevation, const std::vector<bool>& active);
+
+        /**
+         * Take a sequence of actions in each environment without returning between steps, e.g. to replay
+         * trajectories. Environments whose actions run out are left as they are, as if inactive in 
+         * makeAction, until every sequence is done.
+         * @param index, heading, elevation - actions of each environment, one entry per step
+         * @param log - if given, is filled with the poses (and images) of every step
+         * @throws std::domain_error if an action index is invalid, leaving the batch at that step
+         */
+        void executeSequence(const std::vector<std::vector<unsigned int> >& index,
+                        const std::vector<std::vector<double> >& heading,
+                        const std::vector<std::vector<double> >& elevation);
+        void executeSequence(const std::vector<std::vector<unsigned int> >& index,
+                        const std::vector<std::vector<double> >& heading,
+                        const std::vector<std::vector<double> >& elevation, TrajectoryLog& log);
+
+        /**
+         * Move along a path of viewpoints in each environment without returning between steps, taking
+         * the actions of shortestPathActions towards each viewpoint in turn. Viewpoints the agent is 
+         * already at are skipped, so paths may begin with the current viewpoint as in R2R.
+         * @param viewpointIx - viewpoint indices to visit in each environment, as in Viewpoint::ix
+         * @param log - if given, is filled with the poses (and images) of every step
+         * @throws std::invalid_argument if a viewpoint can't be reached from the one before it
+         * @throws std::runtime_error if the actions don't reach a viewpoint, e.g. because it never comes
+         *         into a narrow field of view, leaving the batch at that step
+         */
+        void executePath(const std::vector<std::vector<unsigned int> >& viewpointIx);
+        void executePath(const std::vector<std::vector<unsigned int> >& viewpointIx, TrajectoryLog& log);
+        void executePath(const std::vector<std::vector<std::string> >& viewpointId);
+        void executePath(const std::vector<std::vector<std::string> >& viewpointId, TrajectoryLog& log);
+
+        /**
+         * Observe the states that actions would lead to without taking them, e.g. to score every
+         * navigable location before moving. Each observation is rendered (with its images read from the
+         * texture cache like any other frame) and has its own navigable locations, but the batch's states
+         * are left unchanged.
+         * @param envIndex - environment of each observation, which may repeat
+         * @param index, heading, elevation - action of each observation, as for makeAction
+         * @return a new state for each observation
+         */
+        std::vector<SimStatePtr> peek(const std::vector<unsigned int>& envIndex, const std::vector<unsigned int>& index,
+                        const std::vector<double>& heading, const std::vector<double>& elevation);
+
+        /**
+         * Copy the states of the batch, or of some environments, e.g. to branch for beam search or
+         * lookahead. Copies are cheap: they share the rendered images and navigable locations with the
+         * simulator until an environment next changes, when it gets new storage instead of overwriting
+         * them. Copies are never changed by the simulator.
+         * @param envIndex - environments to copy, default is the whole batch
+         */
+        std::vector<SimStatePtr> snapshot();
+        std::vector<SimStatePtr> snapshot(const std::vector<unsigned int>& envIndex);
+
+        /**
+         * Return environments to copied states without rendering or finding navigable locations again.
+         * The states in getState() are updated in place, and keep sharing storage with the copies until
+         * they next change.
+         * @param envIndex - environments to restore, default is the whole batch
+         * @param snapshot - a state for each environment, from snapshot() or getState()
+         * @throws std::invalid_argument if a state has no location or was rendered at another resolution
+         */
+        void restore(const std::vector<SimStatePtr>& snapshot);
+        void restore(const std::vector<unsigned int>& envIndex, const std::vector<SimStatePtr>& snapshot);
+
+        /**
+         * Copy the state of one environment into the k environments after it, e.g. to expand a beam
+         * that occupies consecutive environments. Equivalent to restoring a snapshot of the environment.
+         * @throws std::out_of_range if there are fewer than k environments after it
+         */
+        void fork(unsigned int envIndex, unsigned int k);
+
         /**
          * Closes the environment and releases underlying texture resources, OpenGL contexts, etc.
          */
@@ -237,12 +559,36 @@ namespace mattersim {
          */
         std::string timingInfo(); 
 
+        /**
+         * Return the texture cache hit, miss and eviction counters.
+         */
+        CacheStats cacheStats();
+
     private:
-        const int headingCount = 12; // 12 heading values in discretized views
-        const double elevationIncrement = M_PI/6.0; // 30 degrees discretized up/down
-        void populateNavigable();
-        void setHeadingElevation(const std::vector<double>& heading, const std::vector<double>& elevation);
-        void renderScene();
+        const int parallelBatchSize = 64; // larger batches update navigable locations in parallel
+        void resetNavigator();
+        void update(const std::vector<bool>& changed);
+        bool teacherAction(const SimState& state, unsigned int goal, NavGraph& navGraph, unsigned int& index,
+                double& heading, double& elevation) const;
+        void runSequence(const std::vector<std::vector<unsigned int> >& index,
+                const std::vector<std::vector<double> >& heading,
+                const std::vector<std::vector<double> >& elevation, TrajectoryLog* log);
+        void runPath(const std::vector<std::vector<unsigned int> >& viewpointIx, TrajectoryLog* log);
+        void execute(const std::function<bool(unsigned int, unsigned int&, double&, double&)>& nextAction,
+                size_t maxSteps, TrajectoryLog* log);
+        std::vector<std::vector<unsigned int> > pathIndices(
+                const std::vector<std::vector<std::string> >& viewpointId);
+        void populateNavigable(SimState& state, const NavGraph& navGraph) const;
+        std::vector<unsigned int> scanHandles(const std::vector<std::string>& scanId, NavGraph& navGraph) const;
+        std::vector<glm::vec3> points(const std::vector<double>& x, const std::vector<double>& y,
+                const std::vector<double>& z) const;
+        void setHeadingElevation(SimState& state, double heading, double elevation) const;
+        void startEpisode(SimState& state, unsigned int scanHandle, unsigned int ix, double heading,
+                double elevation, NavGraph& navGraph) const;
+        void renderScene(const std::vector<SimStatePtr>& targets);
+        void unshareImages(unsigned int envIndex);
+        glm::mat4 modelView(const SimStatePtr& state, NavGraph& navGraph);
+        unsigned char visibleFaces(const glm::mat4& modelView) const;
 #ifdef OSMESA_RENDERING
         void *buffer;
         OSMesaContext ctx;
@@ -253,16 +599,27 @@ namespace mattersim {
         GLuint FramebufferName;
 #endif
         std::vector<SimStatePtr> states;
+        std::unordered_map<const SimState*, unsigned int> envIndices; // position of each state in the batch
+        std::vector<bool> sharedImages; // images still referenced by a copy, so the next frame needs new ones
+        std::unique_ptr<Navigator> navigator;
         bool initialized;
         bool renderingEnabled;
         bool discretizeViews;
         bool restrictedNavigation;
         bool preloadImages;
         bool renderDepth;
+        bool lazyLoading;
+        bool deadlineMode;
+        bool backgroundUpload;
+        bool candidateTablesEnabled;
         int width;
         int height;
         int randomSeed;
         unsigned int cacheSize;
+        CachePolicy cachePolicy;
+        size_t cacheCapacity;
+        unsigned int minFaceSize;
+        unsigned int lowResFaceSize;
         unsigned int batchSize;
         double vfov;
         double minElevation;
@@ -284,6 +641,7 @@ namespace mattersim {
         GLuint glShaderF;
         std::string datasetPath;
         std::string navGraphPath;
+        std::unique_ptr<TextureUploader> uploader;
         Timer preloadTimer; // Preloading images from disk into cpu memory
         Timer loadTimer; // Loading textures from disk or cpu memory onto gpu
         Timer renderTimer; // Rendering time
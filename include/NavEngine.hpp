@@ -0,0 +1,172 @@
+#ifndef NAV_ENGINE_HPP
+#define NAV_ENGINE_HPP
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "NavGraph.hpp"
+#include "Navigator.hpp"
+
+namespace mattersim {
+
+    //! Viewpoint index of the padding after an environment's last candidate
+    const unsigned int noCandidate = 0xFFFFFFFF;
+
+    /**
+     * State of a batch of NavEngine environments as parallel arrays, with one entry per environment.
+     * Candidates are padded to maxCandidates entries per environment, so candidate k of environment n
+     * is at n*maxCandidates + k. Candidate 0 is always to remain at the current viewpoint, and the
+     * remaining candidates are in the same order as SimState::navigableLocations.
+     */
+    struct NavBatchState {
+        //! Scan handle, see Simulator::scanHandle
+        std::vector<unsigned int> scanHandle;
+        //! Current viewpoint index, as in Viewpoint::ix
+        std::vector<unsigned int> ix;
+        //! Camera heading in radians
+        std::vector<double> heading;
+        //! Camera elevation in radians
+        std::vector<double> elevation;
+        //! View [0-35] (set only when viewing angles are discretized)
+        std::vector<unsigned int> viewIndex;
+        //! Number of steps since the last reset
+        std::vector<unsigned int> step;
+        //! Number of candidate entries per environment
+        unsigned int maxCandidates = 0;
+        //! Number of valid candidates of each environment
+        std::vector<unsigned int> candidateCount;
+        //! Viewpoint index of each candidate, noCandidate in the padding
+        std::vector<unsigned int> candidateIx;
+        //! Distance of each candidate from the agent, 0 in the padding
+        std::vector<float> candidateDistance;
+        //! Heading of each candidate relative to the camera, 0 in the padding
+        std::vector<double> candidateHeading;
+        //! Elevation of each candidate relative to the camera, 0 in the padding
+        std::vector<double> candidateElevation;
+    };
+
+
+    /**
+     * Headless navigation-only counterpart of Simulator for very large batches, e.g. for agents that use
+     * precomputed image features, or for search. There is no rendering and no per-environment object:
+     * the state is kept in flat arrays that are allocated once by initialize(), and actions only use
+     * integer handles. Navigation follows exactly the same rules as Simulator with the same settings.
+     */
+    class NavEngine {
+
+    public:
+        NavEngine();
+
+        /**
+         * Set a non-standard path to the viewpoint connectivity graphs, see Simulator::setNavGraphPath
+         */
+        void setNavGraphPath(const std::string& path);
+
+        /**
+         * Sets the camera resolution, whose aspect ratio determines the horizontal field of view used
+         * by restricted navigation. Default is 320 x 240.
+         */
+        void setCameraResolution(int width, int height);
+
+        /**
+         * Sets camera vertical field-of-view in radians. Default is 0.8, approx 46 degrees.
+         */
+        void setCameraVFOV(double vfov);
+
+        /**
+         * Set the camera elevation min and max limits in radians. Default is +-0.94 radians.
+         * @return true if successful.
+         */
+        bool setElevationLimits(double min, double max);
+
+        /**
+         * Enable or disable discretized viewing angles, see Simulator::setDiscretizedViewingAngles.
+         * Default is false (disabled).
+         */
+        void setDiscretizedViewingAngles(bool value);
+
+        /**
+         * Enable or disable restricted navigation, see Simulator::setRestrictedNavigation. Default is
+         * true (enabled).
+         */
+        void setRestrictedNavigation(bool value);
+
+        /**
+         * Enable or disable candidate tables, see Simulator::setCandidateTablesEnabled. Default is
+         * false (disabled).
+         */
+        void setCandidateTablesEnabled(bool value);
+
+        /**
+         * Set the number of environments in the batch. Default is 1.
+         */
+        void setBatchSize(unsigned int size);
+
+        /**
+         * Set the number of candidate entries per environment. Environments with more navigable locations
+         * only keep the first maxCandidates, i.e. those closest to the centre of the image. Default is 0,
+         * which allows for every reachable viewpoint of the largest scan (this loads every scan's graph).
+         */
+        void setMaxCandidates(unsigned int count);
+
+        /**
+         * Initialize the engine and allocate the state of the batch. Further configuration won't take
+         * any effect from now on.
+         */
+        void initialize();
+
+        /**
+         * Interned integer handle of a scan, see Simulator::scanHandle
+         */
+        unsigned int scanHandle(const std::string& scanId);
+
+        /**
+         * Index of a viewpoint in its scan's navigation graph, see Simulator::viewpointIndex
+         */
+        unsigned int viewpointIndex(unsigned int scanHandle, const std::string& viewpointId);
+
+        /**
+         * Start new episodes in every environment, as in Simulator::newEpisode with integer handles
+         * @throws std::invalid_argument if the arguments don't have an entry for each environment, or a
+         *         viewpoint is excluded from the graph
+         */
+        void reset(const std::vector<unsigned int>& scanHandle, const std::vector<unsigned int>& viewpointIx,
+              const std::vector<double>& heading, const std::vector<double>& elevation);
+
+        /**
+         * Take an action in every environment, as in Simulator::makeAction
+         * @param index - index of each environment's next viewpoint among its candidates
+         * @throws std::domain_error if an index is not a valid candidate, in which case no environment moves
+         */
+        void step(const std::vector<unsigned int>& index, const std::vector<double>& heading,
+              const std::vector<double>& elevation);
+
+        /**
+         * Returns the state of the batch. The arrays are allocated by initialize(), and are updated in
+         * place by reset and step.
+         */
+        const NavBatchState& getState() const;
+
+    private:
+        const int parallelBatchSize = 64; // larger batches are split across threads
+        NavGraph& navGraph();
+        void updateCandidates(unsigned int n, const NavGraph& navGraph);
+        NavBatchState state;
+        std::unique_ptr<Navigator> navigator;
+        bool initialized;
+        bool discretizeViews;
+        bool restrictedNavigation;
+        bool candidateTablesEnabled;
+        int width;
+        int height;
+        unsigned int batchSize;
+        unsigned int maxCandidates;
+        double vfov;
+        double minElevation;
+        double maxElevation;
+        std::string navGraphPath;
+    };
+}
+
+#endif
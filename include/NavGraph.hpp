@@ -4,6 +4,9 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <set>
+#include <mutex>
+#include <future>
 #include <random>
 #include <cmath>
 #include <sstream>
@@ -28,6 +31,13 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "TextureUploader.hpp"
+#include "TextureCache.hpp"
+#include "NavGraphFile.hpp"
+#include "ShortestPaths.hpp"
+#include "SpatialIndex.hpp"
+#include "Span.hpp"
+
 namespace mattersim {
 
     static void assertOpenGLError(const std::string& msg) {
@@ -59,8 +69,7 @@ namespace mattersim {
 
     private:
 
-        NavGraph(const std::string& navGraphPath, const std::string& datasetPath, 
-                bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize);
+        NavGraph(const std::string& navGraphPath);
 
         ~NavGraph();
 
@@ -73,57 +82,300 @@ namespace mattersim {
         NavGraph& operator=(NavGraph&&) = delete;
 
         /**
-         * First call will load the navigation graph from disk and (optionally) preload the 
-         * cubemap images into memory.
+         * Get the navigation graph without configuring images, for callers that never load them. The 
+         * first call opens the navigation graph. Each scan's graph is only loaded when it is first used,
+         * from the compiled index in the navGraphPath directory if there is one, or else from its json file.
+         * @param navGraphPath - directory containing json viewpoint connectivity graphs
+         * @throws std::invalid_argument if the graph was already opened from a different navGraphPath
+         */
+        static NavGraph& getInstance(const std::string& navGraphPath);
+
+        /**
+         * Get the navigation graph, and configure images the first time this is called. The first 
+         * call may (optionally) preload the cubemap images into memory. Later calls must use the same
+         * paths, but the other settings of the first call are kept.
          * @param navGraphPath - directory containing json viewpoint connectivity graphs
          * @param datasetPath - directory containing a data directory for each Matterport scan id
          * @param preloadImages - if true, all cubemap images will be loaded into CPU memory immediately
          * @param renderDepth - if true, depth map images are also required
          * @param randomSeed - only used for randomViewpoint function
-         * @param cacheSize - number of pano textures to keep in GPU memory
+         * @param cacheSize - number of pano textures to keep in GPU memory, if cacheCapacity is 0
+         * @param cachePolicy - texture cache eviction policy
+         * @param cacheCapacity - GPU memory in bytes for caching pano textures, or 0 to size the
+         *                        cache to hold cacheSize textures of the average size measured
+         * @throws std::invalid_argument if the graph or images were already opened from different paths
          */
         static NavGraph& getInstance(const std::string& navGraphPath, const std::string& datasetPath, 
-                bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize);
+                bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize,
+                CachePolicy cachePolicy, size_t cacheCapacity);
   
+        /**
+         * Interned integer handle of a scan, which is its position in scans.txt. Methods taking a scan
+         * handle avoid looking up the scanId string, the string versions are thin wrappers.
+         * @throws std::invalid_argument if the scan is not listed in scans.txt
+         */
+        unsigned int scanHandle(const std::string& scanId) const;
+
+        /**
+         * ScanId of a scan handle
+         */
+        const std::string& scanId(unsigned int scan) const;
+
+        /**
+         * Number of scans listed in scans.txt, so scan handles are less than this
+         */
+        unsigned int scanCount() const;
+
+        /**
+         * Number of viewpoints in a scan, including excluded ones
+         */
+        unsigned int viewpointCount(unsigned int scan) const;
+
         /**
          * Select a random viewpoint from a scan
          */
         const std::string& randomViewpoint(const std::string& scanId);
+
+        /**
+         * Select the index of a random viewpoint from a scan
+         */
+        unsigned int randomViewpointIndex(unsigned int scan);
                       
         /**
-         * Find the index of a selected viewpointId
+         * Find the index of a selected viewpointId, using a hash index of the scan's viewpoints
+         * @throws std::invalid_argument if the viewpoint is not in the scan or is excluded
          */
         unsigned int index(const std::string& scanId, const std::string& viewpointId) const;
+        unsigned int index(unsigned int scan, const std::string& viewpointId) const;
+
+        /**
+         * Find the indices of a batch of viewpointIds
+         * @param scans - scan handle of each viewpoint
+         * @throws std::invalid_argument if any viewpoint is not in its scan or is excluded
+         */
+        std::vector<unsigned int> index(const std::vector<unsigned int>& scans, 
+                const std::vector<std::string>& viewpointIds) const;
+
+        /**
+         * True unless the viewpoint is a duplicate that was excluded from the graph
+         */
+        bool included(unsigned int scan, unsigned int ix) const;
 
         /**
          * ViewpointId of a selected viewpoint index
          */
         const std::string& viewpoint(const std::string& scanId, unsigned int ix) const;
+        const std::string& viewpoint(unsigned int scan, unsigned int ix) const;
 
         /**
          * Camera rotation matrix for a selected viewpoint index
          */
         const glm::mat4& cameraRotation(const std::string& scanId, unsigned int ix) const;
+        const glm::mat4& cameraRotation(unsigned int scan, unsigned int ix) const;
 
         /**
          * Camera position vector for a selected viewpoint index
          */
         const glm::vec3& cameraPosition(const std::string& scanId, unsigned int ix) const;
+        const glm::vec3& cameraPosition(unsigned int scan, unsigned int ix) const;
+
+        /**
+         * Camera positions of all the viewpoints in a scan, by viewpoint index
+         */
+        Span<glm::vec3> cameraPositions(unsigned int scan) const;
 
         /**
          * Return a list of other viewpoint indices that are reachable from a selected viewpoint index
          */
         std::vector<unsigned int> adjacentViewpointIndices(const std::string& scanId, unsigned int ix) const;
+        std::vector<unsigned int> adjacentViewpointIndices(unsigned int scan, unsigned int ix) const;
+
+        /**
+         * Other viewpoint indices that are reachable from a selected viewpoint index, in ascending order.
+         * The span points into the graph's adjacency lists, so this takes constant time and doesn't allocate.
+         */
+        Span<unsigned int> adjacentViewpoints(unsigned int scan, unsigned int ix) const;
+
+        /**
+         * Direction and distance from a viewpoint to each of its reachable viewpoints, which only depend on
+         * the graph and are computed when it is loaded
+         */
+        struct NeighbourBearings {
+            Span<unsigned int> viewpoints; //! Reachable viewpoint indices, sorted by bearing
+            Span<double> bearings;         //! Heading from the y-axis (turning right is positive), in [0, 2pi)
+            Span<double> elevations;       //! Elevation above the horizon defined by the x-y plane
+            Span<float> distances;         //! Euclidean distance
+        };
+
+        /**
+         * Bearings of the viewpoints reachable from a selected viewpoint index. Viewpoints within an 
+         * angular window of the camera heading can then be found with a binary search.
+         */
+        NeighbourBearings neighbourBearings(unsigned int scan, unsigned int ix) const;
+
+        /**
+         * Nearest included viewpoint to a point in world coordinates. Each scan has a kd-tree of its 
+         * camera positions, which is built when its graph is loaded.
+         * @throws std::runtime_error if the scan has no included viewpoints
+         */
+        unsigned int nearestViewpoint(unsigned int scan, const glm::vec3& point) const;
+
+        /**
+         * Nearest included viewpoints to a batch of points
+         * @param scans - scan handle of each point
+         */
+        std::vector<unsigned int> nearestViewpoints(const std::vector<unsigned int>& scans,
+                const std::vector<glm::vec3>& points) const;
+
+        /**
+         * Included viewpoints within a radius in metres of a point, nearest first
+         */
+        std::vector<unsigned int> viewpointsWithin(unsigned int scan, const glm::vec3& point, double radius) const;
+
+        /**
+         * Included viewpoints within a radius in metres of each of a batch of points, nearest first
+         * @param scans - scan handle of each point
+         */
+        std::vector<std::vector<unsigned int> > viewpointsWithin(const std::vector<unsigned int>& scans,
+                const std::vector<glm::vec3>& points, double radius) const;
+
+        /**
+         * Geodesic distance in metres between two viewpoint indices along the navigation graph, or 
+         * infinity if there is no path. Shortest paths between all pairs of viewpoints in a scan are 
+         * computed the first time they are needed, and cached on disk next to the connectivity files.
+         */
+        float distance(unsigned int scan, unsigned int from, unsigned int to) const;
+
+        /**
+         * First viewpoint index after 'from' on a shortest path to 'to', 'from' itself if they are
+         * the same, or noNextHop if there is no path
+         */
+        unsigned int nextHop(unsigned int scan, unsigned int from, unsigned int to) const;
+
+        /**
+         * Geodesic distances and next hops for a batch of viewpoint pairs
+         * @param scans - scan handle of each pair
+         */
+        std::vector<float> distances(const std::vector<unsigned int>& scans, 
+                const std::vector<unsigned int>& from, const std::vector<unsigned int>& to) const;
+        std::vector<unsigned int> nextHops(const std::vector<unsigned int>& scans, 
+                const std::vector<unsigned int>& from, const std::vector<unsigned int>& to) const;
+
+        /**
+         * Viewpoint indices along a shortest path, including both ends, or empty if there is no path
+         */
+        std::vector<unsigned int> shortestPath(unsigned int scan, unsigned int from, unsigned int to) const;
+
+        /**
+         * All-pairs shortest paths of a scan, reading or computing them if necessary. Lookups in the
+         * result are unchecked, which suits code that queries every pair. Safe to call from several threads.
+         */
+        const ShortestPaths& shortestPaths(unsigned int scan) const;
 
         /**
          * Get cubemap RGB (and optionally, depth) textures for a selected viewpoint index
+         * @param faceMask - bitmask of the cubemap faces that must be loaded, other faces
+         *                   may be left uninitialized until they are requested
+         * @param minFaceSize - minimum RGB face resolution needed by the camera (0 for full resolution),
+         *                      images are decoded at a reduced scale when this allows
          */
-        std::pair<GLuint, GLuint> cubemapTextures(const std::string& scanId, unsigned int ix);
+        std::pair<GLuint, GLuint> cubemapTextures(const std::string& scanId, unsigned int ix,
+                unsigned char faceMask = 0x3F, unsigned int minFaceSize = 0);
+        std::pair<GLuint, GLuint> cubemapTextures(unsigned int scan, unsigned int ix,
+                unsigned char faceMask = 0x3F, unsigned int minFaceSize = 0);
+
+        /**
+         * Start uploading cubemap textures for a batch of viewpoints through a TextureUploader, so that
+         * uploads for later viewpoints can continue while earlier ones are rendered. Images must 
+         * already be in CPU memory. The viewpoints are first marked as used in the texture cache, which 
+         * must be larger than the batch.
+         * @param faceMasks - bitmask of the cubemap faces required for each viewpoint
+         * @param minFaceSize - minimum RGB face resolution required (0 for full resolution)
+         * @return for each viewpoint, a future that is ready once cubemapTextures can be called 
+         *         without uploading
+         */
+        std::vector<std::shared_future<void> > uploadCubemapTextures(const std::vector<unsigned int>& scans,
+                const std::vector<unsigned int>& ixs, const std::vector<unsigned char>& faceMasks, 
+                unsigned int minFaceSize, TextureUploader& uploader);
+
+        /**
+         * Load cubemap images for a batch of viewpoints into CPU memory (if they are not already loaded).
+         * All the file reads are submitted together, and images are decoded in parallel as data arrives.
+         * @param scans, ixs - scan handles and viewpoint indices
+         * @param faceMasks - bitmask of the cubemap faces required for each viewpoint
+         * @param minFaceSize - minimum RGB face resolution required (0 for full resolution). Images 
+         *                      already loaded at a lower resolution are decoded again.
+         */
+        void loadCubemapImages(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+                const std::vector<unsigned char>& faceMasks, unsigned int minFaceSize);
+
+        /**
+         * Preload the cubemap images that a known workload is likely to touch into CPU memory. Each 
+         * given viewpoint, and its neighbourhood up to a number of hops away in the navigation graph, 
+         * is prioritized by how often it occurs (neighbours contributing half as much per hop). The 
+         * highest priority viewpoints are then loaded in parallel batches until the memory budget is used.
+         * @param scans, ixs - viewpoints visited by the workload, repeated entries raise their priority
+         * @param hops - size of the neighbourhood to include around each viewpoint
+         * @param memoryBudget - maximum CPU memory in bytes to use for the images loaded by this call
+         * @param minFaceSize - minimum RGB face resolution required (0 for full resolution)
+         * @return number of viewpoints loaded, not counting those that were already in memory
+         */
+        unsigned int warmCache(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+                unsigned int hops, size_t memoryBudget, unsigned int minFaceSize);
+
+        /**
+         * True if the images needed for the faces in faceMask are already in CPU memory at no less than
+         * minFaceSize, so that cubemapTextures will not need to wait for disk reads
+         */
+        bool cubemapImagesLoaded(unsigned int scan, unsigned int ix, unsigned char faceMask, 
+                unsigned int minFaceSize) const;
+
+        /**
+         * Start loading cubemap images for a batch of viewpoints on a background thread and return
+         * immediately. Requests made while a previous batch is still loading are ignored.
+         * @throws any error from the previous background load
+         */
+        void loadCubemapImagesAsync(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+                const std::vector<unsigned char>& faceMasks, unsigned int minFaceSize);
+
+        /**
+         * Load a low resolution cubemap of every viewpoint in a scan onto the GPU. These textures are
+         * kept resident outside of the texture cache. Does nothing if the scan is already loaded.
+         * @param faceSize - face resolution of the low resolution cubemaps
+         */
+        void loadLowResolutionTextures(unsigned int scan, unsigned int faceSize);
+
+        /**
+         * Start reading and decoding the low resolution cubemaps of a scan on a background thread and
+         * return immediately. Does nothing if the scan is already loaded or loading. Poll with
+         * lowResolutionTexturesLoaded.
+         * @param faceSize - face resolution of the low resolution cubemaps
+         */
+        void loadLowResolutionTexturesAsync(unsigned int scan, unsigned int faceSize);
+
+        /**
+         * True if the low resolution textures of a scan are ready to use. When a background load has 
+         * just finished, the textures are created from the calling thread, which must own the OpenGL context.
+         * @throws any error from the background load
+         */
+        bool lowResolutionTexturesLoaded(unsigned int scan);
+
+        /**
+         * Get the low resolution cubemap RGB (and optionally, depth) textures for a selected viewpoint 
+         * index. loadLowResolutionTextures must have been called for the scan.
+         */
+        std::pair<GLuint, GLuint> lowResolutionTextures(unsigned int scan, unsigned int ix);
 
         /**
          * Free GPU memory associated with this viewpoint's textures
          */
         void deleteCubemapTextures(const std::string& scanId, unsigned int ix);
+        void deleteCubemapTextures(unsigned int scan, unsigned int ix);
+
+        /**
+         * Texture cache hit, miss and eviction counters
+         */
+        const CacheStats& cacheStats() const;
 
 
     protected:
@@ -135,113 +387,183 @@ namespace mattersim {
 
         public:
             /**
-             * Construct a location object from a json struct
-             * @param viewpoint - json struct
+             * Construct a location object
+             * @param viewpointId - Matterport identifier of the pano
              * @param skyboxDir - directory containing a data directory for each Matterport scan id
              * @param preload - if true, all cubemap images will be loaded into CPU memory immediately
              * @param depth - if true, depth textures will also be provided
              */
-            Location(const Json::Value& viewpoint, const std::string& skyboxDir, bool preload, bool depth);
+            Location(const std::string& viewpointId, const std::string& skyboxDir, bool preload,
+                    bool depth);
 
             Location() = delete; // no default constructor
 
             /**
              * Return the cubemap RGB (and optionally, depth) textures for this viewpoint, which will 
              * be loaded from CPU memory or disk if necessary
+             * @param faceMask - bitmask of the cubemap faces that must be loaded
+             * @param minFaceSize - minimum RGB face resolution required (0 for full resolution)
              */
-            std::pair<GLuint, GLuint> cubemapTextures();
+            std::pair<GLuint, GLuint> cubemapTextures(unsigned char faceMask, unsigned int minFaceSize);
 
             /**
              * Free GPU memory associated with RGB and depth textures at this location
              */
             void deleteCubemapTextures();
 
+            /**
+             * True if textures with the faces in faceMask are already in GPU memory at no less than minFaceSize
+             */
+            bool cubemapTexturesLoaded(unsigned char faceMask, unsigned int minFaceSize) const;
+
+            /**
+             * GPU memory in bytes allocated for the RGB and depth textures at this location, or that 
+             * will be allocated when they are created from the images already in CPU memory
+             */
+            size_t textureBytes() const;
+
+            /**
+             * Return the RGB and depth skybox image files that must be read from disk to provide 
+             * the faces in faceMask at no less than minFaceSize. Filenames are empty if the images are 
+             * already in CPU memory.
+             */
+            std::pair<std::string, std::string> missingImageFiles(unsigned char faceMask, 
+                    unsigned int minFaceSize) const;
+
+            /**
+             * Decode the contents of an RGB skybox image file into CPU memory. If the faces already 
+             * loaded are smaller than minFaceSize, they are all decoded again at the larger size.
+             * @param faceMask - bitmask of the cubemap faces required
+             * @param minFaceSize - minimum face resolution required (0 for full resolution)
+             */
+            void decodeCubemapImages(unsigned char faceMask, unsigned int minFaceSize, 
+                    const std::vector<unsigned char>& data);
+
+            /**
+             * Decode the contents of a depth skybox image file into CPU memory
+             */
+            void decodeDepthImages(const std::vector<unsigned char>& data);
+
+            /**
+             * CPU memory in bytes used by the decoded RGB and depth images at this location
+             */
+            size_t imageBytes() const;
+
+            /**
+             * Return the RGB and depth skybox image files that must be read from disk to provide the
+             * low resolution cubemap. Filenames are empty if it is already loaded.
+             */
+            std::pair<std::string, std::string> missingLowResolutionFiles() const;
+
+            /**
+             * Decode a low resolution copy of the contents of an RGB or depth skybox image file
+             * @param faceSize - faces larger than this are downsampled
+             */
+            void decodeLowResolutionImages(const std::vector<unsigned char>& data, bool depth, 
+                    unsigned int faceSize);
+
+            /**
+             * Return the low resolution cubemap RGB (and optionally, depth) textures for this viewpoint,
+             * which are created from the decoded images the first time
+             */
+            std::pair<GLuint, GLuint> lowResolutionTextures();
+
+            /**
+             * Free GPU memory associated with the low resolution textures at this location
+             */
+            void deleteLowResolutionTextures();
+
             std::string viewpointId;        //! Unique Matterport identifier for every pano
-            bool included;                  //! Some duplicated viewpoints have been excluded
-            glm::mat4 rot;                  //! Camera pose rotation component
-            glm::vec3 pos;                  //! Camera pose translation component
-            std::vector<bool> unobstructed; //! Connections to other graph locations
 
         protected:
 
             /**
              * Load RGB (and optionally, depth) cubemap images from disk into CPU memory
+             * @param faceMask - bitmask of the cubemap faces to load
+             * @param minFaceSize - minimum RGB face resolution required (0 for full resolution)
              */
-            void loadCubemapImages();
+            void loadCubemapImages(unsigned char faceMask, unsigned int minFaceSize);
 
             /**
              * Create RGB (and optionally, depth) textures from cubemap images (e.g., in GPU memory)
+             * @param faceMask - bitmask of the cubemap faces to upload
              */
-            void loadCubemapTextures();
+            void loadCubemapTextures(unsigned char faceMask);
 
             GLuint cubemap_texture;
             GLuint depth_texture;
-            cv::Mat xpos;                   //! RGB images for faces of the cubemap
-            cv::Mat xneg;
-            cv::Mat ypos;
-            cv::Mat yneg;
-            cv::Mat zpos;
-            cv::Mat zneg;
-            cv::Mat xposD;                   //! Depth images for faces of the cubemap
-            cv::Mat xnegD;
-            cv::Mat yposD;
-            cv::Mat ynegD;
-            cv::Mat zposD;
-            cv::Mat znegD;
-            bool im_loaded;
+            GLuint lowres_texture;
+            GLuint lowres_depth_texture;
+            std::vector<cv::Mat> faces;     //! RGB images for faces of the cubemap, in OpenGL order
+            std::vector<cv::Mat> depthFaces;//! Depth images for faces of the cubemap, in OpenGL order
+            unsigned char im_loaded;        //! Bitmask of cubemap faces loaded into CPU memory
+            unsigned char tex_loaded;       //! Bitmask of cubemap faces uploaded to the textures
+            size_t tex_bytes;               //! GPU memory allocated for the textures
+            std::vector<cv::Mat> lowResFaces;      //! Low resolution RGB images, until they are uploaded
+            std::vector<cv::Mat> lowResDepthFaces; //! Low resolution depth images, until they are uploaded
+            mutable std::mutex imageMutex;  //! Guards the images, which may be loaded in the background
             bool includeDepth;
+            unsigned int imageFaceSize;     //! minFaceSize the RGB images were decoded for (0 for full resolution)
+            unsigned int textureFaceSize;   //! minFaceSize of the images in the RGB texture
             std::string skyboxDir;          //! Path to skybox images
+            std::string rgbFile() const;
+            std::string depthFile() const;
         };
         typedef std::shared_ptr<Location> LocationPtr;
 
+        /**
+         * Navigation graph of a scan in structure-of-arrays form, indexed by viewpoint, and the 
+         * locations holding its images. Each is loaded the first time it is used.
+         */
+        struct Scan {
+            std::string scanId;
+            std::once_flag graphLoaded;
+            std::once_flag locationsCreated;
+            std::once_flag pathsComputed;
+            std::vector<std::string> viewpointIds;
+            std::unordered_map<std::string, unsigned int> viewpointIndex; //! Inverse of viewpointIds
+            std::vector<glm::vec3> positions;           //! Camera pose translation components
+            std::vector<glm::mat4> rotations;           //! Camera pose rotation components
+            std::vector<bool> included;                 //! Some duplicated viewpoints have been excluded
+            std::vector<unsigned int> neighbourOffsets; //! Start of each viewpoint's neighbours, plus the end
+            std::vector<unsigned int> neighbours;       //! Reachable included viewpoints, in ascending order
+            std::vector<unsigned int> bearingNeighbours; //! Reachable viewpoints sorted by bearing, same offsets
+            std::vector<double> bearings;               //! Heading of each bearing neighbour, in [0, 2pi)
+            std::vector<double> elevations;             //! Elevation of each bearing neighbour
+            std::vector<float> distances;               //! Distance to each bearing neighbour
+            SpatialIndex spatialIndex;                  //! Kd-tree of the included camera positions
+            std::vector<LocationPtr> locations;
+            ShortestPaths paths;
+        };
 
         /**
-         * Helper class implementing a LRU cache for cubemap textures.
+         * Navigation graph of a scan, loading it if necessary. Safe to call from several threads.
          */
-        class TextureCache {
+        const Scan& graph(unsigned int scan) const;
 
-        public:
-            TextureCache(unsigned int size) : size(size) {
-                cacheMap.reserve(size+1);
-            }
-
-            TextureCache() = delete; // no default constructor
-
-            void add(LocationPtr loc) {
-                auto map_it = cacheMap.find(loc);
-                if (map_it != cacheMap.end()) {
-                    // Remove entry from middle of list
-                    cacheList.erase(map_it->second);
-                    cacheMap.erase(map_it);
-                }
-                // Add element to list and save iterator on map
-                auto list_it = cacheList.insert(cacheList.begin(), loc);
-                cacheMap.emplace(loc, list_it);
-                if (cacheMap.size() >= size) {
-                    removeEldest();
-                }
-            }
-
-            void removeEldest() {
-                if (cacheMap.empty()) {
-                    throw std::runtime_error("MatterSim: TextureCache is empty");
-                }
-                LocationPtr loc = cacheList.back();
-                loc->deleteCubemapTextures();
-                cacheMap.erase(loc);
-                cacheList.pop_back();
-            }
-
-        private:
-            unsigned int size;
-            std::unordered_map<LocationPtr, std::list<LocationPtr>::iterator > cacheMap;
-            std::list<LocationPtr> cacheList;
-        };
+        /**
+         * Locations of a scan, creating them if necessary. Safe to call from several threads.
+         */
+        const std::vector<LocationPtr>& locations(unsigned int scan) const;
 
-        
-        std::map<std::string, std::vector<LocationPtr> > scanLocations;
+        /**
+         * Read and decode the low resolution cubemap images of a scan into CPU memory
+         */
+        void loadLowResolutionImages(unsigned int scan, unsigned int faceSize);
+
+        std::string navGraphPath;
+        std::string datasetPath;
+        bool preloadImages;
+        bool renderDepth;
+        std::once_flag imagesConfigured;          //! Image settings are fixed by the first caller that sets them
+        std::unique_ptr<NavGraphFile> compiled;   //! Compiled navigation graphs, if available
+        std::vector<std::unique_ptr<Scan> > scanLocations;       //! Indexed by scan handle
+        std::unordered_map<std::string, unsigned int> scanHandles;
+        std::set<unsigned int> lowResolutionScans; //! Scans with resident low resolution textures
+        std::unordered_map<unsigned int, std::future<void> > lowResolutionLoads; //! Background low resolution loading
+        std::future<void> pendingLoad;            //! Background image loading
         std::default_random_engine generator;
-        TextureCache cache;
+        TextureCache<LocationPtr> cache;
     };
 
 }
@@ -0,0 +1,84 @@
+#ifndef NAVGRAPH_FILE_HPP
+#define NAVGRAPH_FILE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace mattersim {
+
+    /**
+     * Navigation graph of a single scan, as stored in its connectivity json file
+     */
+    struct ScanGraph {
+        std::vector<std::string> viewpointIds;        //! Unique Matterport identifier for every pano
+        std::vector<bool> included;                   //! Some duplicated viewpoints have been excluded
+        std::vector<float> poses;                     //! 4x4 camera pose of each viewpoint, row-major
+        std::vector<std::vector<bool> > unobstructed; //! Connections between viewpoints
+    };
+
+    /**
+     * Parse a connectivity json file
+     * @throws std::invalid_argument if the file could not be read
+     */
+    void readConnectivityJson(const std::string& filename, ScanGraph& graph);
+
+    /**
+     * Compact binary index of all the navigation graphs in a connectivity directory, holding the
+     * viewpoint poses, bit-packed included flags and adjacency matrices, and a string table of
+     * scan and viewpoint ids. The file is memory mapped, so opening it costs almost nothing and
+     * only the scans that are read are paged in.
+     */
+    class NavGraphFile {
+
+    public:
+        /**
+         * Location of the index within a connectivity directory
+         */
+        static std::string path(const std::string& navGraphPath);
+
+        /**
+         * Compile the connectivity json files of all the scans listed in navGraphPath/scans.txt
+         * @param outputFile - file to write, which is replaced atomically
+         * @throws std::invalid_argument if a json file could not be read, or std::runtime_error
+         *         if the output could not be written
+         */
+        static void compile(const std::string& navGraphPath, const std::string& outputFile);
+
+        /**
+         * Memory map a compiled index
+         * @throws std::runtime_error if the file could not be mapped or is not a valid index
+         */
+        explicit NavGraphFile(const std::string& filename);
+
+        ~NavGraphFile();
+
+        NavGraphFile(const NavGraphFile&) = delete;
+        NavGraphFile& operator=(const NavGraphFile&) = delete;
+
+        /**
+         * Number of scans in the index
+         */
+        size_t size() const;
+
+        /**
+         * Read the navigation graph of a scan from the index
+         * @param sourceFile - connectivity json file the scan was compiled from. If it exists and has
+         *                     changed since the index was compiled, the index is not used.
+         * @return false if the scan is not in the index or is out of date
+         */
+        bool read(const std::string& scanId, const std::string& sourceFile, ScanGraph& graph) const;
+
+    private:
+        struct Header;
+        struct ScanEntry;
+
+        const unsigned char* data; //! Mapped file contents
+        size_t bytes;              //! Size of the mapping
+        std::unordered_map<std::string, const ScanEntry*> scans;
+        std::string filename;
+    };
+
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef NAVIGATOR_HPP
+#define NAVIGATOR_HPP
+
+#include <memory>
+#include <vector>
+#include <mutex>
+
+#include "NavGraph.hpp"
+#include "Span.hpp"
+
+namespace mattersim {
+
+    /**
+     * Navigable location in compact form, without its position and viewpointId
+     */
+    struct Candidate {
+        unsigned int ix;       //! Viewpoint index
+        float distance;        //! Distance from the agent
+        double rel_heading;    //! Heading relative to the camera
+        double rel_elevation;  //! Elevation relative to the camera
+    };
+
+    /**
+     * Rules for moving a camera through the navigation graph: how headings and elevations are snapped
+     * or limited, and which viewpoints are navigable from a camera pose, in which order. Simulator and
+     * NavEngine share these, so they always agree on the navigable locations.
+     */
+    class Navigator {
+
+    public:
+        static const int headingCount = 12;  // 12 heading values in discretized views
+        static const double elevationIncrement; // 30 degrees discretized up/down
+
+        /**
+         * @param discretizeViews - see Simulator::setDiscretizedViewingAngles
+         * @param restrictedNavigation - see Simulator::setRestrictedNavigation
+         * @param half_hfov - half the horizontal field of view of the camera in radians
+         * @param minElevation, maxElevation - camera elevation limits with continuous viewing angles
+         * @param candidateTables - tabulate the candidates of each view (discretized views only), see
+         *                          Simulator::setCandidateTablesEnabled
+         */
+        Navigator(bool discretizeViews, bool restrictedNavigation, double half_hfov, double minElevation,
+                double maxElevation, bool candidateTables);
+
+        /**
+         * Normalize a camera heading to [0, 2pi) and limit its elevation, or with discretized viewing angles
+         * snap both to the nearest view and set its viewIndex (otherwise viewIndex is left unchanged)
+         */
+        void setHeadingElevation(double heading, double elevation, double& newHeading, double& newElevation,
+                unsigned int& viewIndex) const;
+
+        /**
+         * With discretized viewing angles, replace heading and elevation changes by a single step in the
+         * direction of their sign. Otherwise they are left unchanged.
+         */
+        void discretizeChange(double& heading, double& elevation) const;
+
+        /**
+         * Navigable locations from a camera pose. The current viewpoint comes first, followed by the
+         * viewpoints in the camera's field of view (or all reachable viewpoints if navigation is not
+         * restricted) sorted by their angular distance from the centre of the image. The span points into
+         * a candidate table or into per-thread storage that is reused by the next call on the same thread.
+         * @param viewIndex - only used with candidate tables
+         */
+        Span<Candidate> candidates(const NavGraph& navGraph, unsigned int scan, unsigned int ix, double heading,
+                double elevation, unsigned int viewIndex) const;
+
+    private:
+        /**
+         * Sorted navigable locations of every (viewpoint, viewIndex) of a scan with discretized views
+         */
+        struct CandidateTable {
+            std::once_flag built;
+            std::vector<unsigned int> offsets;  //! Start of each (viewpoint, viewIndex), plus the end
+            std::vector<Candidate> candidates;
+        };
+        void sortNavigable(const NavGraph& navGraph, unsigned int scan, unsigned int ix, double heading,
+                double elevation, std::vector<Candidate>& sorted) const;
+        const CandidateTable& candidateTable(const NavGraph& navGraph, unsigned int scan) const;
+
+        bool discretizeViews;
+        bool restrictedNavigation;
+        double half_hfov;
+        double minElevation;
+        double maxElevation;
+        bool candidateTablesEnabled;
+        mutable std::once_flag tablesAllocated;
+        mutable std::vector<std::unique_ptr<CandidateTable> > candidateTables; //! Indexed by scan handle
+    };
+}
+
+#endif
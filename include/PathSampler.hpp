@@ -0,0 +1,115 @@
+#ifndef PATH_SAMPLER_HPP
+#define PATH_SAMPLER_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "NavGraph.hpp"
+
+namespace mattersim {
+
+    /**
+     * Start and goal viewpoints joined by a shortest path or a random walk, e.g. for data augmentation
+     */
+    struct SampledPath {
+        unsigned int scanHandle;         //! Scan handle, see Simulator::scanHandle
+        std::vector<unsigned int> path;  //! Viewpoint indices from start to goal, including both ends
+        float distance;                  //! Length of the path in metres
+        double heading;                  //! Random initial heading in radians
+    };
+
+
+    /**
+     * Samples start/goal pairs uniformly from all the pairs of viewpoints whose shortest path satisfies
+     * length and hop count constraints, together with their shortest paths. Each path has its own
+     * random number stream, derived from the seed and the path's position in the corpus, so a corpus
+     * is reproducible whatever the number of threads that sample it. Alternatively, samples random walks.
+     */
+    class PathSampler {
+
+    public:
+        PathSampler();
+
+        /**
+         * Set a non-standard path to the viewpoint connectivity graphs, see Simulator::setNavGraphPath
+         */
+        void setNavGraphPath(const std::string& path);
+
+        /**
+         * Only sample paths in these scans. Default is every scan in scans.txt.
+         */
+        void setScans(const std::vector<std::string>& scanIds);
+
+        /**
+         * Set the range of geodesic path lengths in metres, inclusive. Default is any length.
+         */
+        void setDistanceRange(float min, float max);
+
+        /**
+         * Set the range of the number of edges in a path, inclusive. Default is at least 1.
+         */
+        void setHopRange(unsigned int min, unsigned int max);
+
+        /**
+         * Set the random seed. Default is 1.
+         */
+        void setSeed(uint64_t seed);
+
+        /**
+         * Sample random walks instead of shortest paths. Each walk starts at a uniformly sampled viewpoint
+         * and takes a number of steps drawn uniformly from the hop range, to a random reachable viewpoint
+         * each time other than the one it just left (unless there is no other). A walk stops early at a
+         * viewpoint with nowhere to go. The distance range doesn't apply. Default is false.
+         */
+        void setRandomWalks(bool randomWalks);
+
+        /**
+         * Find every start/goal pair satisfying the constraints, computing shortest paths for the
+         * scans in parallel if necessary, or every start of a random walk. Further configuration won't
+         * take any effect from now on.
+         * @throws std::invalid_argument if random walks are sampled without a finite hop range
+         * @throws std::runtime_error if no pair satisfies the constraints
+         */
+        void initialize();
+
+        /**
+         * Number of start/goal pairs satisfying the constraints, or of starts for random walks
+         */
+        size_t pairCount();
+
+        /**
+         * Sample paths in parallel
+         * @param first - position of the first path in the corpus, which determines its random numbers
+         * @param count - number of paths
+         */
+        std::vector<SampledPath> sample(size_t first, size_t count);
+
+        /**
+         * Sample the first count paths of the corpus in parallel and stream them to a file with one
+         * json object per line, e.g. {"scan": "...", "path": ["...", ...], "distance": 8.1, "heading": 2.3}
+         * @throws std::runtime_error if the file can't be written
+         */
+        void writeJsonLines(const std::string& filename, size_t count);
+
+    private:
+        const size_t chunkSize = 1 << 16; // paths formatted in memory before they are written
+        const NavGraph& navGraph() const;
+        void samplePath(const NavGraph& graph, size_t index, SampledPath& path) const;
+        std::vector<unsigned int> scans;
+        std::vector<const ShortestPaths*> paths;       //! Shortest paths of each scan
+        std::vector<std::vector<unsigned int> > pairs; //! start * viewpointCount + goal, or random walk starts, per scan
+        std::vector<size_t> pairOffsets;               //! Index of the first pair of each scan, plus the end
+        std::vector<std::string> scanIds;
+        bool initialized;
+        float minDistance;
+        float maxDistance;
+        unsigned int minHops;
+        unsigned int maxHops;
+        uint64_t seed;
+        bool randomWalks;
+        std::string navGraphPath;
+    };
+}
+
+#endif
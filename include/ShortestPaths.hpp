@@ -0,0 +1,66 @@
+#ifndef SHORTEST_PATHS_HPP
+#define SHORTEST_PATHS_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace mattersim {
+
+    //! Next hop of a viewpoint that can't reach the goal
+    const unsigned int noNextHop = 0xFFFFFFFF;
+
+    /**
+     * All-pairs shortest paths through the navigation graph of a scan, with edges weighted by
+     * the euclidean distance between viewpoints
+     */
+    struct ShortestPaths {
+        unsigned int size = 0;               //! Number of viewpoints
+        std::vector<float> distances;        //! Geodesic distance from row to column, infinity if unreachable
+        std::vector<unsigned int> nextHops;  //! First viewpoint after row on a shortest path to column
+
+        float distance(unsigned int from, unsigned int to) const {
+            return distances[size_t(from) * size + to];
+        }
+
+        unsigned int nextHop(unsigned int from, unsigned int to) const {
+            return nextHops[size_t(from) * size + to];
+        }
+    };
+
+    /**
+     * Run Dijkstra's algorithm from every included viewpoint in parallel. Excluded viewpoints are
+     * unreachable.
+     * @param positions - camera position of each viewpoint
+     * @param included - excluded viewpoints are not part of the graph
+     * @param neighbourOffsets, neighbours - reachable viewpoints of each viewpoint in compressed sparse rows
+     */
+    void computeShortestPaths(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+            const std::vector<unsigned int>& neighbourOffsets, const std::vector<unsigned int>& neighbours,
+            ShortestPaths& paths);
+
+    /**
+     * Hash of the contents of a navigation graph, identifying the shortest paths computed from it
+     */
+    uint64_t shortestPathsKey(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+            const std::vector<unsigned int>& neighbourOffsets, const std::vector<unsigned int>& neighbours);
+
+    /**
+     * Read shortest paths cached by writeShortestPaths
+     * @param size - number of viewpoints in the graph
+     * @return false if the file doesn't exist, is invalid, or was computed from a different graph
+     */
+    bool readShortestPaths(const std::string& filename, uint64_t key, unsigned int size, ShortestPaths& paths);
+
+    /**
+     * Cache shortest paths to a file, replacing it atomically. Failures are ignored, since the
+     * paths can always be recomputed.
+     */
+    void writeShortestPaths(const std::string& filename, uint64_t key, const ShortestPaths& paths);
+
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SKYBOX_DECODER_HPP
+#define SKYBOX_DECODER_HPP
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace mattersim {
+
+    //! Position of each cubemap face (in OpenGL order +x, -x, +y, -y, +z, -z) within a skybox strip image
+    const unsigned int skyboxStripIndex[6] = {2, 4, 0, 5, 1, 3};
+
+    //! Bitmask selecting all six cubemap faces. Bit i corresponds to GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+    const unsigned char allCubemapFaces = 0x3F;
+
+    /**
+     * Smallest cubemap face resolution that still provides at least one texel per rendered pixel
+     * for a camera with the given image height (in pixels) and vertical field of view (in radians).
+     */
+    unsigned int requiredFaceSize(int height, double vfov);
+
+    /**
+     * Choose the largest JPEG DCT scaling denominator (1, 2, 4 or 8) such that a face of faceSize
+     * pixels is decoded at no less than minFaceSize pixels. A minFaceSize of 0 means full resolution.
+     */
+    unsigned int skyboxScaleDenom(unsigned int faceSize, unsigned int minFaceSize);
+
+    /**
+     * Load a 6-face RGB skybox strip image (e.g. "<viewpointId>_skybox_small.jpg") from disk and
+     * split it into cubemap faces in OpenGL order. When built with libjpeg-turbo, the image is decoded
+     * directly into the faces at the smallest DCT scale that satisfies minFaceSize, and only the 
+     * horizontal span of the strip containing the requested faces is decoded.
+     * @param filename - path to the skybox jpeg
+     * @param minFaceSize - minimum face resolution required, or 0 for full resolution
+     * @param faceMask - bitmask of the cubemap faces required
+     * @param faces - output, 6 BGR images. Faces that are not decoded are left untouched
+     * @return bitmask of the faces that were decoded (always including faceMask)
+     */
+    unsigned char decodeSkybox(const std::string& filename, unsigned int minFaceSize, 
+            unsigned char faceMask, std::vector<cv::Mat>& faces);
+
+    /**
+     * As above, but decoding a skybox image that has already been read into memory.
+     * @param data - contents of the skybox jpeg file
+     * @param filename - used for error messages only
+     */
+    unsigned char decodeSkybox(const std::vector<unsigned char>& data, const std::string& filename, 
+            unsigned int minFaceSize, unsigned char faceMask, std::vector<cv::Mat>& faces);
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SPAN_HPP
+#define SPAN_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace mattersim {
+
+    /**
+     * Read-only view of a contiguous array owned by someone else, e.g. a range of a std::vector
+     */
+    template <typename T>
+    class Span {
+
+    public:
+        typedef const T* iterator;
+
+        Span() : first(NULL), last(NULL) {}
+
+        Span(const T* first, const T* last) : first(first), last(last) {}
+
+        Span(const std::vector<T>& v) : first(v.data()), last(v.data() + v.size()) {}
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+
+        size_t size() const {
+            return last - first;
+        }
+
+        bool empty() const {
+            return first == last;
+        }
+
+        const T& operator[](size_t i) const {
+            return first[i];
+        }
+
+    private:
+        const T* first;
+        const T* last;
+    };
+
+}
+
+#endif
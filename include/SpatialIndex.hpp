@@ -0,0 +1,45 @@
+#ifndef SPATIAL_INDEX_HPP
+#define SPATIAL_INDEX_HPP
+
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+namespace mattersim {
+
+    /**
+     * Balanced kd-tree of the camera positions of a scan, for nearest viewpoint and radius queries.
+     * The tree is implicit: the node of each range of points is at its middle, and splits the rest
+     * of the range along its axis.
+     */
+    struct SpatialIndex {
+        std::vector<glm::vec3> points;        //! Camera positions in tree order
+        std::vector<unsigned int> viewpoints; //! Viewpoint index of each point
+        std::vector<unsigned char> axes;      //! Split axis of the node at each point
+
+        /**
+         * Viewpoint nearest to a point, the lowest viewpoint index if several are equally near
+         * @param distance - set to the euclidean distance to the viewpoint
+         * @return false if the index is empty
+         */
+        bool nearest(const glm::vec3& point, unsigned int& viewpoint, double& distance) const;
+
+        /**
+         * Append the viewpoints within a radius of a point to a list, sorted by their distance and
+         * then their viewpoint index
+         */
+        void within(const glm::vec3& point, double radius, std::vector<unsigned int>& result) const;
+    };
+
+    /**
+     * Build a spatial index of the included viewpoints of a scan
+     * @param positions - camera position of each viewpoint
+     * @param included - excluded viewpoints are left out of the index
+     */
+    void buildSpatialIndex(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+            SpatialIndex& index);
+
+}
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mattersim {
+
+    /**
+     * Eviction policies for the texture cache
+     */
+    enum class CachePolicy {
+        LRU,         //! Evict the least recently used textures
+        TwoQueue,    //! 2Q: textures used only once are evicted before those used repeatedly
+        ScanAffinity //! Evict the least recently used textures of the scan holding the most entries
+    };
+
+    /**
+     * Texture cache counters, for tuning the cache policy and capacity
+     */
+    struct CacheStats {
+        //! Requests for textures that were already resident
+        unsigned long hits = 0;
+        //! Requests for textures that had to be uploaded
+        unsigned long misses = 0;
+        //! Entries evicted to stay within capacity
+        unsigned long evictions = 0;
+        //! Texture memory in bytes freed by evictions
+        size_t evictedBytes = 0;
+        //! Number of entries in the cache
+        size_t entries = 0;
+        //! Texture memory in bytes held by the cache
+        size_t bytes = 0;
+        //! Current capacity in bytes
+        size_t capacity = 0;
+    };
+
+
+    /**
+     * Recency ordered list of keys with constant time access, front is most recent.
+     */
+    template <typename Key>
+    class RecencyList {
+
+    public:
+        typedef typename std::list<Key>::const_reverse_iterator iterator;
+
+        bool contains(const Key& key) const {
+            return index.count(key) > 0;
+        }
+
+        void touch(const Key& key) {
+            erase(key);
+            index.emplace(key, keys.insert(keys.begin(), key));
+        }
+
+        void erase(const Key& key) {
+            auto it = index.find(key);
+            if (it != index.end()) {
+                keys.erase(it->second);
+                index.erase(it);
+            }
+        }
+
+        void pop_back() {
+            erase(keys.back());
+        }
+
+        size_t size() const {
+            return keys.size();
+        }
+
+        //! Iterate from least to most recent
+        iterator begin() const {
+            return keys.rbegin();
+        }
+
+        iterator end() const {
+            return keys.rend();
+        }
+
+    private:
+        std::list<Key> keys;
+        std::unordered_map<Key, typename std::list<Key>::iterator> index;
+    };
+
+
+    /**
+     * Tracks cache entries and decides which to evict.
+     */
+    template <typename Key>
+    class EvictionPolicy {
+
+    public:
+        virtual ~EvictionPolicy() {}
+
+        /**
+         * Record a use of an entry, inserting it if necessary
+         */
+        virtual void access(const Key& key, const std::string& scanId) = 0;
+
+        /**
+         * Choose an entry to evict (that isn't pinned) and remove it
+         * @return false if there is nothing that can be evicted
+         */
+        virtual bool evict(const std::unordered_set<Key>& pinned, Key& victim) = 0;
+
+    protected:
+        // Remove and return the least recent entry that isn't pinned
+        static bool evictOldest(RecencyList<Key>& list, const std::unordered_set<Key>& pinned, Key& victim) {
+            for (auto it = list.begin(); it != list.end(); ++it) {
+                if (!pinned.count(*it)) {
+                    victim = *it;
+                    list.erase(victim);
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+
+    template <typename Key>
+    class LRUPolicy : public EvictionPolicy<Key> {
+
+    public:
+        void access(const Key& key, const std::string& scanId) override {
+            entries.touch(key);
+        }
+
+        bool evict(const std::unordered_set<Key>& pinned, Key& victim) override {
+            return this->evictOldest(entries, pinned, victim);
+        }
+
+    private:
+        RecencyList<Key> entries;
+    };
+
+
+    /**
+     * Simplified 2Q (Johnson and Shasha, 1994). New entries go into a FIFO queue, and only move to
+     * the main LRU queue if they are used again after being evicted from it (tracked by a queue of
+     * recently evicted keys). A single sweep through many viewpoints therefore can't flush the
+     * viewpoints that are used repeatedly.
+     */
+    template <typename Key>
+    class TwoQueuePolicy : public EvictionPolicy<Key> {
+
+    public:
+        void access(const Key& key, const std::string& scanId) override {
+            if (main.contains(key)) {
+                main.touch(key);
+            } else if (!in.contains(key)) {
+                if (out.contains(key)) {
+                    out.erase(key);
+                    main.touch(key);
+                } else {
+                    in.touch(key);
+                }
+            }
+        }
+
+        bool evict(const std::unordered_set<Key>& pinned, Key& victim) override {
+            // Keep about a quarter of the entries in the FIFO queue
+            size_t entries = in.size() + main.size();
+            if (in.size() > std::max<size_t>(1, entries / 4) || main.size() == 0) {
+                if (this->evictOldest(in, pinned, victim)) {
+                    remember(victim, entries);
+                    return true;
+                }
+                return this->evictOldest(main, pinned, victim);
+            }
+            if (this->evictOldest(main, pinned, victim)) {
+                return true;
+            }
+            if (this->evictOldest(in, pinned, victim)) {
+                remember(victim, entries);
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        void remember(const Key& key, size_t entries) {
+            out.touch(key);
+            while (out.size() > std::max<size_t>(1, entries / 2)) {
+                out.pop_back();
+            }
+        }
+
+        RecencyList<Key> in;   //! FIFO of entries used once
+        RecencyList<Key> main; //! LRU of entries used repeatedly
+        RecencyList<Key> out;  //! Keys recently evicted from the FIFO, without textures
+    };
+
+
+    /**
+     * Evicts from the scan with the most entries in the cache, least recently used first. A sweep
+     * through a large scan then mostly evicts its own entries, rather than the working sets of
+     * other scans in the batch.
+     */
+    template <typename Key>
+    class ScanAffinityPolicy : public EvictionPolicy<Key> {
+
+    public:
+        void access(const Key& key, const std::string& scanId) override {
+            auto it = entryScan.find(key);
+            if (it != entryScan.end() && it->second != scanId) {
+                scans[it->second].erase(key);
+            }
+            entryScan[key] = scanId;
+            scans[scanId].touch(key);
+        }
+
+        bool evict(const std::unordered_set<Key>& pinned, Key& victim) override {
+            std::vector<std::pair<size_t, std::string> > order;
+            for (auto& scan : scans) {
+                order.push_back({scan.second.size(), scan.first});
+            }
+            std::stable_sort(order.begin(), order.end(),
+                [](const std::pair<size_t, std::string>& a, const std::pair<size_t, std::string>& b) {
+                    return a.first > b.first;
+                });
+            for (auto& scan : order) {
+                if (this->evictOldest(scans[scan.second], pinned, victim)) {
+                    entryScan.erase(victim);
+                    if (scans[scan.second].size() == 0) {
+                        scans.erase(scan.second);
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::map<std::string, RecencyList<Key> > scans;
+        std::unordered_map<Key, std::string> entryScan;
+    };
+
+
+    /**
+     * Cache of textures with a capacity in bytes and a pluggable eviction policy.
+     */
+    template <typename Key>
+    class TextureCache {
+
+    public:
+        /**
+         * @param policy - eviction policy
+         * @param size - capacity in entries, used only when capacity is 0
+         * @param capacity - capacity in bytes. If 0, the entry count is converted to bytes with the
+         *                   mean texture size measured so far, so the cache holds about size - 1 
+         *                   textures as before byte capacities were added. This is a fixed budget, 
+         *                   it does not adapt to the workload.
+         * @param onEvict - called to free the textures of each evicted entry
+         */
+        TextureCache(CachePolicy policy, unsigned int size, size_t capacity,
+                const std::function<void(const Key&)>& onEvict) :
+                size(size), capacity(capacity), onEvict(onEvict), measuredBytes(0), measuredEntries(0) {
+            switch (policy) {
+                case CachePolicy::TwoQueue:
+                    entries.reset(new TwoQueuePolicy<Key>());
+                    break;
+                case CachePolicy::ScanAffinity:
+                    entries.reset(new ScanAffinityPolicy<Key>());
+                    break;
+                default:
+                    entries.reset(new LRUPolicy<Key>());
+            }
+        }
+
+        TextureCache() = delete; // no default constructor
+
+        /**
+         * Record a use of an entry and its current size, then evict other entries until the
+         * cache is within capacity. The size should be known on the first use, so that the
+         * entry counts against the capacity before its textures are uploaded.
+         */
+        void add(const Key& key, const std::string& scanId, size_t bytes) {
+            entries->access(key, scanId);
+            auto it = sizes.find(key);
+            if (it == sizes.end()) {
+                it = sizes.emplace(key, 0).first;
+            }
+            if (bytes > 0 && bytes != it->second) {
+                measuredBytes += bytes;
+                measuredEntries++;
+            }
+            stats.bytes += bytes - it->second;
+            it->second = bytes;
+            stats.entries = sizes.size();
+            bool wasPinned = pinned.count(key) > 0;
+            pinned.insert(key);
+            stats.capacity = capacityBytes();
+            Key victim;
+            while (stats.bytes > stats.capacity && entries->evict(pinned, victim)) {
+                size_t victimBytes = sizes[victim];
+                sizes.erase(victim);
+                stats.bytes -= victimBytes;
+                stats.entries = sizes.size();
+                stats.evictions++;
+                stats.evictedBytes += victimBytes;
+                onEvict(victim);
+            }
+            if (!wasPinned) {
+                pinned.erase(key);
+            }
+        }
+
+        /**
+         * Prevent an entry from being evicted until unpinAll is called
+         */
+        void pin(const Key& key) {
+            pinned.insert(key);
+        }
+
+        void unpinAll() {
+            pinned.clear();
+        }
+
+        /**
+         * Count a request for textures as a cache hit or miss
+         */
+        void count(bool hit) {
+            if (hit) {
+                stats.hits++;
+            } else {
+                stats.misses++;
+            }
+        }
+
+        const CacheStats& statistics() const {
+            return stats;
+        }
+
+    private:
+        size_t capacityBytes() const {
+            if (capacity > 0) {
+                return capacity;
+            }
+            // Convert the entry count to bytes. Until a size is measured, nothing is evicted.
+            if (measuredEntries == 0) {
+                return stats.bytes;
+            }
+            return measuredBytes / measuredEntries * (size > 0 ? size - 1 : 0);
+        }
+
+        unsigned int size;
+        size_t capacity;
+        std::function<void(const Key&)> onEvict;
+        std::unique_ptr<EvictionPolicy<Key> > entries;
+        std::unordered_map<Key, size_t> sizes;
+        std::unordered_set<Key> pinned;
+        size_t measuredBytes;   //! Total of all texture sizes measured
+        size_t measuredEntries; //! Number of texture sizes measured
+        CacheStats stats;
+    };
+
+}
+
+#endif
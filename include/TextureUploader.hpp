@@ -0,0 +1,87 @@
+#ifndef TEXTURE_UPLOADER_HPP
+#define TEXTURE_UPLOADER_HPP
+
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef OSMESA_RENDERING
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/osmesa.h>
+#elif defined (EGL_RENDERING)
+#include <epoxy/gl.h>
+#include <EGL/egl.h>
+#else
+#include <GL/glew.h>
+#endif
+
+namespace mattersim {
+
+    /**
+     * Stage cubemap faces in a pixel unpack buffer and upload them to the currently bound cubemap
+     * texture, whose storage must already be allocated. The transfer to the GPU proceeds
+     * asynchronously after this returns.
+     * @param faces - images for faces of the cubemap, in OpenGL order
+     * @param faceMask - bitmask of the faces to upload
+     * @param format, type - pixel format and type of the images, e.g. GL_BGR, GL_UNSIGNED_BYTE
+     */
+    void uploadCubemapFaces(const std::vector<cv::Mat>& faces, unsigned char faceMask, GLenum format, GLenum type);
+
+    /**
+     * Runs texture upload tasks. With EGL rendering, tasks can run in order on a loader thread with its
+     * own OpenGL context that shares textures with the rendering context. A task is only reported as
+     * complete once a fence shows that its uploads have finished on the GPU. Otherwise tasks run
+     * immediately on the calling thread.
+     */
+    class TextureUploader {
+
+    public:
+        /**
+         * Run upload tasks on the calling thread
+         */
+        TextureUploader();
+
+#ifdef EGL_RENDERING
+        /**
+         * Run upload tasks on a loader thread
+         * @param shareContext - rendering context that will use the uploaded textures
+         */
+        TextureUploader(EGLDisplay display, EGLConfig config, EGLContext shareContext);
+#endif
+
+        ~TextureUploader();
+
+        TextureUploader(const TextureUploader&) = delete;
+        TextureUploader& operator=(const TextureUploader&) = delete;
+
+        /**
+         * Queue an upload task. The returned future becomes ready when the uploaded textures can be
+         * used by the rendering context, and rethrows any exception from the task.
+         */
+        std::shared_future<void> submit(const std::function<void()>& task);
+
+    private:
+        void run();
+
+        bool threaded;
+#ifdef EGL_RENDERING
+        EGLDisplay display;
+        EGLContext context;
+#endif
+        std::thread loader;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::queue<std::pair<std::function<void()>, std::promise<void> > > tasks;
+        bool stopping;
+    };
+
+}
+
+#endif
@@ -0,0 +1,31 @@
+#include <iostream>
+#include <chrono>
+
+#include "NavGraphFile.hpp"
+
+using namespace mattersim;
+
+// Compiles the json navigation graphs in a connectivity directory into a binary index, which
+// the simulator will then use instead of parsing json.
+int main(int argc, char *argv[]) {
+
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [connectivity_dir] [output_file]" << std::endl;
+        return 1;
+    }
+    std::string navGraphPath = argc > 1 ? argv[1] : "./connectivity";
+    std::string outputFile = argc > 2 ? argv[2] : NavGraphFile::path(navGraphPath);
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        NavGraphFile::compile(navGraphPath, outputFile);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        NavGraphFile index(outputFile);
+        std::cout << "Compiled " << index.size() << " scans to " << outputFile
+                  << " in " << elapsed.count() << " ms" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
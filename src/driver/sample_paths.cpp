@@ -0,0 +1,88 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "PathSampler.hpp"
+
+using namespace mattersim;
+
+static int usage(const char *program) {
+    std::cerr << "Usage: " << program << " count output_file [--seed n] [--scans scans_file]"
+              << " [--min-distance m] [--max-distance m] [--min-hops n] [--max-hops n]"
+              << " [--random-walks] [--connectivity connectivity_dir]" << std::endl;
+    return 1;
+}
+
+// Samples a corpus of start/goal pairs and their shortest paths, or random walks, e.g. for data
+// augmentation, and writes it to a json lines file.
+int main(int argc, char *argv[]) {
+
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+    size_t count = std::strtoull(argv[1], NULL, 10);
+    std::string outputFile = argv[2];
+
+    PathSampler sampler;
+    bool randomWalks = false;
+    float minDistance = 0, maxDistance = std::numeric_limits<float>::infinity();
+    unsigned int minHops = 1, maxHops = std::numeric_limits<unsigned int>::max();
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--random-walks") {
+            randomWalks = true;
+            sampler.setRandomWalks(true);
+            continue;
+        }
+        if (i + 1 == argc) {
+            std::cerr << "Missing value for option: " << option << std::endl;
+            return usage(argv[0]);
+        }
+        std::string value = argv[++i];
+        if (option == "--seed") {
+            sampler.setSeed(std::strtoull(value.c_str(), NULL, 10));
+        } else if (option == "--scans") {
+            std::ifstream scansFile(value);
+            std::vector<std::string> scanIds;
+            std::string scanId;
+            while (scansFile >> scanId) {
+                scanIds.push_back(scanId);
+            }
+            sampler.setScans(scanIds);
+        } else if (option == "--min-distance") {
+            minDistance = std::atof(value.c_str());
+        } else if (option == "--max-distance") {
+            maxDistance = std::atof(value.c_str());
+        } else if (option == "--min-hops") {
+            minHops = std::atoi(value.c_str());
+        } else if (option == "--max-hops") {
+            maxHops = std::atoi(value.c_str());
+        } else if (option == "--connectivity") {
+            sampler.setNavGraphPath(value);
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return usage(argv[0]);
+        }
+    }
+    sampler.setDistanceRange(minDistance, maxDistance);
+    sampler.setHopRange(minHops, maxHops);
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        sampler.initialize();
+        auto sampling = std::chrono::steady_clock::now();
+        sampler.writeJsonLines(outputFile, count);
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "Found " << sampler.pairCount() << (randomWalks ? " walk starts in " : " start/goal pairs in ")
+                  << std::chrono::duration<double, std::milli>(sampling - start).count() << " ms" << std::endl;
+        std::cout << "Wrote " << count << " paths to " << outputFile << " in "
+                  << std::chrono::duration<double, std::milli>(end - sampling).count() << " ms" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+
+#ifdef LIBURING
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <liburing.h>
+#endif
+
+#include "FileReader.hpp"
+
+namespace mattersim {
+
+namespace {
+
+    // Save the first error so it can be rethrown outside of a parallel region
+    void saveError(std::exception_ptr& error, std::exception_ptr e) {
+        #pragma omp critical
+        {
+            if (!error) {
+                error = e;
+            }
+        }
+    }
+
+    // Read the files from a pool of OpenMP threads
+    void readFilesThreaded(const std::vector<std::string>& filenames, std::vector<std::vector<unsigned char> >& data,
+                           const std::function<void(size_t)>& callback) {
+        data.resize(filenames.size());
+        std::exception_ptr error;
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            try {
+                readFile(filenames[i], data[i]);
+                callback(i);
+            } catch (...) {
+                saveError(error, std::current_exception());
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+#ifdef LIBURING
+    void guardedCall(const std::function<void(size_t)>& callback, size_t i, std::exception_ptr& error) {
+        try {
+            callback(i);
+        } catch (...) {
+            saveError(error, std::current_exception());
+        }
+    }
+#endif
+
+}
+
+
+void readFile(const std::string& filename, std::vector<unsigned char>& data) {
+    std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+    if (ifs.fail()) {
+        throw std::invalid_argument( "MatterSim: Could not open file: " + filename );
+    }
+    data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+
+#ifdef LIBURING
+
+void readFiles(const std::vector<std::string>& filenames, std::vector<std::vector<unsigned char> >& data,
+               const std::function<void(size_t)>& callback) {
+    const unsigned int queueDepth = 64;
+    data.resize(filenames.size());
+    std::exception_ptr error;
+    if (filenames.empty()) {
+        return;
+    }
+    struct io_uring ring;
+    if (io_uring_queue_init(std::min<size_t>(queueDepth, filenames.size()), &ring, 0) < 0) {
+        // e.g. an older kernel, or io_uring blocked by a seccomp policy
+        readFilesThreaded(filenames, data, callback);
+        return;
+    }
+    std::vector<int> fds(filenames.size(), -1);
+    int ringError = 0;
+    #pragma omp parallel
+    #pragma omp single
+    {
+        size_t submitted = 0;
+        size_t completed = 0;
+        unsigned int inflight = 0;
+        while (completed < filenames.size() && ringError == 0) {
+            // Keep the submission queue full
+            while (submitted < filenames.size() && inflight < queueDepth) {
+                size_t i = submitted++;
+                struct stat st;
+                fds[i] = open(filenames[i].c_str(), O_RDONLY);
+                if (fds[i] < 0 || fstat(fds[i], &st) < 0) {
+                    if (fds[i] >= 0) {
+                        close(fds[i]);
+                        fds[i] = -1;
+                    }
+                    completed++;
+                    saveError(error, std::make_exception_ptr(std::invalid_argument(
+                            "MatterSim: Could not open file: " + filenames[i] )));
+                    continue;
+                }
+                data[i].resize(st.st_size);
+                struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read(sqe, fds[i], data[i].data(), data[i].size(), 0);
+                io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(i));
+                inflight++;
+            }
+            if (inflight == 0) {
+                continue;
+            }
+            int ret;
+            while ((ret = io_uring_submit(&ring)) == -EINTR) {}
+            struct io_uring_cqe* cqe;
+            if (ret >= 0) {
+                while ((ret = io_uring_wait_cqe(&ring, &cqe)) == -EINTR) {}
+            }
+            if (ret < 0) {
+                ringError = ret;
+                break;
+            }
+            size_t i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            inflight--;
+            completed++;
+            // Short reads are completed synchronously
+            size_t bytes = res < 0 ? 0 : res;
+            while (res >= 0 && bytes < data[i].size()) {
+                res = pread(fds[i], data[i].data() + bytes, data[i].size() - bytes, bytes);
+                bytes += res > 0 ? res : 0;
+                if (res == 0) {
+                    res = -1;
+                }
+            }
+            close(fds[i]);
+            fds[i] = -1;
+            if (res < 0) {
+                saveError(error, std::make_exception_ptr(std::invalid_argument(
+                        "MatterSim: Could not read file: " + filenames[i] )));
+                continue;
+            }
+            // Process the data while the remaining reads complete
+            #pragma omp task firstprivate(i) shared(error)
+            guardedCall(callback, i, error);
+        }
+    }
+    io_uring_queue_exit(&ring);
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (ringError < 0) {
+        throw std::runtime_error( "MatterSim: io_uring failed while reading files (error " + 
+                std::to_string(-ringError) + ")" );
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#else
+
+void readFiles(const std::vector<std::string>& filenames, std::vector<std::vector<unsigned char> >& data,
+               const std::function<void(size_t)>& callback) {
+    readFilesThreaded(filenames, data, callback);
+}
+
+#endif
+
+}
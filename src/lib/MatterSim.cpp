@@ -1,8 +1,11 @@
 #include <iostream>
 #include <fstream>
+#include <numeric>
+#include <cstring>
 
 #include "MatterSim.hpp"
 #include "Benchmark.hpp"
+#include "SkyboxDecoder.hpp"
 
 namespace mattersim {
 
@@ -51,6 +54,24 @@ GLfloat cube_vertices[] = {
      1.0f, -1.0f,  1.0f
 };
 
+namespace {
+
+    // Rearrange items of stride values each, so that item k is the old item order[k]
+    template <typename T>
+    void reorder(std::vector<T>& values, const std::vector<size_t>& order, size_t stride) {
+        if (values.empty()) {
+            return;
+        }
+        std::vector<T> result(values.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            std::copy(values.begin() + order[k] * stride, values.begin() + (order[k] + 1) * stride,
+                    result.begin() + k * stride);
+        }
+        values.swap(result);
+    }
+
+}
+
 
 Simulator::Simulator() :width(320),
                         height(240),
@@ -69,8 +90,16 @@ Simulator::Simulator() :width(320),
                         restrictedNavigation(true),
                         preloadImages(false),
                         renderDepth(false),
+                        lazyLoading(false),
+                        deadlineMode(false),
+                        backgroundUpload(false),
+                        candidateTablesEnabled(false),
                         batchSize(1),
                         cacheSize(200),
+                        cachePolicy(CachePolicy::LRU),
+                        cacheCapacity(0),
+                        minFaceSize(0),
+                        lowResFaceSize(0),
                         randomSeed(1) {
 };
 
@@ -99,16 +128,25 @@ void Simulator::setRenderingEnabled(bool value) {
 void Simulator::setCameraResolution(int width, int height) {
     this->width = width;
     this->height = height;
+    if (initialized) {
+        resetNavigator();
+    }
 }
 
 void Simulator::setCameraVFOV(double vfov) {
     this->vfov = vfov;
+    if (initialized) {
+        resetNavigator();
+    }
 }
 
 bool Simulator::setElevationLimits(double min, double max) {
     if (min < 0.0 && min > -M_PI/2.0 && max > 0.0 && max < M_PI/2.0) {
         minElevation = min;
         maxElevation = max;
+        if (initialized) {
+            resetNavigator();
+        }
         return true;
     } else {
         return false;
@@ -139,6 +177,36 @@ void Simulator::setDepthEnabled(bool value) {
     } 
 }
 
+void Simulator::setLazyLoadingEnabled(bool value) {
+     if (!initialized) {
+        lazyLoading = value;
+    } 
+}
+
+void Simulator::setLowResolutionFaceSize(unsigned int size) {
+     if (!initialized) {
+        lowResFaceSize = size;
+    } 
+}
+
+void Simulator::setDeadlineModeEnabled(bool value) {
+     if (!initialized) {
+        deadlineMode = value;
+    } 
+}
+
+void Simulator::setBackgroundUploadEnabled(bool value) {
+     if (!initialized) {
+        backgroundUpload = value;
+    } 
+}
+
+void Simulator::setCandidateTablesEnabled(bool value) {
+    if (!initialized) {
+        candidateTablesEnabled = value;
+    }
+}
+
 void Simulator::setBatchSize(unsigned int size) {
     if (!initialized) {
         batchSize = size;
@@ -151,6 +219,18 @@ void Simulator::setCacheSize(unsigned int size) {
     }
 }
 
+void Simulator::setCachePolicy(CachePolicy policy) {
+    if (!initialized) {
+        cachePolicy = policy;
+    }
+}
+
+void Simulator::setCacheCapacity(size_t bytes) {
+    if (!initialized) {
+        cacheCapacity = bytes;
+    }
+}
+
 void Simulator::setSeed(int seed) {
     if (!initialized) {
         randomSeed = seed;
@@ -158,11 +238,24 @@ void Simulator::setSeed(int seed) {
 }
 
 void Simulator::initialize() {
+    if (renderingEnabled) {
+        // Skybox images can be decoded at reduced scale if the camera resolution is low
+        minFaceSize = requiredFaceSize(height, vfov);
+        if (deadlineMode && lowResFaceSize == 0) {
+            // Deadline mode needs something to render while images load
+            lowResFaceSize = 64;
+        }
+    }
     for (unsigned int i=0; i<batchSize; ++i) {
         states.push_back(std::make_shared<SimState>());
         states.back()->rgb = cv::Mat(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
         states.back()->depth = cv::Mat(height, width, CV_16UC1, cv::Scalar(0));
     }
+    envIndices.clear();
+    for (unsigned int i=0; i<states.size(); ++i) {
+        envIndices[states[i].get()] = i;
+    }
+    sharedImages.assign(states.size(), false);
     if (renderingEnabled) {
 #ifdef OSMESA_RENDERING
         ctx = OSMesaCreateContext(OSMESA_RGBA, NULL);
@@ -209,6 +302,11 @@ void Simulator::initialize() {
         eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, eglCtx);
         assertEGLError("eglMakeCurrent");
 
+        if (backgroundUpload) {
+            // Textures are uploaded from a second context sharing objects with this one
+            uploader.reset(new TextureUploader(eglDpy, eglCfg, eglCtx));
+        }
+
 #else
         cv::namedWindow("renderwin", cv::WINDOW_OPENGL);
         cv::setOpenGlContext("renderwin");
@@ -216,6 +314,10 @@ void Simulator::initialize() {
         glewInit();
 #endif
 
+        if (!uploader) {
+            uploader.reset(new TextureUploader());
+        }
+
 #ifndef OSMESA_RENDERING
         GLuint FramebufferName;
         glGenFramebuffers(1, &FramebufferName);
@@ -323,77 +425,91 @@ void Simulator::initialize() {
             // trigger loading from disk now, to get predictable timing later
             preloadTimer.Start();
             auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, 
-                              renderDepth, randomSeed, cacheSize);
+                              renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
             preloadTimer.Stop();
         }
     }
+    resetNavigator();
     initialized = true;
 }
 
-void Simulator::populateNavigable() {
-    for (auto state: states) {
-        std::vector<ViewpointPtr> updatedNavigable;
-        updatedNavigable.push_back(state->location);
-        unsigned int idx = state->location->ix;
-        double adjustedheading = M_PI/2.0 - state->heading;
-        glm::vec3 camera_horizon_dir(cos(adjustedheading), sin(adjustedheading), 0.f);
-        double cos_half_hfov = cos(vfov * width / height / 2.0);
-        
-        auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize);
-        for (unsigned int i : navGraph.adjacentViewpointIndices(state->scanId, idx)) {
-            // Check if visible between camera left and camera right
-            glm::vec3 target_dir = navGraph.cameraPosition(state->scanId,i) - navGraph.cameraPosition(state->scanId,idx);
-            double rel_distance = glm::length(target_dir);
-            double tar_z = target_dir.z;
-            target_dir.z = 0.f; // project to xy plane
-            double rel_elevation = atan2(tar_z, glm::length(target_dir)) - state->elevation;
-            glm::vec3 normed_target_dir = glm::normalize(target_dir);
-            double cos_angle = glm::dot(normed_target_dir, camera_horizon_dir);
-            if (!restrictedNavigation || (cos_angle >= cos_half_hfov)) {
-                glm::vec3 pos = navGraph.cameraPosition(state->scanId,i);
-                double rel_heading = atan2( target_dir.x*camera_horizon_dir.y - target_dir.y*camera_horizon_dir.x,
-                        target_dir.x*camera_horizon_dir.x + target_dir.y*camera_horizon_dir.y );
-                Viewpoint v{navGraph.viewpoint(state->scanId,i), i, pos[0], pos[1], pos[2],
-                      rel_heading, rel_elevation, rel_distance};
-                updatedNavigable.push_back(std::make_shared<Viewpoint>(v));
+void Simulator::resetNavigator() {
+    navigator.reset(new Navigator(discretizeViews, restrictedNavigation, vfov * width / height / 2.0,
+            minElevation, maxElevation, candidateTablesEnabled));
+}
+
+void Simulator::update(const std::vector<bool>& changed) {
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<SimStatePtr> targets;
+    for (unsigned int i=0; i<states.size(); ++i) {
+        if (changed[i]) {
+            targets.push_back(states[i]);
+        }
+    }
+    int count = targets.size();
+    // Environments are independent, so large batches are split across threads
+    #pragma omp parallel for schedule(static) if(count >= parallelBatchSize)
+    for (int n = 0; n < count; ++n) {
+        populateNavigable(*targets[n], navGraph);
+    }
+    if (renderingEnabled && !targets.empty()) {
+        for (unsigned int i=0; i<states.size(); ++i) {
+            if (changed[i]) {
+                unshareImages(i);
             }
         }
-        std::sort(updatedNavigable.begin(), updatedNavigable.end(), ViewpointPtrComp());
-        state->navigableLocations = updatedNavigable;
+        renderScene(targets);
     }
 }
 
-void Simulator::setHeadingElevation(const std::vector<double>& heading, const std::vector<double>& elevation) {
-    for (unsigned int i=0; i<states.size(); ++i) {
-        auto state = states.at(i);
-        // Normalize heading to range [0, 360]
-        state->heading = fmod(heading.at(i), M_PI*2.0);
-        while (state->heading < 0.0) {
-            state->heading += M_PI*2.0;
-        }
-        if (discretizeViews) {
-            // Snap heading to nearest discrete value
-            double headingIncrement = M_PI*2.0/headingCount;
-            int heading_step = std::lround(state->heading/headingIncrement);
-            if (heading_step == headingCount) heading_step = 0;
-            state->heading = (double)heading_step * headingIncrement;
-            // Snap elevation to nearest discrete value (disregarding elevation limits)
-            state->elevation = elevation.at(i);
-            if (state->elevation < -elevationIncrement/2.0) {
-              state->elevation = -elevationIncrement;
-              state->viewIndex = heading_step;
-            } else if (state->elevation > elevationIncrement/2.0) {
-              state->elevation = elevationIncrement;
-              state->viewIndex = heading_step + 2*headingCount;
-            } else {
-              state->elevation = 0.0;
-              state->viewIndex = heading_step + headingCount;
-            }
+void Simulator::populateNavigable(SimState& state, const NavGraph& navGraph) const {
+    unsigned int scan = state.scanHandle;
+    unsigned int idx = state.location->ix;
+    Span<Candidate> sorted = navigator->candidates(navGraph, scan, idx, state.heading, state.elevation,
+            state.viewIndex);
+
+    state.location.reset();
+    state.navigableLocations.clear();
+    if (!state.candidates || state.candidates.use_count() > 1) {
+        // Previous candidates are still referenced outside the simulator, so leave them unchanged
+        state.candidates = std::make_shared<std::vector<Viewpoint> >();
+    }
+    std::vector<Viewpoint>& candidates = *state.candidates;
+    Span<glm::vec3> positions = navGraph.cameraPositions(scan);
+    unsigned int locationIndex = 0;
+    unsigned int count = 0;
+    for (const Candidate& c : sorted) {
+        if (c.ix == idx) {
+            locationIndex = count;
+        }
+        const glm::vec3& pos = positions[c.ix];
+        if (count < candidates.size()) {
+            // Overwrite the previous candidates in place, so their id strings don't reallocate
+            Viewpoint& v = candidates[count];
+            v.viewpointId = navGraph.viewpoint(scan,c.ix);
+            v.ix = c.ix;
+            v.x = pos[0];
+            v.y = pos[1];
+            v.z = pos[2];
+            v.rel_heading = c.rel_heading;
+            v.rel_elevation = c.rel_elevation;
+            v.rel_distance = c.distance;
         } else {
-            // Set elevation with limits
-            state->elevation = std::max(std::min(elevation.at(i), maxElevation), minElevation);
+            candidates.emplace_back(navGraph.viewpoint(scan,c.ix), c.ix, pos[0], pos[1], pos[2],
+                  c.rel_heading, c.rel_elevation, c.distance);
         }
+        count++;
+    }
+    candidates.erase(candidates.begin() + count, candidates.end());
+    // Views share ownership of the storage, which doesn't allocate
+    for (Viewpoint& candidate : candidates) {
+        state.navigableLocations.emplace_back(state.candidates, &candidate);
     }
+    state.location = state.navigableLocations[locationIndex];
+}
+
+void Simulator::setHeadingElevation(SimState& state, double heading, double elevation) const {
+    navigator->setHeadingElevation(heading, elevation, state.heading, state.elevation, state.viewIndex);
 }
 
 void Simulator::newEpisode(const std::vector<std::string>& scanId,
@@ -405,64 +521,551 @@ void Simulator::newEpisode(const std::vector<std::string>& scanId,
     if (!initialized) {
         initialize();
     }
-    setHeadingElevation(heading, elevation);
-    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize);
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<unsigned int> scans;
+    std::vector<unsigned int> ixs;
     for (unsigned int i=0; i<states.size(); ++i) {
-        auto state = states.at(i);
-        state->step = 0;
-        state->scanId = scanId.at(i);
-        unsigned int ix = navGraph.index(state->scanId, viewpointId.at(i));
-        glm::vec3 pos = navGraph.cameraPosition(state->scanId, ix);
-        Viewpoint v {
-            viewpointId.at(i), 
-            ix,
-            pos[0], pos[1], pos[2], 
-            0.0, 0.0, 0.0
-        };
-        state->location = std::make_shared<Viewpoint>(v);
+        scans.push_back(navGraph.scanHandle(scanId.at(i)));
+        ixs.push_back(navGraph.index(scans.back(), viewpointId.at(i)));
     }
-    populateNavigable();
-    if (renderingEnabled) {
-        renderScene();
+    newEpisode(scans, ixs, heading, elevation);
+}
+
+
+void Simulator::newEpisode(const std::vector<unsigned int>& scanHandle,
+                           const std::vector<unsigned int>& viewpointIx,
+                           const std::vector<double>& heading,
+                           const std::vector<double>& elevation) {
+    wallTimer.Start();
+    processTimer.Start();
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    for (unsigned int i=0; i<states.size(); ++i) {
+        unsigned int ix = viewpointIx.at(i);
+        if (!navGraph.included(scanHandle.at(i), ix)) {
+            throw std::invalid_argument( "MatterSim: ViewpointId: " + navGraph.viewpoint(scanHandle.at(i), ix)
+                    + ", is excluded from the connectivity graph." );
+        }
+    }
+    for (unsigned int i=0; i<states.size(); ++i) {
+        startEpisode(*states.at(i), scanHandle.at(i), viewpointIx.at(i), heading.at(i), elevation.at(i), navGraph);
+    }
+    update(std::vector<bool>(states.size(), true));
+    processTimer.Stop();
+}
+
+void Simulator::startEpisode(SimState& state, unsigned int scanHandle, unsigned int ix, double heading,
+                             double elevation, NavGraph& navGraph) const {
+    setHeadingElevation(state, heading, elevation);
+    state.step = 0;
+    if (state.scanId.empty() || state.scanHandle != scanHandle) {
+        state.scanId = navGraph.scanId(scanHandle);
+    }
+    state.scanHandle = scanHandle;
+    glm::vec3 pos = navGraph.cameraPosition(state.scanHandle, ix);
+    Viewpoint v {
+        navGraph.viewpoint(state.scanHandle, ix), 
+        ix,
+        pos[0], pos[1], pos[2], 
+        0.0, 0.0, 0.0
+    };
+    state.location = std::make_shared<Viewpoint>(v);
+}
+
+void Simulator::resetEnvs(const std::vector<unsigned int>& envIndex,
+                          const std::vector<std::string>& scanId,
+                          const std::vector<std::string>& viewpointId,
+                          const std::vector<double>& heading,
+                          const std::vector<double>& elevation) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before resetEnvs";
+        throw std::runtime_error( msg.str() );
+    }
+    if (scanId.size() != envIndex.size() || viewpointId.size() != envIndex.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a scan, viewpoint, heading and elevation for each environment to reset" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<unsigned int> scans;
+    std::vector<unsigned int> ixs;
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        scans.push_back(navGraph.scanHandle(scanId[k]));
+        ixs.push_back(navGraph.index(scans.back(), viewpointId[k]));
+    }
+    resetEnvs(envIndex, scans, ixs, heading, elevation);
+}
+
+void Simulator::resetEnvs(const std::vector<unsigned int>& envIndex,
+                          const std::vector<unsigned int>& scanHandle,
+                          const std::vector<unsigned int>& viewpointIx,
+                          const std::vector<double>& heading,
+                          const std::vector<double>& elevation) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before resetEnvs";
+        throw std::runtime_error( msg.str() );
+    }
+    if (scanHandle.size() != envIndex.size() || viewpointIx.size() != envIndex.size()
+            || heading.size() != envIndex.size() || elevation.size() != envIndex.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a scan, viewpoint, heading and elevation for each environment to reset" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        if (envIndex[k] >= states.size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid environment index: " << envIndex[k] << " in a batch of " << states.size();
+            throw std::out_of_range( msg.str() );
+        }
+        if (!navGraph.included(scanHandle[k], viewpointIx[k])) {
+            throw std::invalid_argument( "MatterSim: ViewpointId: " + navGraph.viewpoint(scanHandle[k], viewpointIx[k])
+                    + ", is excluded from the connectivity graph." );
+        }
+    }
+    processTimer.Start();
+    std::vector<bool> reset(states.size(), false);
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        startEpisode(*states[envIndex[k]], scanHandle[k], viewpointIx[k], heading[k], elevation[k], navGraph);
+        reset[envIndex[k]] = true;
     }
+    update(reset);
     processTimer.Stop();
 }
 
 
+unsigned int Simulator::scanHandle(const std::string& scanId) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.scanHandle(scanId);
+}
+
+
+unsigned int Simulator::viewpointIndex(unsigned int scanHandle, const std::string& viewpointId) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.index(scanHandle, viewpointId);
+}
+
+
+std::vector<unsigned int> Simulator::viewpointIndices(const std::vector<std::string>& scanId,
+                                                     const std::vector<std::string>& viewpointId) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.index(scanHandles(scanId, navGraph), viewpointId);
+}
+
+
+std::vector<unsigned int> Simulator::scanHandles(const std::vector<std::string>& scanId, NavGraph& navGraph) const {
+    std::vector<unsigned int> scans;
+    scans.reserve(scanId.size());
+    for (unsigned int i=0; i<scanId.size(); ++i) {
+        // batches are usually grouped by scan
+        if (i > 0 && scanId[i] == scanId[i-1]) {
+            scans.push_back(scans.back());
+        } else {
+            scans.push_back(navGraph.scanHandle(scanId[i]));
+        }
+    }
+    return scans;
+}
+
+
+std::vector<float> Simulator::shortestPathDistances(const std::vector<unsigned int>& scanHandle,
+                                                    const std::vector<unsigned int>& from,
+                                                    const std::vector<unsigned int>& to) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.distances(scanHandle, from, to);
+}
+
+
+std::vector<float> Simulator::shortestPathDistances(const std::vector<std::string>& scanId,
+                                                    const std::vector<std::string>& from,
+                                                    const std::vector<std::string>& to) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    auto scans = scanHandles(scanId, navGraph);
+    return navGraph.distances(scans, navGraph.index(scans, from), navGraph.index(scans, to));
+}
+
+
+std::vector<unsigned int> Simulator::shortestPathNextHops(const std::vector<unsigned int>& scanHandle,
+                                                          const std::vector<unsigned int>& from,
+                                                          const std::vector<unsigned int>& to) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.nextHops(scanHandle, from, to);
+}
+
+
+std::vector<std::string> Simulator::shortestPathNextHops(const std::vector<std::string>& scanId,
+                                                         const std::vector<std::string>& from,
+                                                         const std::vector<std::string>& to) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    auto scans = scanHandles(scanId, navGraph);
+    auto hops = navGraph.nextHops(scans, navGraph.index(scans, from), navGraph.index(scans, to));
+    std::vector<std::string> viewpointIds(hops.size());
+    for (unsigned int i=0; i<hops.size(); ++i) {
+        if (hops[i] != noNextHop) {
+            viewpointIds[i] = navGraph.viewpoint(scans[i], hops[i]);
+        }
+    }
+    return viewpointIds;
+}
+
+
+std::vector<std::string> Simulator::shortestPath(const std::string& scanId, const std::string& from,
+                                                 const std::string& to) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    unsigned int scan = navGraph.scanHandle(scanId);
+    std::vector<std::string> path;
+    for (auto ix : navGraph.shortestPath(scan, navGraph.index(scan, from), navGraph.index(scan, to))) {
+        path.push_back(navGraph.viewpoint(scan, ix));
+    }
+    return path;
+}
+
+
+Actions Simulator::shortestPathActions(const std::vector<unsigned int>& goalViewpointIx) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before shortestPathActions";
+        throw std::runtime_error( msg.str() );
+    }
+    if (goalViewpointIx.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a goal viewpoint for each environment" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    Actions actions;
+    actions.index.assign(states.size(), 0);
+    actions.heading.assign(states.size(), 0.0);
+    actions.elevation.assign(states.size(), 0.0);
+    for (unsigned int i=0; i<states.size(); ++i) {
+        if (!teacherAction(*states[i], goalViewpointIx[i], navGraph, actions.index[i], actions.heading[i],
+                actions.elevation[i])) {
+            std::stringstream msg;
+            msg << "MatterSim: No path to the goal viewpoint in environment " << i << " of " << batchSize;
+            throw std::invalid_argument( msg.str() );
+        }
+    }
+    return actions;
+}
+
+bool Simulator::teacherAction(const SimState& state, unsigned int goal, NavGraph& navGraph, unsigned int& index,
+                              double& heading, double& elevation) const {
+    const double headingIncrement = M_PI*2.0/Navigator::headingCount;
+    const double threshold = M_PI/6.0;
+    index = 0;
+    heading = 0.0;
+    elevation = 0.0;
+    unsigned int ix = state.location->ix;
+    if (ix == goal) {
+        return true; // do nothing
+    }
+    unsigned int next = navGraph.nextHop(state.scanHandle, ix, goal);
+    if (next == noNextHop) {
+        return false;
+    }
+    // Same as viewIndex/headingCount with discretized viewing angles: 0 down, 1 horizon, 2 up
+    int level = 1;
+    if (state.elevation < -Navigator::elevationIncrement/2.0) {
+        level = 0;
+    } else if (state.elevation > Navigator::elevationIncrement/2.0) {
+        level = 2;
+    }
+    // Whether an elevation change would tilt the camera at all, which it won't past the elevation limits
+    auto canTilt = [&](double change) {
+        double h = 0.0, e = change, newHeading, newElevation;
+        unsigned int newViewIndex = state.viewIndex;
+        navigator->discretizeChange(h, e);
+        navigator->setHeadingElevation(state.heading, state.elevation + e, newHeading, newElevation, newViewIndex);
+        return newElevation != state.elevation;
+    };
+    // Can we see the next viewpoint?
+    for (unsigned int n=0; n<state.navigableLocations.size(); ++n) {
+        const Viewpoint& loc = *state.navigableLocations[n];
+        if (loc.ix != next) {
+            continue;
+        }
+        // Look directly at the viewpoint before moving
+        if (loc.rel_heading > threshold) {
+            heading = headingIncrement;
+        } else if (loc.rel_heading < -threshold) {
+            heading = -headingIncrement;
+        } else if (loc.rel_elevation > threshold && level < 2 && canTilt(Navigator::elevationIncrement)) {
+            elevation = Navigator::elevationIncrement;
+        } else if (loc.rel_elevation < -threshold && level > 0 && canTilt(-Navigator::elevationIncrement)) {
+            elevation = -Navigator::elevationIncrement;
+        } else {
+            index = n;
+        }
+        return true;
+    }
+    // Can't see it - first neutralize camera elevation, if the limits allow
+    if (level != 1 && canTilt(-state.elevation)) {
+        elevation = -state.elevation;
+        return true;
+    }
+    // Otherwise decide which way to turn
+    const glm::vec3& target = navGraph.cameraPosition(state.scanHandle, next);
+    double targetHeading = M_PI/2.0 - atan2(target.y - state.location->y, target.x - state.location->x);
+    if (targetHeading < 0) {
+        targetHeading += 2.0*M_PI;
+    }
+    if ((state.heading > targetHeading && state.heading - targetHeading < M_PI)
+            || (targetHeading > state.heading && targetHeading - state.heading > M_PI)) {
+        heading = -headingIncrement;
+    } else {
+        heading = headingIncrement;
+    }
+    return true;
+}
+
+
+Actions Simulator::shortestPathActions(const std::vector<std::string>& goalViewpointId) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before shortestPathActions";
+        throw std::runtime_error( msg.str() );
+    }
+    if (goalViewpointId.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a goal viewpoint for each environment" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<unsigned int> goals;
+    for (unsigned int i=0; i<states.size(); ++i) {
+        goals.push_back(navGraph.index(states[i]->scanHandle, goalViewpointId[i]));
+    }
+    return shortestPathActions(goals);
+}
+
+
+std::vector<unsigned int> Simulator::nearestViewpoints(const std::vector<unsigned int>& scanHandle,
+        const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.nearestViewpoints(scanHandle, points(x, y, z));
+}
+
+
+std::vector<std::vector<unsigned int> > Simulator::viewpointsWithin(const std::vector<unsigned int>& scanHandle,
+        const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z, double radius) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.viewpointsWithin(scanHandle, points(x, y, z), radius);
+}
+
+
+std::vector<glm::vec3> Simulator::points(const std::vector<double>& x, const std::vector<double>& y,
+        const std::vector<double>& z) const {
+    if (x.size() != y.size() || x.size() != z.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of x, y and z coordinates" );
+    }
+    std::vector<glm::vec3> result(x.size());
+    for (unsigned int i = 0; i < x.size(); ++i) {
+        result[i] = glm::vec3(x[i], y[i], z[i]);
+    }
+    return result;
+}
+
+
 void Simulator::newRandomEpisode(const std::vector<std::string>& scanId) {
-    std::vector<std::string> viewpointId;
+    if (!initialized) {
+        initialize();
+    }
+    std::vector<unsigned int> scans;
+    std::vector<unsigned int> ixs;
     std::vector<double> heading;
     std::vector<double> elevation(scanId.size(), 0.0);
     std::default_random_engine generator;
     std::uniform_real_distribution<double> distribution(0.0,M_PI*2.0);
-    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize);
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
     for (auto scan : scanId) {
-        viewpointId.push_back(navGraph.randomViewpoint(scan));
+        scans.push_back(navGraph.scanHandle(scan));
+        ixs.push_back(navGraph.randomViewpointIndex(scans.back()));
         heading.push_back(distribution(generator));
     }
-    newEpisode(scanId, viewpointId, heading, elevation);
+    newEpisode(scans, ixs, heading, elevation);
+}
+
+unsigned int Simulator::warmCache(const std::vector<std::string>& scanId, 
+                                  const std::vector<std::string>& viewpointId,
+                                  unsigned int hops, size_t memoryBudget) {
+    if (!initialized) {
+        initialize();
+    }
+    if (!renderingEnabled) {
+        // images are only needed for rendering
+        return 0;
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<unsigned int> scans;
+    std::vector<unsigned int> ixs;
+    for (unsigned int i=0; i<viewpointId.size(); ++i) {
+        scans.push_back(navGraph.scanHandle(scanId.at(i)));
+        ixs.push_back(navGraph.index(scans.back(), viewpointId.at(i)));
+    }
+    preloadTimer.Start();
+    unsigned int loaded = navGraph.warmCache(scans, ixs, hops, memoryBudget, minFaceSize);
+    preloadTimer.Stop();
+    return loaded;
 }
 
+
+unsigned int Simulator::warmCacheFromFile(const std::string& episodeFile, unsigned int hops, size_t memoryBudget) {
+    Json::Value root;
+    std::ifstream ifs(episodeFile, std::ifstream::in);
+    if (ifs.fail()){
+        throw std::invalid_argument( "MatterSim: Could not open episode file: " +
+                episodeFile + ", is path valid?" );
+    }
+    ifs >> root;
+    std::vector<std::string> scanId;
+    std::vector<std::string> viewpointId;
+    for (auto episode : root) {
+        for (auto viewpoint : episode["path"]) {
+            scanId.push_back(episode["scan"].asString());
+            viewpointId.push_back(viewpoint.asString());
+        }
+    }
+    return warmCache(scanId, viewpointId, hops, memoryBudget);
+}
+
+
 const std::vector<SimStatePtr>& Simulator::getState() {
     return this->states;
 }
 
-void Simulator::renderScene() {
-    frames += batchSize;
+std::vector<SimStatePtr> Simulator::getState(const std::vector<bool>& active) {
+    if (active.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected an active flag for each environment" );
+    }
+    std::vector<SimStatePtr> result;
+    for (unsigned int i=0; i<states.size(); ++i) {
+        if (active[i]) {
+            result.push_back(states[i]);
+        }
+    }
+    return result;
+}
+
+glm::mat4 Simulator::modelView(const SimStatePtr& state, NavGraph& navGraph) {
+    // Scale and move the cubemap model into position
+    Model = navGraph.cameraRotation(state->scanHandle,state->location->ix) * Scale;
+    // Opengl camera looking down -z axis. Rotate around x by -90deg (now looking down +y). Add positive elevation to look up.
+    RotateX = glm::rotate(glm::mat4(1.0f), -(float)M_PI / 2.0f + (float)state->elevation, glm::vec3(1.0f, 0.0f, 0.0f));
+    // Rotate camera around z for heading, positive heading will turn right.
+    View = glm::rotate(RotateX, (float)M_PI + (float)state->heading, glm::vec3(0.0f, 0.0f, 1.0f));
+    return View * Model;
+}
+
+void Simulator::unshareImages(unsigned int i) {
+    if (sharedImages[i]) {
+        // A snapshot still references the images, so render into new ones
+        states[i]->rgb = cv::Mat(height, width, CV_8UC3);
+        if (renderDepth) {
+            states[i]->depth = cv::Mat(height, width, CV_16UC1);
+        }
+        sharedImages[i] = false;
+    }
+}
+
+void Simulator::renderScene(const std::vector<SimStatePtr>& targets) {
+    frames += targets.size();
     loadTimer.Start();
-    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize);
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    // Read any missing images for the whole batch together before drawing starts
+    std::vector<unsigned int> scans;
+    std::vector<unsigned int> ixs;
+    std::vector<unsigned char> masks;
+    std::vector<unsigned int> asyncScans;
+    std::vector<unsigned int> asyncIxs;
+    std::vector<unsigned char> asyncMasks;
+    std::vector<unsigned char> faceMasks;
+    for (auto state : targets) {
+        unsigned char mask = lazyLoading ? visibleFaces(modelView(state, navGraph)) : allCubemapFaces;
+        faceMasks.push_back(mask);
+        state->lowResolution = false;
+        state->placeholder = false;
+        if (lowResFaceSize > 0) {
+            bool lowResLoaded = true;
+            if (deadlineMode) {
+                // Don't wait for the low resolution tier on the first frame of a scan either
+                navGraph.loadLowResolutionTexturesAsync(state->scanHandle, lowResFaceSize);
+                lowResLoaded = navGraph.lowResolutionTexturesLoaded(state->scanHandle);
+            } else {
+                navGraph.loadLowResolutionTextures(state->scanHandle, lowResFaceSize);
+            }
+            if (minFaceSize <= lowResFaceSize) {
+                // Full resolution would add no detail
+                state->lowResolution = true;
+                state->placeholder = !lowResLoaded;
+                continue;
+            }
+            if (deadlineMode && !navGraph.cubemapImagesLoaded(state->scanHandle, state->location->ix, mask, minFaceSize)) {
+                state->lowResolution = true;
+                state->placeholder = !lowResLoaded;
+                asyncScans.push_back(state->scanHandle);
+                asyncIxs.push_back(state->location->ix);
+                asyncMasks.push_back(mask);
+                continue;
+            }
+        }
+        scans.push_back(state->scanHandle);
+        ixs.push_back(state->location->ix);
+        masks.push_back(mask);
+    }
+    navGraph.loadCubemapImages(scans, ixs, masks, minFaceSize);
+    if (!asyncIxs.empty()) {
+        navGraph.loadCubemapImagesAsync(asyncScans, asyncIxs, asyncMasks, minFaceSize);
+    }
+    // With background uploads enabled, textures for later viewpoints are uploaded while earlier ones are drawn
+    std::vector<std::shared_future<void> > uploads = navGraph.uploadCubemapTextures(scans, ixs, masks, minFaceSize, *uploader);
     loadTimer.Stop();
-    for (auto state : states) {
+    unsigned int nextUpload = 0;
+    for (unsigned int i = 0; i < targets.size(); ++i) {
+        auto state = targets.at(i);
+        std::pair<GLuint, GLuint> texIds;
+        if (state->placeholder) {
+            state->rgb.setTo(cv::Scalar(0, 0, 0));
+            if (renderDepth) {
+                state->depth.setTo(cv::Scalar(0));
+            }
+            continue;
+        } else if (state->lowResolution) {
+            texIds = navGraph.lowResolutionTextures(state->scanHandle, state->location->ix);
+        } else {
+            loadTimer.Start();
+            uploads.at(nextUpload++).get();
+            texIds = navGraph.cubemapTextures(state->scanHandle, state->location->ix, faceMasks.at(i), minFaceSize);
+            loadTimer.Stop();
+        }
         renderTimer.Start();
-        std::pair<GLuint, GLuint> texIds = navGraph.cubemapTextures(state->scanId, state->location->ix);
+        glm::mat4 M = modelView(state, navGraph);
         glClear(GL_COLOR_BUFFER_BIT);
-        // Scale and move the cubemap model into position
-        Model = navGraph.cameraRotation(state->scanId,state->location->ix) * Scale;
-        // Opengl camera looking down -z axis. Rotate around x by -90deg (now looking down +y). Add positive elevation to look up.
-        RotateX = glm::rotate(glm::mat4(1.0f), -(float)M_PI / 2.0f + (float)state->elevation, glm::vec3(1.0f, 0.0f, 0.0f));
-        // Rotate camera around z for heading, positive heading will turn right.
-        View = glm::rotate(RotateX, (float)M_PI + (float)state->heading, glm::vec3(0.0f, 0.0f, 1.0f));
-        glm::mat4 M = View * Model;
         glUniformMatrix4fv(ModelViewMat, 1, GL_FALSE, glm::value_ptr(M));
         glUniform1i(isDepth, false);
         glViewport(0, 0, width, height);
@@ -498,49 +1101,440 @@ void Simulator::renderScene() {
     }
 }
 
+unsigned char Simulator::visibleFaces(const glm::mat4& modelView) const {
+    // Camera rays map to cubemap texture coordinates by the inverse of the model view rotation 
+    // (uniform scaling doesn't change which face is sampled)
+    glm::mat3 inverseRotation = glm::transpose(glm::mat3(modelView));
+    // Sample a grid of rays over a slightly enlarged image to be conservative at face boundaries
+    const int samples = 16;
+    const double margin = 1.1;
+    double tanV = tan(vfov / 2.0) * margin;
+    double tanH = tanV * width / height;
+    unsigned char mask = 0;
+    for (int i = 0; i <= samples; ++i) {
+        for (int j = 0; j <= samples; ++j) {
+            glm::vec3 ray((2.0*i/samples - 1.0) * tanH, (2.0*j/samples - 1.0) * tanV, -1.0);
+            glm::vec3 t = inverseRotation * ray;
+            float ax = fabs(t.x);
+            float ay = fabs(t.y);
+            float az = fabs(t.z);
+            // Faces are in OpenGL order +x, -x, +y, -y, +z, -z
+            if (ax >= ay && ax >= az) {
+                mask |= t.x > 0 ? 1 : 2;
+            } else if (ay >= az) {
+                mask |= t.y > 0 ? 4 : 8;
+            } else {
+                mask |= t.z > 0 ? 16 : 32;
+            }
+        }
+    }
+    return mask;
+}
+
 void Simulator::makeAction(const std::vector<unsigned int>& index, const std::vector<double>& heading, 
                         const std::vector<double>& elevation) {
-    processTimer.Start();
+    makeAction(index, heading, elevation, std::vector<bool>(states.size(), true));
+}
+
+void Simulator::makeAction(const std::vector<unsigned int>& index, const std::vector<double>& heading, 
+                        const std::vector<double>& elevation, const std::vector<bool>& active) {
     if (!initialized){
         std::stringstream msg;
         msg << "MatterSim: newEpisode must be called before makeAction";
         throw std::runtime_error( msg.str() );
     }
-    std::vector<double> newHeading;
-    std::vector<double> newElevation;
+    if (active.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected an active flag for each environment" );
+    }
     for (unsigned int i=0; i<states.size(); ++i) {
-        auto state = states.at(i);
-        if (index.at(i) >= state->navigableLocations.size() ){
+        if (active[i] && index.at(i) >= states[i]->navigableLocations.size() ){
             std::stringstream msg;
             msg << "MatterSim: Invalid action index: " << index.at(i) << " in environment " <<
                   i << " of " << batchSize;
             throw std::domain_error( msg.str() );
         }
+    }
+    processTimer.Start();
+    for (unsigned int i=0; i<states.size(); ++i) {
+        if (!active[i]) {
+            continue;
+        }
+        const SimStatePtr& state = states.at(i);
+        // The location is replaced when navigable locations are found, so the candidate (which may
+        // be shared with a snapshot) is left unchanged
         state->location = state->navigableLocations[index.at(i)];
-        state->location->rel_heading = 0.0;
-        state->location->rel_elevation = 0.0;
-        state->location->rel_distance = 0.0;
         state->step += 1;
         double h = heading.at(i);
         double e = elevation.at(i);
-        if (discretizeViews) {
-            // Increments based on sign of input
-            if (h > 0.0) h = M_PI*2.0/headingCount;
-            if (h < 0.0) h = -M_PI*2.0/headingCount;
-            if (e > 0.0) e =  elevationIncrement;
-            if (e < 0.0) e = -elevationIncrement;
-        }
-        newHeading.push_back(state->heading + h);
-        newElevation.push_back(state->elevation + e);
-    }
-    setHeadingElevation(newHeading, newElevation);
-    populateNavigable();
-    if (renderingEnabled) {
-        renderScene();
+        navigator->discretizeChange(h, e);
+        setHeadingElevation(*state, state->heading + h, state->elevation + e);
     }
+    update(active);
     processTimer.Stop();
 }
 
+void Simulator::executeSequence(const std::vector<std::vector<unsigned int> >& index,
+                                const std::vector<std::vector<double> >& heading,
+                                const std::vector<std::vector<double> >& elevation) {
+    runSequence(index, heading, elevation, NULL);
+}
+
+void Simulator::executeSequence(const std::vector<std::vector<unsigned int> >& index,
+                                const std::vector<std::vector<double> >& heading,
+                                const std::vector<std::vector<double> >& elevation, TrajectoryLog& log) {
+    runSequence(index, heading, elevation, &log);
+}
+
+void Simulator::runSequence(const std::vector<std::vector<unsigned int> >& index,
+                            const std::vector<std::vector<double> >& heading,
+                            const std::vector<std::vector<double> >& elevation, TrajectoryLog* log) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before executeSequence";
+        throw std::runtime_error( msg.str() );
+    }
+    if (index.size() != states.size() || heading.size() != states.size() || elevation.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a sequence of actions for each environment" );
+    }
+    for (unsigned int i=0; i<states.size(); ++i) {
+        if (heading[i].size() != index[i].size() || elevation[i].size() != index[i].size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Expected an index, heading and elevation for each step in environment " <<
+                  i << " of " << batchSize;
+            throw std::invalid_argument( msg.str() );
+        }
+    }
+    size_t maxSteps = 0;
+    for (unsigned int i=0; i<states.size(); ++i) {
+        maxSteps = std::max(maxSteps, index[i].size());
+    }
+    std::vector<size_t> steps(states.size(), 0);
+    execute([&](unsigned int i, unsigned int& ix, double& h, double& e) {
+        size_t t = steps[i]++;
+        if (t >= index[i].size()) {
+            return false;
+        }
+        ix = index[i][t];
+        h = heading[i][t];
+        e = elevation[i][t];
+        return true;
+    }, maxSteps, log);
+}
+
+void Simulator::executePath(const std::vector<std::vector<unsigned int> >& viewpointIx) {
+    runPath(viewpointIx, NULL);
+}
+
+void Simulator::executePath(const std::vector<std::vector<unsigned int> >& viewpointIx, TrajectoryLog& log) {
+    runPath(viewpointIx, &log);
+}
+
+void Simulator::executePath(const std::vector<std::vector<std::string> >& viewpointId) {
+    runPath(pathIndices(viewpointId), NULL);
+}
+
+void Simulator::executePath(const std::vector<std::vector<std::string> >& viewpointId, TrajectoryLog& log) {
+    runPath(pathIndices(viewpointId), &log);
+}
+
+std::vector<std::vector<unsigned int> > Simulator::pathIndices(
+        const std::vector<std::vector<std::string> >& viewpointId) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before executePath";
+        throw std::runtime_error( msg.str() );
+    }
+    if (viewpointId.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a path for each environment" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    std::vector<std::vector<unsigned int> > viewpointIx(states.size());
+    for (unsigned int i=0; i<states.size(); ++i) {
+        for (const std::string& id : viewpointId[i]) {
+            viewpointIx[i].push_back(navGraph.index(states[i]->scanHandle, id));
+        }
+    }
+    return viewpointIx;
+}
+
+void Simulator::runPath(const std::vector<std::vector<unsigned int> >& viewpointIx, TrajectoryLog* log) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before executePath";
+        throw std::runtime_error( msg.str() );
+    }
+    if (viewpointIx.size() != states.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a path for each environment" );
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    // Check every path before moving, so a bad path leaves the batch unchanged
+    size_t maxSteps = 0;
+    for (unsigned int i=0; i<states.size(); ++i) {
+        unsigned int scan = states[i]->scanHandle;
+        unsigned int from = states[i]->location->ix;
+        size_t hops = 0;
+        for (unsigned int ix : viewpointIx[i]) {
+            if (ix >= navGraph.viewpointCount(scan) || std::isinf(navGraph.distance(scan, from, ix))) {
+                std::stringstream msg;
+                msg << "MatterSim: No path to viewpoint " << ix << " in environment " << i << " of " << batchSize;
+                throw std::invalid_argument( msg.str() );
+            }
+            for (; from != ix; ++hops) {
+                from = navGraph.nextHop(scan, from, ix);
+            }
+        }
+        // Each hop takes at most a full turn, levelling out, two tilts and a move
+        maxSteps = std::max(maxSteps, hops * (Navigator::headingCount + 4));
+    }
+    std::vector<size_t> next(states.size(), 0);
+    execute([&](unsigned int i, unsigned int& ix, double& h, double& e) {
+        const SimState& state = *states[i];
+        const std::vector<unsigned int>& path = viewpointIx[i];
+        while (next[i] < path.size() && path[next[i]] == state.location->ix) {
+            ++next[i];
+        }
+        if (next[i] == path.size()) {
+            return false;
+        }
+        return teacherAction(state, path[next[i]], navGraph, ix, h, e);
+    }, maxSteps, log);
+}
+
+void Simulator::execute(const std::function<bool(unsigned int, unsigned int&, double&, double&)>& nextAction,
+                        size_t maxSteps, TrajectoryLog* log) {
+    std::vector<unsigned int> loggedEnvs; // environment of each logged step, in the order they were taken
+    auto logStep = [&](unsigned int i) {
+        const SimState& state = *states[i];
+        loggedEnvs.push_back(i);
+        log->viewpointIx.push_back(state.location->ix);
+        log->heading.push_back(state.heading);
+        log->elevation.push_back(state.elevation);
+        log->viewIndex.push_back(state.viewIndex);
+        if (renderingEnabled) {
+            size_t rowBytes = width * 3;
+            size_t offset = log->rgb.size();
+            log->rgb.resize(offset + height * rowBytes);
+            for (int r = 0; r < height; ++r) {
+                std::memcpy(&log->rgb[offset + r * rowBytes], state.rgb.ptr(r), rowBytes);
+            }
+            if (renderDepth) {
+                offset = log->depth.size();
+                log->depth.resize(offset + height * width);
+                for (int r = 0; r < height; ++r) {
+                    std::memcpy(&log->depth[offset + r * width], state.depth.ptr(r), width * sizeof(unsigned short));
+                }
+            }
+        }
+    };
+    if (log) {
+        *log = TrajectoryLog();
+        log->width = width;
+        log->height = height;
+        for (unsigned int i=0; i<states.size(); ++i) {
+            logStep(i);
+        }
+    }
+    std::vector<bool> active(states.size());
+    std::vector<unsigned int> index(states.size());
+    std::vector<double> heading(states.size());
+    std::vector<double> elevation(states.size());
+    for (size_t step = 0; ; ++step) {
+        bool any = false;
+        for (unsigned int i=0; i<states.size(); ++i) {
+            active[i] = nextAction(i, index[i], heading[i], elevation[i]);
+            any = any || active[i];
+        }
+        if (!any) {
+            break;
+        }
+        if (step == maxSteps) {
+            unsigned int i = std::find(active.begin(), active.end(), true) - active.begin();
+            std::stringstream msg;
+            msg << "MatterSim: Environment " << i << " of " << batchSize << " didn't finish within " <<
+                  maxSteps << " steps";
+            throw std::runtime_error( msg.str() );
+        }
+        makeAction(index, heading, elevation, active);
+        if (log) {
+            for (unsigned int i=0; i<states.size(); ++i) {
+                if (active[i]) {
+                    logStep(i);
+                }
+            }
+        }
+    }
+    if (log) {
+        // Group the steps by environment
+        log->offsets.assign(states.size() + 1, 0);
+        for (unsigned int i : loggedEnvs) {
+            log->offsets[i + 1] += 1;
+        }
+        for (unsigned int i=0; i<states.size(); ++i) {
+            log->offsets[i + 1] += log->offsets[i];
+        }
+        std::vector<size_t> position(log->offsets.begin(), log->offsets.end() - 1);
+        std::vector<size_t> order(loggedEnvs.size()); // logged step at each position
+        for (size_t k=0; k<loggedEnvs.size(); ++k) {
+            order[position[loggedEnvs[k]]++] = k;
+        }
+        reorder(log->viewpointIx, order, 1);
+        reorder(log->heading, order, 1);
+        reorder(log->elevation, order, 1);
+        reorder(log->viewIndex, order, 1);
+        reorder(log->rgb, order, height * width * 3);
+        reorder(log->depth, order, height * width);
+    }
+}
+
+std::vector<SimStatePtr> Simulator::peek(const std::vector<unsigned int>& envIndex,
+                        const std::vector<unsigned int>& index, const std::vector<double>& heading,
+                        const std::vector<double>& elevation) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before peek";
+        throw std::runtime_error( msg.str() );
+    }
+    if (index.size() != envIndex.size() || heading.size() != envIndex.size()
+            || elevation.size() != envIndex.size()) {
+        throw std::invalid_argument( "MatterSim: Expected an action for each observation" );
+    }
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        if (envIndex[k] >= states.size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid environment index: " << envIndex[k] << " in a batch of " << states.size();
+            throw std::out_of_range( msg.str() );
+        }
+        if (index[k] >= states[envIndex[k]]->navigableLocations.size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid action index: " << index[k] << " in environment " <<
+                  envIndex[k] << " of " << batchSize;
+            throw std::domain_error( msg.str() );
+        }
+    }
+    processTimer.Start();
+    std::vector<SimStatePtr> observations;
+    observations.reserve(envIndex.size());
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        const SimState& state = *states[envIndex[k]];
+        SimStatePtr observation = std::make_shared<SimState>();
+        observation->scanId = state.scanId;
+        observation->scanHandle = state.scanHandle;
+        observation->step = state.step + 1;
+        observation->rgb = cv::Mat(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
+        observation->depth = cv::Mat(height, width, CV_16UC1, cv::Scalar(0));
+        observation->location = state.navigableLocations[index[k]];
+        double h = heading[k];
+        double e = elevation[k];
+        navigator->discretizeChange(h, e);
+        setHeadingElevation(*observation, state.heading + h, state.elevation + e);
+        observations.push_back(observation);
+    }
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    int count = observations.size();
+    #pragma omp parallel for schedule(static) if(count >= parallelBatchSize)
+    for (int n = 0; n < count; ++n) {
+        populateNavigable(*observations[n], navGraph);
+    }
+    if (renderingEnabled && !observations.empty()) {
+        renderScene(observations);
+    }
+    processTimer.Stop();
+    return observations;
+}
+
+std::vector<SimStatePtr> Simulator::snapshot() {
+    std::vector<unsigned int> envIndex(states.size());
+    std::iota(envIndex.begin(), envIndex.end(), 0);
+    return snapshot(envIndex);
+}
+
+std::vector<SimStatePtr> Simulator::snapshot(const std::vector<unsigned int>& envIndex) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before snapshot";
+        throw std::runtime_error( msg.str() );
+    }
+    for (unsigned int i : envIndex) {
+        if (i >= states.size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid environment index: " << i << " in a batch of " << states.size();
+            throw std::out_of_range( msg.str() );
+        }
+    }
+    std::vector<SimStatePtr> copies;
+    copies.reserve(envIndex.size());
+    for (unsigned int i : envIndex) {
+        copies.push_back(std::make_shared<SimState>(*states[i]));
+        sharedImages[i] = true;
+    }
+    return copies;
+}
+
+void Simulator::restore(const std::vector<SimStatePtr>& snapshot) {
+    std::vector<unsigned int> envIndex(states.size());
+    std::iota(envIndex.begin(), envIndex.end(), 0);
+    restore(envIndex, snapshot);
+}
+
+void Simulator::restore(const std::vector<unsigned int>& envIndex, const std::vector<SimStatePtr>& snapshot) {
+    if (!initialized) {
+        initialize();
+    }
+    if (envIndex.size() != snapshot.size()) {
+        throw std::invalid_argument( "MatterSim: Expected a state for each environment to restore" );
+    }
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        if (envIndex[k] >= states.size()) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid environment index: " << envIndex[k] << " in a batch of " << states.size();
+            throw std::out_of_range( msg.str() );
+        }
+        const SimStatePtr& source = snapshot[k];
+        if (!source || !source->location) {
+            throw std::invalid_argument( "MatterSim: Can't restore a state without a location" );
+        }
+        if (source->rgb.rows != height || source->rgb.cols != width) {
+            throw std::invalid_argument( "MatterSim: Can't restore a state rendered at a different resolution" );
+        }
+    }
+    // Copy every source before any environment changes, since sources may be states in the batch
+    std::vector<SimState> sources;
+    sources.reserve(snapshot.size());
+    for (const SimStatePtr& source : snapshot) {
+        sources.push_back(*source);
+        auto live = envIndices.find(source.get());
+        if (live != envIndices.end()) {
+            sharedImages[live->second] = true;
+        }
+    }
+    for (unsigned int k=0; k<envIndex.size(); ++k) {
+        *states[envIndex[k]] = std::move(sources[k]);
+        sharedImages[envIndex[k]] = true;
+    }
+}
+
+void Simulator::fork(unsigned int envIndex, unsigned int k) {
+    if (!initialized || !states.front()->location) {
+        std::stringstream msg;
+        msg << "MatterSim: newEpisode must be called before fork";
+        throw std::runtime_error( msg.str() );
+    }
+    if (envIndex >= states.size() || k >= states.size() - envIndex) {
+        std::stringstream msg;
+        msg << "MatterSim: Can't fork environment " << envIndex << " into the " << k
+            << " environments after it in a batch of " << states.size();
+        throw std::out_of_range( msg.str() );
+    }
+    const SimState& source = *states[envIndex];
+    for (unsigned int i = envIndex + 1; i <= envIndex + k; ++i) {
+        *states[i] = source;
+        sharedImages[i] = true;
+    }
+    if (k > 0) {
+        sharedImages[envIndex] = true;
+    }
+}
+
 void Simulator::close() {
     if (initialized) {
         if (renderingEnabled) {
@@ -555,6 +1549,7 @@ void Simulator::close() {
             glDeleteShader(glShaderF);
             glDeleteShader(glShaderV);
             glDeleteProgram(glProgram);
+            uploader.reset();
 #ifdef OSMESA_RENDERING
             free( buffer );
             buffer = NULL;
@@ -565,6 +1560,7 @@ void Simulator::close() {
             cv::destroyAllWindows();
 #endif
         }
+        navigator.reset();
         initialized = false;
     }
 }
@@ -577,6 +1573,11 @@ void Simulator::resetTimers() {
     wallTimer.Reset();
 }
 
+CacheStats Simulator::cacheStats() {
+    auto& navGraph = NavGraph::getInstance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize, cachePolicy, cacheCapacity);
+    return navGraph.cacheStats();
+}
+
 std::string Simulator::timingInfo() {
     std::ostringstream oss;
     float f = static_cast<float>(frames);
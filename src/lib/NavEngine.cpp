@@ -0,0 +1,212 @@
+#include <sstream>
+#include <algorithm>
+
+#include "NavEngine.hpp"
+
+namespace mattersim {
+
+NavEngine::NavEngine() : initialized(false),
+                         discretizeViews(false),
+                         restrictedNavigation(true),
+                         candidateTablesEnabled(false),
+                         width(320),
+                         height(240),
+                         batchSize(1),
+                         maxCandidates(0),
+                         vfov(0.8),
+                         minElevation(-0.94),
+                         maxElevation(0.94),
+                         navGraphPath("./connectivity") {
+}
+
+void NavEngine::setNavGraphPath(const std::string& path) {
+    if (!initialized) {
+        navGraphPath = path;
+    }
+}
+
+void NavEngine::setCameraResolution(int width, int height) {
+    if (!initialized) {
+        this->width = width;
+        this->height = height;
+    }
+}
+
+void NavEngine::setCameraVFOV(double vfov) {
+    if (!initialized) {
+        this->vfov = vfov;
+    }
+}
+
+bool NavEngine::setElevationLimits(double min, double max) {
+    if (!initialized && min < 0.0 && min > -M_PI/2.0 && max > 0.0 && max < M_PI/2.0) {
+        minElevation = min;
+        maxElevation = max;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void NavEngine::setDiscretizedViewingAngles(bool value) {
+    if (!initialized) {
+        discretizeViews = value;
+    }
+}
+
+void NavEngine::setRestrictedNavigation(bool value) {
+    if (!initialized) {
+        restrictedNavigation = value;
+    }
+}
+
+void NavEngine::setCandidateTablesEnabled(bool value) {
+    if (!initialized) {
+        candidateTablesEnabled = value;
+    }
+}
+
+void NavEngine::setBatchSize(unsigned int size) {
+    if (!initialized) {
+        batchSize = size;
+    }
+}
+
+void NavEngine::setMaxCandidates(unsigned int count) {
+    if (!initialized) {
+        maxCandidates = count;
+    }
+}
+
+NavGraph& NavEngine::navGraph() {
+    // Images are never loaded, so leave them for a Simulator to configure
+    return NavGraph::getInstance(navGraphPath);
+}
+
+void NavEngine::initialize() {
+    if (initialized) {
+        return;
+    }
+    auto& graph = navGraph();
+    if (maxCandidates == 0) {
+        // The current viewpoint, and every reachable viewpoint
+        for (unsigned int scan = 0; scan < graph.scanCount(); ++scan) {
+            for (unsigned int ix = 0; ix < graph.viewpointCount(scan); ++ix) {
+                maxCandidates = std::max<unsigned int>(maxCandidates, 1 + graph.adjacentViewpoints(scan, ix).size());
+            }
+        }
+    }
+    navigator.reset(new Navigator(discretizeViews, restrictedNavigation, vfov * width / height / 2.0,
+            minElevation, maxElevation, candidateTablesEnabled));
+    state.scanHandle.assign(batchSize, 0);
+    state.ix.assign(batchSize, 0);
+    state.heading.assign(batchSize, 0.0);
+    state.elevation.assign(batchSize, 0.0);
+    state.viewIndex.assign(batchSize, 0);
+    state.step.assign(batchSize, 0);
+    state.maxCandidates = maxCandidates;
+    state.candidateCount.assign(batchSize, 0);
+    state.candidateIx.assign(size_t(batchSize) * maxCandidates, noCandidate);
+    state.candidateDistance.assign(size_t(batchSize) * maxCandidates, 0.f);
+    state.candidateHeading.assign(size_t(batchSize) * maxCandidates, 0.0);
+    state.candidateElevation.assign(size_t(batchSize) * maxCandidates, 0.0);
+    initialized = true;
+}
+
+unsigned int NavEngine::scanHandle(const std::string& scanId) {
+    return navGraph().scanHandle(scanId);
+}
+
+unsigned int NavEngine::viewpointIndex(unsigned int scanHandle, const std::string& viewpointId) {
+    return navGraph().index(scanHandle, viewpointId);
+}
+
+void NavEngine::reset(const std::vector<unsigned int>& scanHandle, const std::vector<unsigned int>& viewpointIx,
+              const std::vector<double>& heading, const std::vector<double>& elevation) {
+    if (!initialized) {
+        initialize();
+    }
+    if (scanHandle.size() != batchSize || viewpointIx.size() != batchSize || heading.size() != batchSize
+            || elevation.size() != batchSize) {
+        throw std::invalid_argument( "MatterSim: Expected a scan, viewpoint, heading and elevation for each environment" );
+    }
+    auto& graph = navGraph();
+    for (unsigned int n = 0; n < batchSize; ++n) {
+        if (!graph.included(scanHandle[n], viewpointIx[n])) {
+            throw std::invalid_argument( "MatterSim: ViewpointId: " + graph.viewpoint(scanHandle[n], viewpointIx[n])
+                    + ", is excluded from the connectivity graph." );
+        }
+    }
+    int count = batchSize;
+    // Environments are independent, so large batches are split across threads
+    #pragma omp parallel for schedule(static) if(count >= parallelBatchSize)
+    for (int n = 0; n < count; ++n) {
+        state.scanHandle[n] = scanHandle[n];
+        state.ix[n] = viewpointIx[n];
+        state.step[n] = 0;
+        navigator->setHeadingElevation(heading[n], elevation[n], state.heading[n], state.elevation[n],
+                state.viewIndex[n]);
+        updateCandidates(n, graph);
+    }
+}
+
+void NavEngine::step(const std::vector<unsigned int>& index, const std::vector<double>& heading,
+              const std::vector<double>& elevation) {
+    if (!initialized) {
+        std::stringstream msg;
+        msg << "MatterSim: reset must be called before step";
+        throw std::runtime_error( msg.str() );
+    }
+    if (index.size() != batchSize || heading.size() != batchSize || elevation.size() != batchSize) {
+        throw std::invalid_argument( "MatterSim: Expected an index, heading and elevation for each environment" );
+    }
+    for (unsigned int n = 0; n < batchSize; ++n) {
+        if (index[n] >= state.candidateCount[n]) {
+            std::stringstream msg;
+            msg << "MatterSim: Invalid action index: " << index[n] << " in environment " <<
+                  n << " of " << batchSize;
+            throw std::domain_error( msg.str() );
+        }
+    }
+    auto& graph = navGraph();
+    int count = batchSize;
+    #pragma omp parallel for schedule(static) if(count >= parallelBatchSize)
+    for (int n = 0; n < count; ++n) {
+        state.ix[n] = state.candidateIx[size_t(n) * maxCandidates + index[n]];
+        state.step[n] += 1;
+        double h = heading[n];
+        double e = elevation[n];
+        navigator->discretizeChange(h, e);
+        navigator->setHeadingElevation(state.heading[n] + h, state.elevation[n] + e, state.heading[n],
+                state.elevation[n], state.viewIndex[n]);
+        updateCandidates(n, graph);
+    }
+}
+
+void NavEngine::updateCandidates(unsigned int n, const NavGraph& graph) {
+    Span<Candidate> sorted = navigator->candidates(graph, state.scanHandle[n], state.ix[n], state.heading[n],
+            state.elevation[n], state.viewIndex[n]);
+    unsigned int count = std::min<size_t>(sorted.size(), maxCandidates);
+    size_t offset = size_t(n) * maxCandidates;
+    for (unsigned int k = 0; k < count; ++k) {
+        const Candidate& c = sorted[k];
+        state.candidateIx[offset + k] = c.ix;
+        state.candidateDistance[offset + k] = c.distance;
+        state.candidateHeading[offset + k] = c.rel_heading;
+        state.candidateElevation[offset + k] = c.rel_elevation;
+    }
+    // Clear whatever the previous candidates left in the padding
+    for (unsigned int k = count; k < state.candidateCount[n]; ++k) {
+        state.candidateIx[offset + k] = noCandidate;
+        state.candidateDistance[offset + k] = 0.f;
+        state.candidateHeading[offset + k] = 0.0;
+        state.candidateElevation[offset + k] = 0.0;
+    }
+    state.candidateCount[n] = count;
+}
+
+const NavBatchState& NavEngine::getState() const {
+    return state;
+}
+
+}
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <fstream>
 #include <iterator>
+#include <algorithm>
+#include <chrono>
 #include <opencv2/opencv.hpp>
 
 #include <json/json.h>
@@ -8,116 +10,251 @@
 #include <omp.h>
 #endif
 #include "NavGraph.hpp"
+#include "SkyboxDecoder.hpp"
+#include "FileReader.hpp"
+#include "TextureUploader.hpp"
+#include "NavGraphFile.hpp"
+#include "ShortestPaths.hpp"
 
 namespace mattersim {
 
+namespace {
 
-NavGraph::Location::Location(const Json::Value& viewpoint, const std::string& skyboxDir, 
-        bool preload, bool depth): skyboxDir(skyboxDir), im_loaded(false), 
-                                   includeDepth(depth), cubemap_texture(0), depth_texture(0) {
-
-    viewpointId = viewpoint["image_id"].asString();
-    included = viewpoint["included"].asBool();
+    // Split a 16 bit grayscale skybox strip into cubemap faces in OpenGL order. 
+    // PNG can't be partially decoded so all faces are loaded.
+    void decodeDepthSkybox(const std::vector<unsigned char>& data, const std::string& filename,
+            std::vector<cv::Mat>& faces) {
+        cv::Mat depth = cv::imdecode(data, CV_LOAD_IMAGE_ANYDEPTH);
+        if (depth.empty()) {
+            throw std::invalid_argument( "MatterSim: Could not open skybox depth files at: " + filename);
+        }
+        int w = depth.cols/6;
+        int h = depth.rows;
+        faces.resize(6);
+        for (unsigned int i = 0; i < 6; ++i) {
+            faces[i] = depth(cv::Rect(skyboxStripIndex[i]*w, 0, w, h));
+        }
+    }
 
-    float posearr[16];
-    int i = 0;
-    for (auto f : viewpoint["pose"]) {
-        posearr[i++] = f.asFloat();
+    // True if RGB images decoded for one minimum face size are also good enough for another,
+    // where 0 means full resolution
+    bool faceSizeSatisfies(unsigned int decoded, unsigned int required) {
+        return decoded == 0 || (required != 0 && required <= decoded);
     }
-    // glm uses column-major order. Inputs are in row-major order.
-    rot = glm::transpose(glm::make_mat4(posearr));
-    // glm access is col,row
-    pos = glm::vec3{rot[3][0], rot[3][1], rot[3][2]};
-    rot[3] = {0,0,0,1}; // remove translation component
-    
-    for (auto u : viewpoint["unobstructed"]) {
-        unobstructed.push_back(u.asBool());
+
+    // Create a complete cubemap texture from six face images in OpenGL order
+    GLuint createCubemapTexture(const std::vector<cv::Mat>& faces, GLint internalFormat, GLenum format,
+            GLenum type, GLint filter) {
+        GLuint texture;
+        glActiveTexture(GL_TEXTURE0);
+        glEnable(GL_TEXTURE_CUBE_MAP);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        for (unsigned int i = 0; i < 6; ++i) {
+            const cv::Mat& face = faces[i];
+            //use fast 4-byte alignment (default anyway) if possible
+            glPixelStorei(GL_UNPACK_ALIGNMENT, (face.step & 3) ? 1 : 4);
+            //set length of one complete row in data (doesn't need to equal image.cols)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, face.step/face.elemSize());
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internalFormat, face.rows, face.cols, 0, format, type, face.ptr());
+        }
+        return texture;
     }
 
+}
+
+
+NavGraph::Location::Location(const std::string& viewpointId, const std::string& skyboxDir, 
+        bool preload, bool depth): viewpointId(viewpointId), skyboxDir(skyboxDir), 
+                                   im_loaded(0), tex_loaded(0), tex_bytes(0), includeDepth(depth), 
+                                   imageFaceSize(0), textureFaceSize(0), cubemap_texture(0), depth_texture(0), 
+                                   lowres_texture(0), lowres_depth_texture(0) {
     if (preload) {
         // Preload skybox images
-        loadCubemapImages();
+        loadCubemapImages(allCubemapFaces, 0);
     }
 };
 
 
-void NavGraph::Location::loadCubemapImages() {
-    cv::Mat rgb = cv::imread(skyboxDir + viewpointId + "_skybox_small.jpg");
-    int w = rgb.cols/6;
-    int h = rgb.rows;
-    xpos = rgb(cv::Rect(2*w, 0, w, h));
-    xneg = rgb(cv::Rect(4*w, 0, w, h));
-    ypos = rgb(cv::Rect(0*w, 0, w, h));
-    yneg = rgb(cv::Rect(5*w, 0, w, h));
-    zpos = rgb(cv::Rect(1*w, 0, w, h));
-    zneg = rgb(cv::Rect(3*w, 0, w, h));
-    if (xpos.empty() || xneg.empty() || ypos.empty() || yneg.empty() || zpos.empty() || zneg.empty()) {
-        throw std::invalid_argument( "MatterSim: Could not open skybox RGB files at: " + skyboxDir + viewpointId + "_skybox_small.jpg");
+std::string NavGraph::Location::rgbFile() const {
+    return skyboxDir + viewpointId + "_skybox_small.jpg";
+}
+
+
+std::string NavGraph::Location::depthFile() const {
+    return skyboxDir + viewpointId + "_skybox_depth_small.png";
+}
+
+
+std::pair<std::string, std::string> NavGraph::Location::missingImageFiles(unsigned char faceMask, 
+        unsigned int minFaceSize) const {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    std::pair<std::string, std::string> files;
+    if ((im_loaded & faceMask) != faceMask || 
+            (im_loaded != 0 && !faceSizeSatisfies(imageFaceSize, minFaceSize))) {
+        files.first = rgbFile();
     }
-    if (includeDepth) {
-        // 16 bit grayscale images
-        cv::Mat depth = cv::imread(skyboxDir + viewpointId + "_skybox_depth_small.png", CV_LOAD_IMAGE_ANYDEPTH);
-        w = depth.cols/6;
-        h = depth.rows;
-        xposD = depth(cv::Rect(2*w, 0, w, h));
-        xnegD = depth(cv::Rect(4*w, 0, w, h));
-        yposD = depth(cv::Rect(0*w, 0, w, h));
-        ynegD = depth(cv::Rect(5*w, 0, w, h));
-        zposD = depth(cv::Rect(1*w, 0, w, h));
-        znegD = depth(cv::Rect(3*w, 0, w, h));
-        if (xposD.empty() || xnegD.empty() || yposD.empty() || ynegD.empty() || zposD.empty() || znegD.empty()) {
-            throw std::invalid_argument( "MatterSim: Could not open skybox depth files at: " + skyboxDir + viewpointId + "_skybox_depth_small.png");
+    if (includeDepth && depthFaces.empty()) {
+        files.second = depthFile();
+    }
+    return files;
+}
+
+
+void NavGraph::Location::decodeCubemapImages(unsigned char faceMask, unsigned int minFaceSize,
+        const std::vector<unsigned char>& data) {
+    while (true) {
+        // All faces of a cubemap must be the same size, so missing faces are decoded at the size
+        // of the loaded ones, unless those are too small and must all be decoded again
+        unsigned int faceSize = minFaceSize;
+        unsigned char request = faceMask;
+        {
+            std::lock_guard<std::mutex> lock(imageMutex);
+            if (im_loaded != 0 && faceSizeSatisfies(imageFaceSize, minFaceSize)) {
+                faceSize = imageFaceSize;
+                request &= ~im_loaded;
+            } else {
+                request |= im_loaded;
+            }
+        }
+        if (request == 0) {
+            return;
+        }
+        // Decode outside the lock, then only add faces that weren't loaded meanwhile by another thread
+        std::vector<cv::Mat> decoded;
+        unsigned char mask = decodeSkybox(data, rgbFile(), faceSize, request, decoded);
+        std::lock_guard<std::mutex> lock(imageMutex);
+        if (im_loaded != 0 && faceSize != imageFaceSize) {
+            if (!faceSizeSatisfies(faceSize, imageFaceSize)) {
+                // Another thread loaded larger faces meanwhile, so decode again to match them
+                continue;
+            }
+            im_loaded = 0;
+            faces.clear();
         }
+        imageFaceSize = faceSize;
+        faces.resize(6);
+        for (unsigned int i = 0; i < 6; ++i) {
+            if ((mask & ~im_loaded) & (1 << i)) {
+                faces[i] = decoded[i];
+            }
+        }
+        im_loaded |= mask;
+        return;
+    }
+}
+
+
+void NavGraph::Location::decodeDepthImages(const std::vector<unsigned char>& data) {
+    std::vector<cv::Mat> decoded;
+    decodeDepthSkybox(data, depthFile(), decoded);
+    std::lock_guard<std::mutex> lock(imageMutex);
+    if (depthFaces.empty()) {
+        depthFaces.swap(decoded);
     }
-    im_loaded = true;
 }
 
 
-void NavGraph::Location::loadCubemapTextures() {
+size_t NavGraph::Location::imageBytes() const {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    size_t bytes = 0;
+    for (auto& face : faces) {
+        bytes += face.total() * face.elemSize();
+    }
+    for (auto& face : depthFaces) {
+        bytes += face.total() * face.elemSize();
+    }
+    return bytes;
+}
+
+
+void NavGraph::Location::loadCubemapImages(unsigned char faceMask, unsigned int minFaceSize) {
+    std::pair<std::string, std::string> files = missingImageFiles(faceMask, minFaceSize);
+    std::vector<unsigned char> data;
+    if (!files.first.empty()) {
+        readFile(files.first, data);
+        decodeCubemapImages(faceMask, minFaceSize, data);
+    }
+    if (!files.second.empty()) {
+        readFile(files.second, data);
+        decodeDepthImages(data);
+    }
+}
+
+
+void NavGraph::Location::loadCubemapTextures(unsigned char faceMask) {
+    // Storage for all faces is allocated when the texture is created so that the cubemap is 
+    // complete, but only faces in faceMask are filled. The others are uploaded when requested.
+    // Faces are staged through a pixel unpack buffer so the transfer doesn't block this thread.
+    bool create = !glIsTexture(cubemap_texture);
+    if (!create && textureFaceSize != imageFaceSize) {
+        // The images have been decoded again at a larger size
+        deleteCubemapTextures();
+        create = true;
+    }
+    if (create) {
+        textureFaceSize = imageFaceSize;
+    }
+    unsigned char upload = faceMask & ~tex_loaded;
+    int size = 0;
+    for (unsigned int i = 0; i < 6; ++i) {
+        if (upload & (1 << i)) {
+            size = faces[i].rows;
+        }
+    }
     // RGB texture
     glActiveTexture(GL_TEXTURE0);
     glEnable(GL_TEXTURE_CUBE_MAP);
-    glGenTextures(1, &cubemap_texture);
+    if (create) {
+        glGenTextures(1, &cubemap_texture);
+    }
     glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap_texture);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    //use fast 4-byte alignment (default anyway) if possible
-    glPixelStorei(GL_UNPACK_ALIGNMENT, (xneg.step & 3) ? 1 : 4);
-    //set length of one complete row in data (doesn't need to equal image.cols)
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, xneg.step/xneg.elemSize());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGB, xpos.rows, xpos.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, xpos.ptr());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGB, xneg.rows, xneg.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, xneg.ptr());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGB, ypos.rows, ypos.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, ypos.ptr());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGB, yneg.rows, yneg.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, yneg.ptr());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGB, zpos.rows, zpos.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, zpos.ptr());
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGB, zneg.rows, zneg.cols, 0, GL_BGR, GL_UNSIGNED_BYTE, zneg.ptr());
+    if (create) {
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        for (unsigned int i = 0; i < 6; ++i) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, size, size, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+    uploadCubemapFaces(faces, upload, GL_BGR, GL_UNSIGNED_BYTE);
     assertOpenGLError("RGB texture");
+    if (create) {
+        tex_bytes = 6 * size * size * 3;
+    }
     if (includeDepth) {
         // Depth Texture
         glActiveTexture(GL_TEXTURE0);
         glEnable(GL_TEXTURE_CUBE_MAP);
-        glGenTextures(1, &depth_texture);
+        if (create) {
+            glGenTextures(1, &depth_texture);
+        }
         glBindTexture(GL_TEXTURE_CUBE_MAP, depth_texture);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        //use fast 4-byte alignment (default anyway) if possible
-        glPixelStorei(GL_UNPACK_ALIGNMENT, (xnegD.step & 3) ? 1 : 4);
-        //set length of one complete row in data (doesn't need to equal image.cols)
-        glPixelStorei(GL_UNPACK_ROW_LENGTH, xnegD.step/xnegD.elemSize());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RED, xposD.rows, xposD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, xposD.ptr());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RED, xnegD.rows, xnegD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, xnegD.ptr());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RED, yposD.rows, yposD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, yposD.ptr());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RED, ynegD.rows, ynegD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, ynegD.ptr());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RED, zposD.rows, zposD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, zposD.ptr());
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RED, znegD.rows, znegD.cols, 0, GL_RED, GL_UNSIGNED_SHORT, znegD.ptr());
+        if (create) {
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            for (unsigned int i = 0; i < 6; ++i) {
+                const cv::Mat& face = depthFaces[i];
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RED, face.rows, face.cols, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+            }
+        }
+        uploadCubemapFaces(depthFaces, upload, GL_RED, GL_UNSIGNED_SHORT);
         assertOpenGLError("Depth texture");
+        if (create) {
+            tex_bytes += 6 * depthFaces[0].rows * depthFaces[0].cols * 2;
+        }
     }
+    tex_loaded |= upload;
 }
 
 
@@ -127,25 +264,125 @@ void NavGraph::Location::deleteCubemapTextures() {
     glDeleteTextures(1, &depth_texture);
     cubemap_texture = 0;
     depth_texture = 0;
+    tex_loaded = 0;
+    tex_bytes = 0;
+}
+
+
+bool NavGraph::Location::cubemapTexturesLoaded(unsigned char faceMask, unsigned int minFaceSize) const {
+    return glIsTexture(cubemap_texture) && (tex_loaded & faceMask) == faceMask && 
+            faceSizeSatisfies(textureFaceSize, minFaceSize);
 }
 
 
-std::pair<GLuint, GLuint> NavGraph::Location::cubemapTextures() {
-    if (glIsTexture(cubemap_texture)){
+size_t NavGraph::Location::textureBytes() const {
+    std::lock_guard<std::mutex> lock(imageMutex);
+    if (tex_bytes > 0 && textureFaceSize == imageFaceSize) {
+        return tex_bytes;
+    }
+    // Not uploaded yet, so use the size the textures will have when created from the images
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < 6; ++i) {
+        if (im_loaded & (1 << i)) {
+            bytes = 6 * faces[i].rows * faces[i].cols * 3;
+            break;
+        }
+    }
+    if (includeDepth && !depthFaces.empty()) {
+        bytes += 6 * depthFaces[0].rows * depthFaces[0].cols * 2;
+    }
+    return bytes;
+}
+
+
+std::pair<GLuint, GLuint> NavGraph::Location::cubemapTextures(unsigned char faceMask, unsigned int minFaceSize) {
+    if (cubemapTexturesLoaded(faceMask, minFaceSize)) {
         return {cubemap_texture, depth_texture}; 
     }
-    if (!im_loaded) {
-        loadCubemapImages();
+    while (true) {
+        loadCubemapImages(faceMask, minFaceSize);
+        std::lock_guard<std::mutex> lock(imageMutex);
+        // A background load may have decoded the faces again at another size in between
+        if ((im_loaded & faceMask) == faceMask) {
+            loadCubemapTextures(faceMask);
+            return {cubemap_texture, depth_texture};
+        }
     }
-    loadCubemapTextures();
-    return {cubemap_texture, depth_texture};
 }
 
 
-NavGraph::NavGraph(const std::string& navGraphPath, const std::string& datasetPath, 
-              bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize) : cache(cacheSize) {
+std::pair<std::string, std::string> NavGraph::Location::missingLowResolutionFiles() const {
+    std::pair<std::string, std::string> files;
+    if (lowres_texture == 0 && lowResFaces.empty()) {
+        files.first = rgbFile();
+    }
+    if (includeDepth && lowres_depth_texture == 0 && lowResDepthFaces.empty()) {
+        files.second = depthFile();
+    }
+    return files;
+}
 
-    generator.seed(randomSeed);
+
+void NavGraph::Location::decodeLowResolutionImages(const std::vector<unsigned char>& data, bool depth,
+        unsigned int faceSize) {
+    std::vector<cv::Mat> decoded;
+    if (depth) {
+        decodeDepthSkybox(data, depthFile(), decoded);
+    } else {
+        // With libjpeg-turbo this is decoded at up to 1/8 scale
+        decodeSkybox(data, rgbFile(), faceSize, allCubemapFaces, decoded);
+    }
+    for (auto& face : decoded) {
+        if (face.rows > faceSize) {
+            cv::Mat small;
+            cv::resize(face, small, cv::Size(faceSize, faceSize), 0, 0, 
+                    depth ? cv::INTER_NEAREST : cv::INTER_AREA);
+            face = small;
+        }
+    }
+    if (depth) {
+        lowResDepthFaces.swap(decoded);
+    } else {
+        lowResFaces.swap(decoded);
+    }
+}
+
+
+std::pair<GLuint, GLuint> NavGraph::Location::lowResolutionTextures() {
+    if (lowres_texture == 0) {
+        if (lowResFaces.empty() || (includeDepth && lowResDepthFaces.empty())) {
+            throw std::logic_error( "MatterSim: Low resolution images not loaded for viewpoint: " + viewpointId );
+        }
+        lowres_texture = createCubemapTexture(lowResFaces, GL_RGB, GL_BGR, GL_UNSIGNED_BYTE, GL_LINEAR);
+        assertOpenGLError("Low resolution RGB texture");
+        if (includeDepth) {
+            lowres_depth_texture = createCubemapTexture(lowResDepthFaces, GL_RED, GL_RED, 
+                    GL_UNSIGNED_SHORT, GL_NEAREST);
+            assertOpenGLError("Low resolution depth texture");
+        }
+        // The textures stay resident, so the images are no longer needed
+        std::vector<cv::Mat>().swap(lowResFaces);
+        std::vector<cv::Mat>().swap(lowResDepthFaces);
+    }
+    return {lowres_texture, lowres_depth_texture};
+}
+
+
+void NavGraph::Location::deleteLowResolutionTextures() {
+    // no need to check existence, silently ignores errors
+    glDeleteTextures(1, &lowres_texture);
+    glDeleteTextures(1, &lowres_depth_texture);
+    lowres_texture = 0;
+    lowres_depth_texture = 0;
+}
+
+
+NavGraph::NavGraph(const std::string& navGraphPath) : 
+              navGraphPath(navGraphPath), datasetPath("./data/v1/scans/"), preloadImages(false),
+              renderDepth(false),
+              cache(CachePolicy::LRU, 200, 0, [](const LocationPtr& loc) { 
+                  loc->deleteCubemapTextures(); 
+              }) {
 
     auto textFile = navGraphPath + "/scans.txt";
     std::ifstream scansFile(textFile);
@@ -157,128 +394,775 @@ NavGraph::NavGraph(const std::string& navGraphPath, const std::string& datasetPa
     std::copy(std::istream_iterator<std::string>(scansFile),
           std::istream_iterator<std::string>(),
           std::back_inserter(scanIds));
+    for (auto& scanId : scanIds) {
+        if (scanHandles.count(scanId)) {
+            continue;
+        }
+        scanHandles[scanId] = scanLocations.size();
+        scanLocations.emplace_back(new Scan());
+        scanLocations.back()->scanId = scanId;
+    }
 
-    #pragma omp parallel for
-    for (unsigned int i=0; i<scanIds.size(); i++) {
-        std::string scanId = scanIds.at(i);
-        Json::Value root;
-        auto navGraphFile =  navGraphPath + "/" + scanId + "_connectivity.json";
-        std::ifstream ifs(navGraphFile, std::ifstream::in);
-        if (ifs.fail()){
-            throw std::invalid_argument( "MatterSim: Could not open navigation graph file: " +
-                    navGraphFile + ", is path valid?" );
-        }
-        ifs >> root;
-        auto skyboxDir = datasetPath + "/" + scanId + "/matterport_skybox_images/";
-        #pragma omp critical
-        {
-            scanLocations.insert(std::pair<std::string, 
-                    std::vector<LocationPtr> > (scanId, std::vector<LocationPtr>()));
-        }
-        for (auto viewpoint : root) {
-            Location l(viewpoint, skyboxDir, preloadImages, renderDepth);
-            #pragma omp critical
-            {
-                scanLocations[scanId].push_back(std::make_shared<Location>(l));
+    auto indexFile = NavGraphFile::path(navGraphPath);
+    if (std::ifstream(indexFile).good()) {
+        compiled.reset(new NavGraphFile(indexFile));
+    }
+
+}
+
+
+const NavGraph::Scan& NavGraph::graph(unsigned int scan) const {
+    Scan& entry = *scanLocations.at(scan);
+    std::call_once(entry.graphLoaded, [&]() {
+        ScanGraph graph;
+        auto navGraphFile = navGraphPath + "/" + entry.scanId + "_connectivity.json";
+        if (!compiled || !compiled->read(entry.scanId, navGraphFile, graph)) {
+            readConnectivityJson(navGraphFile, graph);
+        }
+        size_t count = graph.viewpointIds.size();
+        entry.viewpointIds.swap(graph.viewpointIds);
+        entry.viewpointIndex.reserve(count);
+        for (unsigned int ix = 0; ix < count; ++ix) {
+            entry.viewpointIndex.emplace(entry.viewpointIds[ix], ix);
+        }
+        entry.included = graph.included;
+        entry.positions.resize(count);
+        entry.rotations.resize(count);
+        for (unsigned int ix = 0; ix < count; ++ix) {
+            // glm uses column-major order. Inputs are in row-major order.
+            glm::mat4 rot = glm::transpose(glm::make_mat4(&graph.poses[16*ix]));
+            // glm access is col,row
+            entry.positions[ix] = glm::vec3{rot[3][0], rot[3][1], rot[3][2]};
+            rot[3] = {0,0,0,1}; // remove translation component
+            entry.rotations[ix] = rot;
+        }
+        // Compressed sparse rows of the reachable viewpoints
+        entry.neighbourOffsets.assign(1, 0);
+        for (unsigned int ix = 0; ix < count; ++ix) {
+            for (unsigned int i = 0; i < count; ++i) {
+                // Skip option to stay at the same viewpoint
+                if (i != ix && graph.unobstructed[ix][i] && entry.included[i]) {
+                    entry.neighbours.push_back(i);
+                }
             }
+            entry.neighbourOffsets.push_back(entry.neighbours.size());
         }
-    }
+        // Static direction to each neighbour, sorted by bearing
+        size_t edges = entry.neighbours.size();
+        entry.bearingNeighbours.resize(edges);
+        entry.bearings.resize(edges);
+        entry.elevations.resize(edges);
+        entry.distances.resize(edges);
+        std::vector<unsigned int> order;
+        for (unsigned int ix = 0; ix < count; ++ix) {
+            unsigned int first = entry.neighbourOffsets[ix];
+            unsigned int last = entry.neighbourOffsets[ix+1];
+            const glm::vec3& origin = entry.positions[ix];
+            for (unsigned int e = first; e < last; ++e) {
+                glm::vec3 target_dir = entry.positions[entry.neighbours[e]] - origin;
+                float xy = target_dir.x*target_dir.x + target_dir.y*target_dir.y;
+                float horizontal = std::sqrt(xy);
+                double bearing = M_PI/2.0 - atan2((double)target_dir.y, (double)target_dir.x);
+                if (bearing < 0.0) {
+                    bearing = std::min(bearing + 2.0*M_PI, std::nextafter(2.0*M_PI, 0.0));
+                }
+                entry.bearings[e] = bearing;
+                entry.elevations[e] = atan2((double)target_dir.z, horizontal);
+                entry.distances[e] = std::sqrt(xy + target_dir.z*target_dir.z);
+            }
+            order.resize(last - first);
+            for (unsigned int k = 0; k < order.size(); ++k) {
+                order[k] = first + k;
+            }
+            std::sort(order.begin(), order.end(), [&](unsigned int l, unsigned int r) {
+                return entry.bearings[l] < entry.bearings[r] || (entry.bearings[l] == entry.bearings[r] && l < r);
+            });
+            std::vector<double> bearings(order.size()), elevations(order.size());
+            std::vector<float> distances(order.size());
+            for (unsigned int k = 0; k < order.size(); ++k) {
+                entry.bearingNeighbours[first + k] = entry.neighbours[order[k]];
+                bearings[k] = entry.bearings[order[k]];
+                elevations[k] = entry.elevations[order[k]];
+                distances[k] = entry.distances[order[k]];
+            }
+            std::copy(bearings.begin(), bearings.end(), entry.bearings.begin() + first);
+            std::copy(elevations.begin(), elevations.end(), entry.elevations.begin() + first);
+            std::copy(distances.begin(), distances.end(), entry.distances.begin() + first);
+        }
+        buildSpatialIndex(entry.positions, entry.included, entry.spatialIndex);
+    });
+    return entry;
+}
+
+
+const std::vector<NavGraph::LocationPtr>& NavGraph::locations(unsigned int scan) const {
+    const Scan& scanGraph = graph(scan);
+    Scan& entry = *scanLocations[scan];
+    std::call_once(entry.locationsCreated, [&]() {
+        auto skyboxDir = datasetPath + "/" + entry.scanId + "/matterport_skybox_images/";
+        std::vector<LocationPtr> locs;
+        for (auto& viewpointId : scanGraph.viewpointIds) {
+            locs.push_back(std::make_shared<Location>(viewpointId, skyboxDir, preloadImages, renderDepth));
+        }
+        entry.locations.swap(locs);
+    });
+    return entry.locations;
+}
+
+
+const ShortestPaths& NavGraph::shortestPaths(unsigned int scan) const {
+    const Scan& scanGraph = graph(scan);
+    Scan& entry = *scanLocations[scan];
+    std::call_once(entry.pathsComputed, [&]() {
+        uint64_t key = shortestPathsKey(scanGraph.positions, scanGraph.included, 
+                scanGraph.neighbourOffsets, scanGraph.neighbours);
+        auto pathsFile = navGraphPath + "/" + entry.scanId + "_paths.bin";
+        if (!readShortestPaths(pathsFile, key, scanGraph.viewpointIds.size(), entry.paths)) {
+            computeShortestPaths(scanGraph.positions, scanGraph.included, 
+                    scanGraph.neighbourOffsets, scanGraph.neighbours, entry.paths);
+            writeShortestPaths(pathsFile, key, entry.paths);
+        }
+    });
+    return entry.paths;
 }
 
 
 NavGraph::~NavGraph() {
+    if (pendingLoad.valid()) {
+        pendingLoad.wait();
+    }
+    for (auto& load : lowResolutionLoads) {
+        load.second.wait();
+    }
     // free all remaining textures
-    for (auto scan : scanLocations) {
-        for (auto loc : scan.second) {
+    for (auto& scan : scanLocations) {
+        for (auto& loc : scan->locations) {
             loc->deleteCubemapTextures();
+            loc->deleteLowResolutionTextures();
         }
     }
 }
 
 
-NavGraph& NavGraph::getInstance(const std::string& navGraphPath, const std::string& datasetPath, 
-                bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize){
+// Length of a path without its trailing slashes
+static size_t trimmedLength(const std::string& path) {
+    size_t length = path.size();
+    while (length > 1 && path[length - 1] == '/') {
+        --length;
+    }
+    return length;
+}
+
+// Whether two paths are the same apart from trailing slashes. Called on every step, so it doesn't allocate.
+static bool samePath(const std::string& a, const std::string& b) {
+    size_t length = trimmedLength(a);
+    return length == trimmedLength(b) && a.compare(0, length, b, 0, length) == 0;
+}
+
+
+NavGraph& NavGraph::getInstance(const std::string& navGraphPath) {
     // magic static
-    static NavGraph instance(navGraphPath, datasetPath, preloadImages, renderDepth, randomSeed, cacheSize);
+    static NavGraph instance(navGraphPath);
+    if (!samePath(navGraphPath, instance.navGraphPath)) {
+        throw std::invalid_argument( "MatterSim: The navigation graph was already loaded from " +
+                instance.navGraphPath + ", it can't also be loaded from " + navGraphPath );
+    }
     return instance;
 }
 
 
+NavGraph& NavGraph::getInstance(const std::string& navGraphPath, const std::string& datasetPath, 
+                bool preloadImages, bool renderDepth, int randomSeed, unsigned int cacheSize,
+                CachePolicy cachePolicy, size_t cacheCapacity){
+    NavGraph& instance = getInstance(navGraphPath);
+    bool configured = false;
+    std::call_once(instance.imagesConfigured, [&]() {
+        instance.datasetPath = datasetPath;
+        instance.preloadImages = preloadImages;
+        instance.renderDepth = renderDepth;
+        instance.generator.seed(randomSeed);
+        instance.cache = TextureCache<LocationPtr>(cachePolicy, cacheSize, cacheCapacity,
+                [](const LocationPtr& loc) { 
+                    loc->deleteCubemapTextures(); 
+                });
+        if (preloadImages) {
+            // Everything will be needed, so load all the scans now
+            #pragma omp parallel for
+            for (unsigned int i=0; i<instance.scanLocations.size(); i++) {
+                instance.locations(i);
+            }
+        }
+        configured = true;
+    });
+    if (!configured && !samePath(datasetPath, instance.datasetPath)) {
+        throw std::invalid_argument( "MatterSim: Images were already configured from " +
+                instance.datasetPath + ", they can't also be loaded from " + datasetPath );
+    }
+    return instance;
+}
+
+
+unsigned int NavGraph::scanHandle(const std::string& scanId) const {
+    auto it = scanHandles.find(scanId);
+    if (it == scanHandles.end()) {
+        throw std::invalid_argument( "MatterSim: Could not find scanId: " +
+                scanId + ", is it listed in scans.txt?" );
+    }
+    return it->second;
+}
+
+
+const std::string& NavGraph::scanId(unsigned int scan) const {
+    return scanLocations.at(scan)->scanId;
+}
+
+
 const std::string& NavGraph::randomViewpoint(const std::string& scanId) {
-    std::uniform_int_distribution<int> distribution(0,scanLocations.at(scanId).size()-1);
+    unsigned int scan = scanHandle(scanId);
+    return viewpoint(scan, randomViewpointIndex(scan));
+}
+
+
+unsigned int NavGraph::scanCount() const {
+    return scanLocations.size();
+}
+
+
+unsigned int NavGraph::viewpointCount(unsigned int scan) const {
+    return graph(scan).viewpointIds.size();
+}
+
+
+unsigned int NavGraph::randomViewpointIndex(unsigned int scan) {
+    const std::vector<bool>& included = graph(scan).included;
+    std::uniform_int_distribution<int> distribution(0,included.size()-1);
     int start_ix = distribution(generator);  // generates random starting index
     int ix = start_ix;
-    while (!scanLocations.at(scanId).at(ix)->included) { // Don't start at an excluded viewpoint
+    while (!included.at(ix)) { // Don't start at an excluded viewpoint
         ix++;
-        if (ix >= scanLocations.at(scanId).size()) ix = 0;
+        if (ix >= included.size()) ix = 0;
         if (ix == start_ix) {
-            throw std::logic_error( "MatterSim: ScanId: " + scanId + " has no included viewpoints!");
+            throw std::logic_error( "MatterSim: ScanId: " + scanId(scan) + " has no included viewpoints!");
         }
     }
-    return scanLocations.at(scanId).at(ix)->viewpointId;
+    return ix;
 }
 
 
 unsigned int NavGraph::index(const std::string& scanId, const std::string& viewpointId) const {
-    int ix = -1;
-    for (int i = 0; i < scanLocations.at(scanId).size(); ++i) {
-        if (scanLocations.at(scanId).at(i)->viewpointId == viewpointId) {
-            if (!scanLocations.at(scanId).at(i)->included) {
-                throw std::invalid_argument( "MatterSim: ViewpointId: " +
-                        viewpointId + ", is excluded from the connectivity graph." );
-            }
-            ix = i;
-            break;
-        }
-    }
-    if (ix < 0) {
+    return index(scanHandle(scanId), viewpointId);
+}
+
+
+unsigned int NavGraph::index(unsigned int scan, const std::string& viewpointId) const {
+    const Scan& entry = graph(scan);
+    auto it = entry.viewpointIndex.find(viewpointId);
+    if (it == entry.viewpointIndex.end()) {
         throw std::invalid_argument( "MatterSim: Could not find viewpointId: " +
                 viewpointId + ", is viewpoint id valid?" );
-    } else {
-        return ix;
     }
+    if (!entry.included[it->second]) {
+        throw std::invalid_argument( "MatterSim: ViewpointId: " +
+                viewpointId + ", is excluded from the connectivity graph." );
+    }
+    return it->second;
 }
 
+
+std::vector<unsigned int> NavGraph::index(const std::vector<unsigned int>& scans, 
+        const std::vector<std::string>& viewpointIds) const {
+    if (scans.size() != viewpointIds.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of scans and viewpointIds" );
+    }
+    std::vector<unsigned int> ixs(viewpointIds.size());
+    for (unsigned int i = 0; i < viewpointIds.size(); ++i) {
+        ixs[i] = index(scans[i], viewpointIds[i]);
+    }
+    return ixs;
+}
+
+bool NavGraph::included(unsigned int scan, unsigned int ix) const {
+    return graph(scan).included.at(ix);
+}
+
+
 const std::string& NavGraph::viewpoint(const std::string& scanId, unsigned int ix) const {
-    return scanLocations.at(scanId).at(ix)->viewpointId;
+    return viewpoint(scanHandle(scanId), ix);
+}
+
+
+const std::string& NavGraph::viewpoint(unsigned int scan, unsigned int ix) const {
+    return graph(scan).viewpointIds.at(ix);
 }
 
 
 const glm::mat4& NavGraph::cameraRotation(const std::string& scanId, unsigned int ix) const {
-    return scanLocations.at(scanId).at(ix)->rot;
+    return cameraRotation(scanHandle(scanId), ix);
+}
+
+
+const glm::mat4& NavGraph::cameraRotation(unsigned int scan, unsigned int ix) const {
+    return graph(scan).rotations.at(ix);
 }
 
 
 const glm::vec3& NavGraph::cameraPosition(const std::string& scanId, unsigned int ix) const {
-    return scanLocations.at(scanId).at(ix)->pos;
+    return cameraPosition(scanHandle(scanId), ix);
+}
+
+
+const glm::vec3& NavGraph::cameraPosition(unsigned int scan, unsigned int ix) const {
+    return graph(scan).positions.at(ix);
+}
+
+
+Span<glm::vec3> NavGraph::cameraPositions(unsigned int scan) const {
+    return graph(scan).positions;
 }
 
 
 std::vector<unsigned int> NavGraph::adjacentViewpointIndices(const std::string& scanId, unsigned int ix) const {
-    std::vector<unsigned int> reachable;
-    for (unsigned int i = 0; i < scanLocations.at(scanId).size(); ++i) {
-        if (i == ix) {
-            // Skip option to stay at the same viewpoint
-            continue;
+    return adjacentViewpointIndices(scanHandle(scanId), ix);
+}
+
+
+std::vector<unsigned int> NavGraph::adjacentViewpointIndices(unsigned int scan, unsigned int ix) const {
+    Span<unsigned int> reachable = adjacentViewpoints(scan, ix);
+    return std::vector<unsigned int>(reachable.begin(), reachable.end());
+}
+
+
+Span<unsigned int> NavGraph::adjacentViewpoints(unsigned int scan, unsigned int ix) const {
+    const Scan& entry = graph(scan);
+    if (ix >= entry.viewpointIds.size()) {
+        throw std::out_of_range( "MatterSim: Invalid viewpoint index for scanId: " + entry.scanId );
+    }
+    const unsigned int* neighbours = entry.neighbours.data();
+    return Span<unsigned int>(neighbours + entry.neighbourOffsets[ix], neighbours + entry.neighbourOffsets[ix+1]);
+}
+
+
+NavGraph::NeighbourBearings NavGraph::neighbourBearings(unsigned int scan, unsigned int ix) const {
+    const Scan& entry = graph(scan);
+    if (ix >= entry.viewpointIds.size()) {
+        throw std::out_of_range( "MatterSim: Invalid viewpoint index for scanId: " + entry.scanId );
+    }
+    unsigned int first = entry.neighbourOffsets[ix];
+    unsigned int last = entry.neighbourOffsets[ix+1];
+    NeighbourBearings result;
+    result.viewpoints = Span<unsigned int>(entry.bearingNeighbours.data() + first, entry.bearingNeighbours.data() + last);
+    result.bearings = Span<double>(entry.bearings.data() + first, entry.bearings.data() + last);
+    result.elevations = Span<double>(entry.elevations.data() + first, entry.elevations.data() + last);
+    result.distances = Span<float>(entry.distances.data() + first, entry.distances.data() + last);
+    return result;
+}
+
+
+unsigned int NavGraph::nearestViewpoint(unsigned int scan, const glm::vec3& point) const {
+    unsigned int ix;
+    double distance;
+    if (!graph(scan).spatialIndex.nearest(point, ix, distance)) {
+        throw std::runtime_error( "MatterSim: No viewpoints in scanId: " + scanId(scan) );
+    }
+    return ix;
+}
+
+
+std::vector<unsigned int> NavGraph::nearestViewpoints(const std::vector<unsigned int>& scans,
+        const std::vector<glm::vec3>& points) const {
+    if (scans.size() != points.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of scans and points" );
+    }
+    std::vector<unsigned int> result(scans.size());
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        // Load the graphs first, and raise any errors outside the parallel loop
+        if (i == 0 || scans[i] != scans[i-1]) {
+            nearestViewpoint(scans[i], points[i]);
         }
-        if (scanLocations.at(scanId).at(ix)->unobstructed[i] && scanLocations.at(scanId).at(i)->included) {
-            reachable.push_back(i);
+    }
+    int count = scans.size();
+    #pragma omp parallel for schedule(static) if(count >= 64)
+    for (int i = 0; i < count; ++i) {
+        result[i] = nearestViewpoint(scans[i], points[i]);
+    }
+    return result;
+}
+
+
+std::vector<unsigned int> NavGraph::viewpointsWithin(unsigned int scan, const glm::vec3& point,
+        double radius) const {
+    std::vector<unsigned int> result;
+    graph(scan).spatialIndex.within(point, radius, result);
+    return result;
+}
+
+
+std::vector<std::vector<unsigned int> > NavGraph::viewpointsWithin(const std::vector<unsigned int>& scans,
+        const std::vector<glm::vec3>& points, double radius) const {
+    if (scans.size() != points.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of scans and points" );
+    }
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        if (i == 0 || scans[i] != scans[i-1]) {
+            graph(scans[i]);
         }
     }
-    return reachable;
+    std::vector<std::vector<unsigned int> > result(scans.size());
+    int count = scans.size();
+    #pragma omp parallel for schedule(static) if(count >= 64)
+    for (int i = 0; i < count; ++i) {
+        graph(scans[i]).spatialIndex.within(points[i], radius, result[i]);
+    }
+    return result;
+}
+
+
+float NavGraph::distance(unsigned int scan, unsigned int from, unsigned int to) const {
+    const ShortestPaths& paths = shortestPaths(scan);
+    if (from >= paths.size || to >= paths.size) {
+        throw std::out_of_range( "MatterSim: Invalid viewpoint index for scanId: " + scanId(scan) );
+    }
+    return paths.distance(from, to);
+}
+
+
+unsigned int NavGraph::nextHop(unsigned int scan, unsigned int from, unsigned int to) const {
+    const ShortestPaths& paths = shortestPaths(scan);
+    if (from >= paths.size || to >= paths.size) {
+        throw std::out_of_range( "MatterSim: Invalid viewpoint index for scanId: " + scanId(scan) );
+    }
+    return paths.nextHop(from, to);
+}
+
+
+std::vector<float> NavGraph::distances(const std::vector<unsigned int>& scans, 
+        const std::vector<unsigned int>& from, const std::vector<unsigned int>& to) const {
+    if (scans.size() != from.size() || scans.size() != to.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of scans and viewpoint indices" );
+    }
+    std::vector<float> result(scans.size());
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        result[i] = distance(scans[i], from[i], to[i]);
+    }
+    return result;
+}
+
+
+std::vector<unsigned int> NavGraph::nextHops(const std::vector<unsigned int>& scans, 
+        const std::vector<unsigned int>& from, const std::vector<unsigned int>& to) const {
+    if (scans.size() != from.size() || scans.size() != to.size()) {
+        throw std::invalid_argument( "MatterSim: Different numbers of scans and viewpoint indices" );
+    }
+    std::vector<unsigned int> result(scans.size());
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        result[i] = nextHop(scans[i], from[i], to[i]);
+    }
+    return result;
 }
 
 
-std::pair<GLuint, GLuint> NavGraph::cubemapTextures(const std::string& scanId, unsigned int ix) {
-    LocationPtr loc = scanLocations.at(scanId).at(ix);
-    std::pair<GLuint, GLuint> textures = loc->cubemapTextures();
-    cache.add(loc);
+std::vector<unsigned int> NavGraph::shortestPath(unsigned int scan, unsigned int from, unsigned int to) const {
+    std::vector<unsigned int> path;
+    if (nextHop(scan, from, to) == noNextHop) {
+        return path;
+    }
+    const ShortestPaths& paths = shortestPaths(scan);
+    path.push_back(from);
+    while (from != to) {
+        from = paths.nextHop(from, to);
+        path.push_back(from);
+    }
+    return path;
+}
+
+
+std::pair<GLuint, GLuint> NavGraph::cubemapTextures(const std::string& scanId, unsigned int ix,
+        unsigned char faceMask, unsigned int minFaceSize) {
+    return cubemapTextures(scanHandle(scanId), ix, faceMask, minFaceSize);
+}
+
+
+std::pair<GLuint, GLuint> NavGraph::cubemapTextures(unsigned int scan, unsigned int ix,
+        unsigned char faceMask, unsigned int minFaceSize) {
+    LocationPtr loc = locations(scan).at(ix);
+    std::pair<GLuint, GLuint> textures = loc->cubemapTextures(faceMask, minFaceSize);
+    cache.add(loc, scanId(scan), loc->textureBytes());
     return textures;
 }
 
 
+std::vector<std::shared_future<void> > NavGraph::uploadCubemapTextures(const std::vector<unsigned int>& scans,
+        const std::vector<unsigned int>& ixs, const std::vector<unsigned char>& faceMasks, 
+        unsigned int minFaceSize, TextureUploader& uploader) {
+    // Merge requests for the same viewpoint. The batch is pinned in the cache, so 
+    // nothing in it is evicted while uploads are in progress.
+    std::vector<LocationPtr> locs;
+    std::unordered_map<LocationPtr, unsigned char> requests;
+    cache.unpinAll();
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        LocationPtr loc = locations(scans.at(i)).at(ixs.at(i));
+        locs.push_back(loc);
+        requests[loc] |= faceMasks.at(i);
+        cache.count(loc->cubemapTexturesLoaded(faceMasks.at(i), minFaceSize));
+        cache.add(loc, scanId(scans.at(i)), loc->textureBytes());
+        cache.pin(loc);
+    }
+    std::unordered_map<LocationPtr, std::shared_future<void> > pending;
+    std::vector<std::shared_future<void> > uploads;
+    for (auto& loc : locs) {
+        if (!pending.count(loc)) {
+            unsigned char faceMask = requests[loc];
+            pending[loc] = uploader.submit([loc, faceMask, minFaceSize]() {
+                loc->cubemapTextures(faceMask, minFaceSize);
+            });
+        }
+        uploads.push_back(pending[loc]);
+    }
+    return uploads;
+}
+
+
+void NavGraph::loadCubemapImages(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+        const std::vector<unsigned char>& faceMasks, unsigned int minFaceSize) {
+    // Merge requests for the same viewpoint
+    std::unordered_map<LocationPtr, unsigned char> requests;
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        requests[locations(scans.at(i)).at(ixs.at(i))] |= faceMasks.at(i);
+    }
+    std::vector<std::string> filenames;
+    std::vector<LocationPtr> locs;
+    std::vector<unsigned char> masks;
+    std::vector<bool> isDepth;
+    for (auto& request : requests) {
+        std::pair<std::string, std::string> files = request.first->missingImageFiles(request.second, minFaceSize);
+        if (!files.first.empty()) {
+            filenames.push_back(files.first);
+            locs.push_back(request.first);
+            masks.push_back(request.second);
+            isDepth.push_back(false);
+        }
+        if (!files.second.empty()) {
+            filenames.push_back(files.second);
+            locs.push_back(request.first);
+            masks.push_back(request.second);
+            isDepth.push_back(true);
+        }
+    }
+    if (filenames.empty()) {
+        return;
+    }
+    std::vector<std::vector<unsigned char> > data;
+    readFiles(filenames, data, [&](size_t i) {
+        if (isDepth[i]) {
+            locs[i]->decodeDepthImages(data[i]);
+        } else {
+            locs[i]->decodeCubemapImages(masks[i], minFaceSize, data[i]);
+        }
+        // release the compressed file contents
+        std::vector<unsigned char>().swap(data[i]);
+    });
+}
+
+
+unsigned int NavGraph::warmCache(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+        unsigned int hops, size_t memoryBudget, unsigned int minFaceSize) {
+    // Count how often each viewpoint is visited
+    std::map<std::pair<unsigned int, unsigned int>, unsigned int> visits;
+    for (unsigned int i = 0; i < scans.size(); ++i) {
+        visits[{scans.at(i), ixs.at(i)}] += 1;
+    }
+    // Spread priority over the neighbourhood of each visited viewpoint (breadth first)
+    std::map<std::pair<unsigned int, unsigned int>, double> priority;
+    for (auto& visit : visits) {
+        unsigned int scan = visit.first.first;
+        std::vector<bool> seen(viewpointCount(scan), false);
+        std::vector<unsigned int> frontier{visit.first.second};
+        seen.at(visit.first.second) = true;
+        double weight = visit.second;
+        for (unsigned int hop = 0; !frontier.empty(); ++hop) {
+            std::vector<unsigned int> next;
+            for (unsigned int ix : frontier) {
+                priority[{scan, ix}] += weight;
+                if (hop == hops) {
+                    continue;
+                }
+                for (unsigned int n : adjacentViewpoints(scan, ix)) {
+                    if (!seen[n]) {
+                        seen[n] = true;
+                        next.push_back(n);
+                    }
+                }
+            }
+            frontier.swap(next);
+            weight /= 2.0;
+        }
+    }
+    std::vector<std::pair<double, std::pair<unsigned int, unsigned int> > > order;
+    for (auto& p : priority) {
+        order.push_back({p.second, p.first});
+    }
+    std::stable_sort(order.begin(), order.end(), 
+        [](const std::pair<double, std::pair<unsigned int, unsigned int> >& a, 
+           const std::pair<double, std::pair<unsigned int, unsigned int> >& b) {
+            return a.first > b.first;
+        });
+
+    // Load in batches sized from the largest image seen so far, so the budget isn't overrun. Images 
+    // in CPU memory are never evicted, so only the bytes added by this call count against the budget.
+    const size_t maxBatch = 256;
+    size_t used = 0;
+    size_t largest = 0;
+    unsigned int loaded = 0;
+    size_t next = 0;
+    while (next < order.size() && used < memoryBudget) {
+        size_t batch = 1;
+        if (largest > 0) {
+            batch = std::min(maxBatch, (memoryBudget - used) / largest);
+            if (batch == 0) {
+                break;
+            }
+        }
+        std::vector<unsigned int> batchScans;
+        std::vector<unsigned int> batchIxs;
+        std::vector<size_t> before;
+        for (; next < order.size() && batchIxs.size() < batch; ++next) {
+            unsigned int scan = order[next].second.first;
+            unsigned int ix = order[next].second.second;
+            if (cubemapImagesLoaded(scan, ix, allCubemapFaces, minFaceSize)) {
+                continue;
+            }
+            batchScans.push_back(scan);
+            batchIxs.push_back(ix);
+            before.push_back(locations(scan).at(ix)->imageBytes());
+        }
+        loadCubemapImages(batchScans, batchIxs, 
+                std::vector<unsigned char>(batchIxs.size(), allCubemapFaces), minFaceSize);
+        for (unsigned int i = 0; i < batchIxs.size(); ++i) {
+            size_t after = locations(batchScans[i]).at(batchIxs[i])->imageBytes();
+            size_t added = after > before[i] ? after - before[i] : 0;
+            used += added;
+            largest = std::max(largest, added);
+            loaded++;
+        }
+    }
+    return loaded;
+}
+
+
+bool NavGraph::cubemapImagesLoaded(unsigned int scan, unsigned int ix, unsigned char faceMask, 
+        unsigned int minFaceSize) const {
+    std::pair<std::string, std::string> files = locations(scan).at(ix)->missingImageFiles(faceMask, minFaceSize);
+    return files.first.empty() && files.second.empty();
+}
+
+
+void NavGraph::loadCubemapImagesAsync(const std::vector<unsigned int>& scans, const std::vector<unsigned int>& ixs,
+        const std::vector<unsigned char>& faceMasks, unsigned int minFaceSize) {
+    if (pendingLoad.valid()) {
+        if (pendingLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+        pendingLoad.get(); // rethrows any error
+    }
+    pendingLoad = std::async(std::launch::async, [this, scans, ixs, faceMasks, minFaceSize]() {
+        loadCubemapImages(scans, ixs, faceMasks, minFaceSize);
+    });
+}
+
+
+void NavGraph::loadLowResolutionImages(unsigned int scan, unsigned int faceSize) {
+    const std::vector<bool>& included = graph(scan).included;
+    const std::vector<LocationPtr>& scanLocs = locations(scan);
+    std::vector<std::string> filenames;
+    std::vector<LocationPtr> locs;
+    std::vector<bool> isDepth;
+    for (unsigned int ix = 0; ix < scanLocs.size(); ++ix) {
+        if (!included[ix]) {
+            continue;
+        }
+        std::pair<std::string, std::string> files = scanLocs[ix]->missingLowResolutionFiles();
+        if (!files.first.empty()) {
+            filenames.push_back(files.first);
+            locs.push_back(scanLocs[ix]);
+            isDepth.push_back(false);
+        }
+        if (!files.second.empty()) {
+            filenames.push_back(files.second);
+            locs.push_back(scanLocs[ix]);
+            isDepth.push_back(true);
+        }
+    }
+    std::vector<std::vector<unsigned char> > data;
+    readFiles(filenames, data, [&](size_t i) {
+        locs[i]->decodeLowResolutionImages(data[i], isDepth[i], faceSize);
+        std::vector<unsigned char>().swap(data[i]);
+    });
+}
+
+
+void NavGraph::loadLowResolutionTextures(unsigned int scan, unsigned int faceSize) {
+    loadLowResolutionTexturesAsync(scan, faceSize);
+    auto it = lowResolutionLoads.find(scan);
+    if (it != lowResolutionLoads.end()) {
+        it->second.wait();
+    }
+    lowResolutionTexturesLoaded(scan);
+}
+
+
+void NavGraph::loadLowResolutionTexturesAsync(unsigned int scan, unsigned int faceSize) {
+    if (lowResolutionScans.count(scan) || lowResolutionLoads.count(scan)) {
+        return;
+    }
+    locations(scan); // report a bad scan handle now rather than from the background thread
+    lowResolutionLoads[scan] = std::async(std::launch::async, [this, scan, faceSize]() {
+        loadLowResolutionImages(scan, faceSize);
+    });
+}
+
+
+bool NavGraph::lowResolutionTexturesLoaded(unsigned int scan) {
+    if (lowResolutionScans.count(scan)) {
+        return true;
+    }
+    auto it = lowResolutionLoads.find(scan);
+    if (it == lowResolutionLoads.end() || 
+            it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return false;
+    }
+    std::future<void> load = std::move(it->second);
+    lowResolutionLoads.erase(it);
+    load.get(); // rethrows any error, a later request will retry
+    // Textures are created from this thread, which owns the OpenGL context
+    const std::vector<bool>& included = graph(scan).included;
+    const std::vector<LocationPtr>& scanLocs = locations(scan);
+    for (unsigned int ix = 0; ix < scanLocs.size(); ++ix) {
+        if (included[ix]) {
+            scanLocs[ix]->lowResolutionTextures();
+        }
+    }
+    lowResolutionScans.insert(scan);
+    return true;
+}
+
+
+std::pair<GLuint, GLuint> NavGraph::lowResolutionTextures(unsigned int scan, unsigned int ix) {
+    return locations(scan).at(ix)->lowResolutionTextures();
+}
+
+
 void NavGraph::deleteCubemapTextures(const std::string& scanId, unsigned int ix) {
-    scanLocations.at(scanId).at(ix)->deleteCubemapTextures();
+    deleteCubemapTextures(scanHandle(scanId), ix);
+}
+
+
+void NavGraph::deleteCubemapTextures(unsigned int scan, unsigned int ix) {
+    locations(scan).at(ix)->deleteCubemapTextures();
+}
+
+
+const CacheStats& NavGraph::cacheStats() const {
+    return cache.statistics();
 }
 
 
@@ -0,0 +1,333 @@
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <json/json.h>
+
+#include "NavGraphFile.hpp"
+
+namespace mattersim {
+
+/*
+ * File layout, in native byte order. All offsets are from the start of the file, and every
+ * section starts on an 8 byte boundary.
+ *   Header
+ *   ScanEntry[scanCount]
+ *   per scan: viewpoint ids   - viewpointCount x {uint32 offset, uint32 length} into the strings
+ *             included flags  - viewpointCount bits
+ *             poses           - viewpointCount x 16 float32, row-major
+ *             adjacency       - viewpointCount rows of viewpointCount bits
+ *   strings
+ */
+struct NavGraphFile::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t scanCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+struct NavGraphFile::ScanEntry {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t viewpointCount;
+    uint32_t reserved;
+    uint64_t sourceSize;     //! Size of the json file the scan was compiled from
+    int64_t sourceModified;  //! Modification time of the json file in nanoseconds
+    uint64_t idsOffset;
+    uint64_t includedOffset;
+    uint64_t posesOffset;
+    uint64_t adjacencyOffset;
+};
+
+namespace {
+
+    const char fileMagic[8] = {'M', 'S', 'N', 'A', 'V', 'G', 'R', 'F'};
+    const uint32_t fileVersion = 1;
+
+    size_t bitBytes(size_t bits) {
+        return (bits + 7) / 8;
+    }
+
+    // Size and modification time of a file, false if it doesn't exist
+    bool sourceVersion(const std::string& filename, uint64_t& size, int64_t& modified) {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            return false;
+        }
+        size = st.st_size;
+        modified = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        return true;
+    }
+
+    // Append a section to the output, padded to 8 bytes, and return its offset
+    uint64_t append(std::vector<unsigned char>& out, const void* section, size_t bytes) {
+        uint64_t offset = out.size();
+        const unsigned char* p = static_cast<const unsigned char*>(section);
+        out.insert(out.end(), p, p + bytes);
+        out.resize((out.size() + 7) & ~size_t(7), 0);
+        return offset;
+    }
+
+    void packBits(const std::vector<bool>& bits, std::vector<unsigned char>& packed) {
+        for (size_t i = 0; i < bits.size(); ++i) {
+            if (bits[i]) {
+                packed[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+
+    void unpackBits(const unsigned char* packed, size_t count, std::vector<bool>& bits) {
+        bits.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            bits[i] = (packed[i / 8] >> (i % 8)) & 1;
+        }
+    }
+
+}
+
+
+void readConnectivityJson(const std::string& filename, ScanGraph& graph) {
+    std::ifstream ifs(filename, std::ifstream::in);
+    if (ifs.fail()){
+        throw std::invalid_argument( "MatterSim: Could not open navigation graph file: " +
+                filename + ", is path valid?" );
+    }
+    Json::Value root;
+    ifs >> root;
+    graph.viewpointIds.clear();
+    graph.included.clear();
+    graph.unobstructed.clear();
+    graph.poses.assign(16 * root.size(), 0.0f);
+    unsigned int ix = 0;
+    for (auto viewpoint : root) {
+        graph.viewpointIds.push_back(viewpoint["image_id"].asString());
+        graph.included.push_back(viewpoint["included"].asBool());
+        int i = 0;
+        for (auto f : viewpoint["pose"]) {
+            if (i < 16) {
+                graph.poses[16 * ix + i++] = f.asFloat();
+            }
+        }
+        std::vector<bool> unobstructed;
+        for (auto u : viewpoint["unobstructed"]) {
+            unobstructed.push_back(u.asBool());
+        }
+        if (unobstructed.size() != root.size()) {
+            throw std::invalid_argument( "MatterSim: Navigation graph file: " + filename +
+                    ", has an unobstructed list of the wrong length" );
+        }
+        graph.unobstructed.push_back(unobstructed);
+        ix++;
+    }
+}
+
+
+std::string NavGraphFile::path(const std::string& navGraphPath) {
+    return navGraphPath + "/navgraph.bin";
+}
+
+
+void NavGraphFile::compile(const std::string& navGraphPath, const std::string& outputFile) {
+    auto textFile = navGraphPath + "/scans.txt";
+    std::ifstream scansFile(textFile);
+    if (scansFile.fail()){
+        throw std::invalid_argument( "MatterSim: Could not open list of scans at: " +
+                textFile + ", is path valid?" );
+    }
+    std::vector<std::string> scanIds;
+    std::copy(std::istream_iterator<std::string>(scansFile),
+          std::istream_iterator<std::string>(),
+          std::back_inserter(scanIds));
+
+    std::vector<ScanGraph> graphs(scanIds.size());
+    std::vector<ScanEntry> entries(scanIds.size());
+    std::exception_ptr error;
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int i = 0; i < scanIds.size(); ++i) {
+        try {
+            auto sourceFile = navGraphPath + "/" + scanIds[i] + "_connectivity.json";
+            std::memset(&entries[i], 0, sizeof(ScanEntry));
+            sourceVersion(sourceFile, entries[i].sourceSize, entries[i].sourceModified);
+            readConnectivityJson(sourceFile, graphs[i]);
+        } catch (...) {
+            #pragma omp critical
+            {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    std::string strings;
+    std::vector<unsigned char> out(sizeof(Header) + entries.size() * sizeof(ScanEntry), 0);
+    for (unsigned int i = 0; i < scanIds.size(); ++i) {
+        const ScanGraph& graph = graphs[i];
+        size_t count = graph.viewpointIds.size();
+        ScanEntry& entry = entries[i];
+        entry.nameOffset = strings.size();
+        entry.nameLength = scanIds[i].size();
+        strings += scanIds[i];
+        entry.viewpointCount = count;
+
+        std::vector<uint32_t> ids;
+        for (auto& viewpointId : graph.viewpointIds) {
+            ids.push_back(strings.size());
+            ids.push_back(viewpointId.size());
+            strings += viewpointId;
+        }
+        entry.idsOffset = append(out, ids.data(), ids.size() * sizeof(uint32_t));
+
+        std::vector<unsigned char> included(bitBytes(count), 0);
+        packBits(graph.included, included);
+        entry.includedOffset = append(out, included.data(), included.size());
+
+        entry.posesOffset = append(out, graph.poses.data(), graph.poses.size() * sizeof(float));
+
+        size_t rowBytes = bitBytes(count);
+        std::vector<unsigned char> adjacency(count * rowBytes, 0);
+        for (size_t j = 0; j < count; ++j) {
+            std::vector<unsigned char> row(rowBytes, 0);
+            packBits(graph.unobstructed[j], row);
+            std::copy(row.begin(), row.end(), adjacency.begin() + j * rowBytes);
+        }
+        entry.adjacencyOffset = append(out, adjacency.data(), adjacency.size());
+    }
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+    header.version = fileVersion;
+    header.scanCount = entries.size();
+    header.stringsSize = strings.size();
+    header.stringsOffset = append(out, strings.data(), strings.size());
+    std::memcpy(out.data(), &header, sizeof(Header));
+    if (!entries.empty()) {
+        std::memcpy(out.data() + sizeof(Header), entries.data(), entries.size() * sizeof(ScanEntry));
+    }
+
+    // Write to a temporary file first, so a simulator never maps a partially written index. The 
+    // name is unique to this process, so concurrent writers don't interleave their output.
+    auto tempFile = outputFile + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream ofs(tempFile, std::ofstream::binary | std::ofstream::trunc);
+        ofs.write(reinterpret_cast<const char*>(out.data()), out.size());
+        if (ofs.fail()) {
+            throw std::runtime_error( "MatterSim: Could not write navigation graph index: " + tempFile );
+        }
+    }
+    if (std::rename(tempFile.c_str(), outputFile.c_str()) != 0) {
+        std::remove(tempFile.c_str());
+        throw std::runtime_error( "MatterSim: Could not write navigation graph index: " + outputFile );
+    }
+}
+
+
+NavGraphFile::NavGraphFile(const std::string& filename) : data(NULL), bytes(0), filename(filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error( "MatterSim: Could not open navigation graph index: " + filename );
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        bytes = st.st_size;
+        void* mapped = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = static_cast<const unsigned char*>(mapped);
+        }
+    }
+    close(fd);
+    if (!data) {
+        throw std::runtime_error( "MatterSim: Could not map navigation graph index: " + filename );
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if (bytes < sizeof(Header) || std::memcmp(header->magic, fileMagic, sizeof(fileMagic)) != 0
+            || header->version != fileVersion
+            || sizeof(Header) + uint64_t(header->scanCount) * sizeof(ScanEntry) > bytes
+            || header->stringsOffset > bytes || header->stringsSize > bytes - header->stringsOffset) {
+        munmap(const_cast<unsigned char*>(data), bytes);
+        throw std::runtime_error( "MatterSim: Invalid navigation graph index: " + filename +
+                ", recompile it with compile_navgraph" );
+    }
+    const char* strings = reinterpret_cast<const char*>(data + header->stringsOffset);
+    const ScanEntry* entries = reinterpret_cast<const ScanEntry*>(data + sizeof(Header));
+    for (uint32_t i = 0; i < header->scanCount; ++i) {
+        const ScanEntry& entry = entries[i];
+        if (uint64_t(entry.nameOffset) + entry.nameLength <= header->stringsSize) {
+            scans[std::string(strings + entry.nameOffset, entry.nameLength)] = &entry;
+        }
+    }
+}
+
+
+NavGraphFile::~NavGraphFile() {
+    munmap(const_cast<unsigned char*>(data), bytes);
+}
+
+
+size_t NavGraphFile::size() const {
+    return scans.size();
+}
+
+
+bool NavGraphFile::read(const std::string& scanId, const std::string& sourceFile, ScanGraph& graph) const {
+    auto it = scans.find(scanId);
+    if (it == scans.end()) {
+        return false;
+    }
+    const ScanEntry& entry = *it->second;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    if (sourceVersion(sourceFile, sourceSize, sourceModified)
+            && (sourceSize != entry.sourceSize || sourceModified != entry.sourceModified)) {
+        return false;
+    }
+
+    const Header* header = reinterpret_cast<const Header*>(data);
+    const char* strings = reinterpret_cast<const char*>(data + header->stringsOffset);
+    uint64_t count = entry.viewpointCount;
+    uint64_t rowBytes = bitBytes(count);
+    auto inBounds = [this](uint64_t offset, uint64_t size) {
+        return offset <= bytes && size <= bytes - offset;
+    };
+    if (!inBounds(entry.idsOffset, count * 2 * sizeof(uint32_t)) || !inBounds(entry.includedOffset, rowBytes)
+            || !inBounds(entry.posesOffset, count * 16 * sizeof(float))
+            || !inBounds(entry.adjacencyOffset, count * rowBytes)) {
+        throw std::runtime_error( "MatterSim: Invalid navigation graph index: " + filename +
+                ", recompile it with compile_navgraph" );
+    }
+
+    const uint32_t* ids = reinterpret_cast<const uint32_t*>(data + entry.idsOffset);
+    graph.viewpointIds.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        if (uint64_t(ids[2*i]) + ids[2*i + 1] > header->stringsSize) {
+            throw std::runtime_error( "MatterSim: Invalid navigation graph index: " + filename +
+                    ", recompile it with compile_navgraph" );
+        }
+        graph.viewpointIds[i].assign(strings + ids[2*i], ids[2*i + 1]);
+    }
+    unpackBits(data + entry.includedOffset, count, graph.included);
+    graph.poses.resize(16 * count);
+    std::memcpy(graph.poses.data(), data + entry.posesOffset, count * 16 * sizeof(float));
+    graph.unobstructed.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        unpackBits(data + entry.adjacencyOffset + i * rowBytes, count, graph.unobstructed[i]);
+    }
+    return true;
+}
+
+}
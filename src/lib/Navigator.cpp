@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Navigator.hpp"
+
+namespace mattersim {
+
+const int Navigator::headingCount;
+const double Navigator::elevationIncrement = M_PI/6.0;
+
+Navigator::Navigator(bool discretizeViews, bool restrictedNavigation, double half_hfov, double minElevation,
+        double maxElevation, bool candidateTables) :
+            discretizeViews(discretizeViews),
+            restrictedNavigation(restrictedNavigation),
+            half_hfov(half_hfov),
+            minElevation(minElevation),
+            maxElevation(maxElevation),
+            candidateTablesEnabled(candidateTables && discretizeViews) {
+}
+
+void Navigator::setHeadingElevation(double heading, double elevation, double& newHeading, double& newElevation,
+        unsigned int& viewIndex) const {
+    // Normalize heading to range [0, 360]
+    newHeading = fmod(heading, M_PI*2.0);
+    while (newHeading < 0.0) {
+        newHeading += M_PI*2.0;
+    }
+    if (discretizeViews) {
+        // Snap heading to nearest discrete value
+        double headingIncrement = M_PI*2.0/headingCount;
+        int heading_step = std::lround(newHeading/headingIncrement);
+        if (heading_step == headingCount) heading_step = 0;
+        newHeading = (double)heading_step * headingIncrement;
+        // Snap elevation to nearest discrete value (disregarding elevation limits)
+        if (elevation < -elevationIncrement/2.0) {
+          newElevation = -elevationIncrement;
+          viewIndex = heading_step;
+        } else if (elevation > elevationIncrement/2.0) {
+          newElevation = elevationIncrement;
+          viewIndex = heading_step + 2*headingCount;
+        } else {
+          newElevation = 0.0;
+          viewIndex = heading_step + headingCount;
+        }
+    } else {
+        // Set elevation with limits
+        newElevation = std::max(std::min(elevation, maxElevation), minElevation);
+    }
+}
+
+void Navigator::discretizeChange(double& heading, double& elevation) const {
+    if (discretizeViews) {
+        // Increments based on sign of input
+        if (heading > 0.0) heading = M_PI*2.0/headingCount;
+        if (heading < 0.0) heading = -M_PI*2.0/headingCount;
+        if (elevation > 0.0) elevation =  elevationIncrement;
+        if (elevation < 0.0) elevation = -elevationIncrement;
+    }
+}
+
+Span<Candidate> Navigator::candidates(const NavGraph& navGraph, unsigned int scan, unsigned int ix,
+        double heading, double elevation, unsigned int viewIndex) const {
+    if (candidateTablesEnabled) {
+        // Candidates are a function of the viewpoint and the discretized view
+        const CandidateTable& table = candidateTable(navGraph, scan);
+        unsigned int entry = ix*3*headingCount + viewIndex;
+        return Span<Candidate>(table.candidates.data() + table.offsets[entry],
+                table.candidates.data() + table.offsets[entry+1]);
+    }
+    static thread_local std::vector<Candidate> scratch;
+    scratch.clear();
+    sortNavigable(navGraph, scan, ix, heading, elevation, scratch);
+    return Span<Candidate>(scratch);
+}
+
+void Navigator::sortNavigable(const NavGraph& navGraph, unsigned int scan, unsigned int ix, double heading,
+        double elevation, std::vector<Candidate>& sorted) const {
+    NavGraph::NeighbourBearings neighbours = navGraph.neighbourBearings(scan, ix);
+
+    // Ranges of neighbours sorted by bearing that are between camera left and camera right
+    typedef std::pair<unsigned int, unsigned int> Range;
+    Range ranges[2] = {Range(0, neighbours.viewpoints.size()), Range(0, 0)};
+    if (restrictedNavigation && half_hfov < M_PI) {
+        const double* first = neighbours.bearings.begin();
+        const double* last = neighbours.bearings.end();
+        double left = heading - half_hfov;
+        double right = heading + half_hfov;
+        if (left < 0.0) {
+            // window wraps around north
+            ranges[0] = Range(0, std::upper_bound(first, last, right) - first);
+            ranges[1] = Range(std::lower_bound(first, last, left + 2.0*M_PI) - first, last - first);
+        } else if (right >= 2.0*M_PI) {
+            ranges[0] = Range(0, std::upper_bound(first, last, right - 2.0*M_PI) - first);
+            ranges[1] = Range(std::lower_bound(first, last, left) - first, last - first);
+        } else {
+            ranges[0] = Range(std::lower_bound(first, last, left) - first, std::upper_bound(first, last, right) - first);
+        }
+    }
+
+    // The current location comes first, with zero relative heading, elevation and distance
+    static thread_local std::vector<Candidate> visible;
+    static thread_local std::vector<unsigned int> order;
+    visible.assign(1, Candidate{ix, 0.f, 0.0, 0.0});
+    for (const Range& range : ranges) {
+        for (unsigned int k = range.first; k < range.second; ++k) {
+            // Bearing relative to the camera heading, in [-pi, pi]
+            double rel_heading = neighbours.bearings[k] - heading;
+            if (rel_heading > M_PI) {
+                rel_heading -= 2.0*M_PI;
+            } else if (rel_heading < -M_PI) {
+                rel_heading += 2.0*M_PI;
+            }
+            visible.push_back(Candidate{neighbours.viewpoints[k], neighbours.distances[k], rel_heading,
+                    neighbours.elevations[k] - elevation});
+        }
+    }
+    order.resize(visible.size());
+    for (unsigned int c = 0; c < order.size(); ++c) {
+        order[c] = c;
+    }
+    // Same comparisons as ViewpointPtrComp, so the order is identical to sorting the pointers
+    std::sort(order.begin(), order.end(), [&](unsigned int l, unsigned int r) {
+        const Candidate& lc = visible[l];
+        const Candidate& rc = visible[r];
+        return sqrt(lc.rel_heading*lc.rel_heading+lc.rel_elevation*lc.rel_elevation)
+            < sqrt(rc.rel_heading*rc.rel_heading+rc.rel_elevation*rc.rel_elevation);
+    });
+    for (unsigned int c : order) {
+        sorted.push_back(visible[c]);
+    }
+}
+
+const Navigator::CandidateTable& Navigator::candidateTable(const NavGraph& navGraph, unsigned int scan) const {
+    std::call_once(tablesAllocated, [&]() {
+        candidateTables.resize(navGraph.scanCount());
+        for (auto& table : candidateTables) {
+            table.reset(new CandidateTable());
+        }
+    });
+    CandidateTable& table = *candidateTables.at(scan);
+    std::call_once(table.built, [&]() {
+        const double headingIncrement = M_PI*2.0/headingCount;
+        unsigned int count = navGraph.viewpointCount(scan);
+        table.offsets.assign(1, 0);
+        for (unsigned int ix = 0; ix < count; ++ix) {
+            // Same order as viewIndex, and the same values as setHeadingElevation
+            for (int level = 0; level < 3; ++level) {
+                double elevation = level == 0 ? -elevationIncrement : (level == 2 ? elevationIncrement : 0.0);
+                for (int heading_step = 0; heading_step < headingCount; ++heading_step) {
+                    sortNavigable(navGraph, scan, ix, (double)heading_step * headingIncrement, elevation,
+                            table.candidates);
+                    table.offsets.push_back(table.candidates.size());
+                }
+            }
+        }
+    });
+    return table;
+}
+
+}
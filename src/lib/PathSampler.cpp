@@ -0,0 +1,265 @@
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <cmath>
+
+#include "PathSampler.hpp"
+
+namespace mattersim {
+
+namespace {
+
+    // splitmix64 finalizer
+    uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // splitmix64
+    uint64_t next(uint64_t& state) {
+        state += 0x9E3779B97F4A7C15ull;
+        return mix(state);
+    }
+
+}
+
+
+PathSampler::PathSampler() : initialized(false),
+                             minDistance(0),
+                             maxDistance(std::numeric_limits<float>::infinity()),
+                             minHops(1),
+                             maxHops(std::numeric_limits<unsigned int>::max()),
+                             seed(1),
+                             randomWalks(false),
+                             navGraphPath("./connectivity") {
+}
+
+void PathSampler::setNavGraphPath(const std::string& path) {
+    if (!initialized) {
+        navGraphPath = path;
+    }
+}
+
+void PathSampler::setScans(const std::vector<std::string>& scanIds) {
+    if (!initialized) {
+        this->scanIds = scanIds;
+    }
+}
+
+void PathSampler::setDistanceRange(float min, float max) {
+    if (!initialized) {
+        minDistance = min;
+        maxDistance = max;
+    }
+}
+
+void PathSampler::setHopRange(unsigned int min, unsigned int max) {
+    if (!initialized) {
+        minHops = min;
+        maxHops = max;
+    }
+}
+
+void PathSampler::setSeed(uint64_t seed) {
+    if (!initialized) {
+        this->seed = seed;
+    }
+}
+
+void PathSampler::setRandomWalks(bool randomWalks) {
+    if (!initialized) {
+        this->randomWalks = randomWalks;
+    }
+}
+
+const NavGraph& PathSampler::navGraph() const {
+    // Images are never loaded, so leave them for a Simulator to configure
+    return NavGraph::getInstance(navGraphPath);
+}
+
+void PathSampler::initialize() {
+    if (initialized) {
+        return;
+    }
+    auto& graph = navGraph();
+    scans.clear();
+    if (scanIds.empty()) {
+        for (unsigned int scan = 0; scan < graph.scanCount(); ++scan) {
+            scans.push_back(scan);
+        }
+    } else {
+        for (auto& scanId : scanIds) {
+            scans.push_back(graph.scanHandle(scanId));
+        }
+    }
+    for (unsigned int scan : scans) {
+        // Load the graphs first, and raise any errors outside the parallel loop
+        graph.viewpointCount(scan);
+    }
+    pairs.assign(scans.size(), std::vector<unsigned int>());
+    if (randomWalks) {
+        if (minHops > maxHops || maxHops == std::numeric_limits<unsigned int>::max()) {
+            throw std::invalid_argument( "MatterSim: Random walks need a finite hop range, see setHopRange" );
+        }
+        for (unsigned int s = 0; s < scans.size(); ++s) {
+            for (unsigned int ix = 0; ix < graph.viewpointCount(scans[s]); ++ix) {
+                if (graph.included(scans[s], ix) && graph.adjacentViewpoints(scans[s], ix).size() > 0) {
+                    pairs[s].push_back(ix);
+                }
+            }
+        }
+    } else {
+        paths.assign(scans.size(), NULL);
+        int count = scans.size();
+        #pragma omp parallel for schedule(dynamic)
+        for (int s = 0; s < count; ++s) {
+            unsigned int scan = scans[s];
+            const ShortestPaths& scanPaths = graph.shortestPaths(scan);
+            paths[s] = &scanPaths;
+            unsigned int n = scanPaths.size;
+            std::vector<unsigned int> hops(n);
+            std::vector<unsigned int> chain;
+            for (unsigned int goal = 0; goal < n; ++goal) {
+                if (!graph.included(scan, goal)) {
+                    continue;
+                }
+                // Hops to the goal, filled in by following next hops until one is known
+                std::fill(hops.begin(), hops.end(), noNextHop);
+                hops[goal] = 0;
+                for (unsigned int start = 0; start < n; ++start) {
+                    unsigned int ix = start;
+                    chain.clear();
+                    while (hops[ix] == noNextHop && scanPaths.nextHop(ix, goal) != noNextHop) {
+                        chain.push_back(ix);
+                        ix = scanPaths.nextHop(ix, goal);
+                    }
+                    if (hops[ix] == noNextHop) {
+                        continue; // unreachable
+                    }
+                    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+                        hops[*it] = hops[scanPaths.nextHop(*it, goal)] + 1;
+                    }
+                    float distance = scanPaths.distance(start, goal);
+                    if (hops[start] >= minHops && hops[start] <= maxHops
+                            && distance >= minDistance && distance <= maxDistance) {
+                        pairs[s].push_back(start * n + goal);
+                    }
+                }
+            }
+        }
+    }
+    pairOffsets.assign(1, 0);
+    for (auto& scanPairs : pairs) {
+        pairOffsets.push_back(pairOffsets.back() + scanPairs.size());
+    }
+    if (pairOffsets.back() == 0) {
+        throw std::runtime_error( "MatterSim: No paths satisfy the path sampler's constraints" );
+    }
+    initialized = true;
+}
+
+size_t PathSampler::pairCount() {
+    if (!initialized) {
+        initialize();
+    }
+    return pairOffsets.back();
+}
+
+void PathSampler::samplePath(const NavGraph& graph, size_t index, SampledPath& path) const {
+    uint64_t state = mix(seed ^ mix(index + 0x9E3779B97F4A7C15ull));
+    size_t pair = next(state) % pairOffsets.back();
+    unsigned int s = std::upper_bound(pairOffsets.begin(), pairOffsets.end(), pair) - pairOffsets.begin() - 1;
+    path.scanHandle = scans[s];
+    if (randomWalks) {
+        unsigned int hops = minHops + next(state) % (maxHops - minHops + 1);
+        unsigned int previous = noNextHop;
+        path.path.assign(1, pairs[s][pair - pairOffsets[s]]);
+        path.distance = 0;
+        for (unsigned int hop = 0; hop < hops; ++hop) {
+            auto neighbours = graph.neighbourBearings(scans[s], path.path.back());
+            size_t count = neighbours.viewpoints.size();
+            if (count == 0) {
+                break; // nowhere to go
+            }
+            size_t back = count;
+            for (size_t k = 0; k < count; ++k) {
+                if (neighbours.viewpoints[k] == previous) {
+                    back = k;
+                }
+            }
+            size_t k;
+            if (back < count && count > 1) {
+                // Any neighbour except the one just left
+                k = next(state) % (count - 1);
+                k += k >= back;
+            } else {
+                k = next(state) % count;
+            }
+            previous = path.path.back();
+            path.path.push_back(neighbours.viewpoints[k]);
+            path.distance += neighbours.distances[k];
+        }
+    } else {
+        const ShortestPaths& scanPaths = *paths[s];
+        unsigned int start = pairs[s][pair - pairOffsets[s]] / scanPaths.size;
+        unsigned int goal = pairs[s][pair - pairOffsets[s]] % scanPaths.size;
+        path.path.assign(1, start);
+        while (path.path.back() != goal) {
+            path.path.push_back(scanPaths.nextHop(path.path.back(), goal));
+        }
+        path.distance = scanPaths.distance(start, goal);
+    }
+    path.heading = (next(state) >> 11) * (1.0 / 9007199254740992.0) * 2.0 * M_PI;
+}
+
+std::vector<SampledPath> PathSampler::sample(size_t first, size_t count) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& graph = navGraph();
+    std::vector<SampledPath> paths(count);
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < (long)count; ++i) {
+        samplePath(graph, first + i, paths[i]);
+    }
+    return paths;
+}
+
+void PathSampler::writeJsonLines(const std::string& filename, size_t count) {
+    if (!initialized) {
+        initialize();
+    }
+    auto& graph = navGraph();
+    std::ofstream ofs(filename, std::ofstream::trunc);
+    if (!ofs) {
+        throw std::runtime_error( "MatterSim: Could not open " + filename + " for writing" );
+    }
+    std::vector<std::string> lines(std::min(count, chunkSize));
+    for (size_t first = 0; first < count; first += chunkSize) {
+        long size = std::min(count - first, chunkSize);
+        #pragma omp parallel for schedule(static)
+        for (long i = 0; i < size; ++i) {
+            SampledPath path;
+            samplePath(graph, first + i, path);
+            std::string& line = lines[i];
+            line.assign("{\"scan\": \"").append(graph.scanId(path.scanHandle)).append("\", \"path\": [");
+            for (unsigned int k = 0; k < path.path.size(); ++k) {
+                line.append(k == 0 ? "\"" : ", \"").append(graph.viewpoint(path.scanHandle, path.path[k])).append("\"");
+            }
+            char numbers[64];
+            std::snprintf(numbers, sizeof(numbers), "], \"distance\": %.6g, \"heading\": %.6g}\n",
+                    path.distance, path.heading);
+            line += numbers;
+        }
+        for (long i = 0; i < size; ++i) {
+            ofs << lines[i];
+        }
+    }
+    if (!ofs.flush()) {
+        throw std::runtime_error( "MatterSim: Could not write to " + filename );
+    }
+}
+
+}
@@ -0,0 +1,163 @@
+#include <fstream>
+#include <queue>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <cmath>
+#include <unistd.h>
+
+#include "ShortestPaths.hpp"
+
+namespace mattersim {
+
+namespace {
+
+    const char fileMagic[8] = {'M', 'S', 'P', 'A', 'T', 'H', 'S', '1'};
+
+    struct Header {
+        char magic[8];
+        uint64_t key;
+        uint32_t size;
+        uint32_t reserved;
+    };
+
+    // FNV-1a
+    void hashBytes(uint64_t& hash, const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < bytes; ++i) {
+            hash ^= p[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    double edgeLength(const glm::vec3& a, const glm::vec3& b) {
+        double dx = double(a.x) - b.x;
+        double dy = double(a.y) - b.y;
+        double dz = double(a.z) - b.z;
+        return std::sqrt(dx*dx + dy*dy + dz*dz);
+    }
+
+}
+
+
+void computeShortestPaths(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+        const std::vector<unsigned int>& neighbourOffsets, const std::vector<unsigned int>& neighbours,
+        ShortestPaths& paths) {
+    unsigned int n = positions.size();
+    paths.size = n;
+    paths.distances.assign(size_t(n) * n, std::numeric_limits<float>::infinity());
+    paths.nextHops.assign(size_t(n) * n, noNextHop);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int source = 0; source < n; ++source) {
+        if (!included[source]) {
+            continue;
+        }
+        // Accumulate in double precision, and only round the final distances
+        std::vector<double> distance(n, std::numeric_limits<double>::infinity());
+        std::vector<unsigned int> firstHop(n, noNextHop);
+        typedef std::pair<double, unsigned int> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+        distance[source] = 0;
+        firstHop[source] = source;
+        queue.push({0.0, source});
+        while (!queue.empty()) {
+            Entry top = queue.top();
+            queue.pop();
+            unsigned int u = top.second;
+            if (top.first > distance[u]) {
+                continue; // stale entry
+            }
+            for (unsigned int e = neighbourOffsets[u]; e < neighbourOffsets[u+1]; ++e) {
+                unsigned int v = neighbours[e];
+                double d = distance[u] + edgeLength(positions[u], positions[v]);
+                if (d < distance[v]) {
+                    distance[v] = d;
+                    firstHop[v] = u == source ? v : firstHop[u];
+                    queue.push({d, v});
+                }
+            }
+        }
+        float* row = &paths.distances[size_t(source) * n];
+        unsigned int* hops = &paths.nextHops[size_t(source) * n];
+        for (unsigned int i = 0; i < n; ++i) {
+            row[i] = distance[i];
+            hops[i] = firstHop[i];
+        }
+    }
+}
+
+
+uint64_t shortestPathsKey(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+        const std::vector<unsigned int>& neighbourOffsets, const std::vector<unsigned int>& neighbours) {
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t count = positions.size();
+    hashBytes(hash, &count, sizeof(count));
+    for (auto& position : positions) {
+        float xyz[3] = {position.x, position.y, position.z};
+        hashBytes(hash, xyz, sizeof(xyz));
+    }
+    for (unsigned int i = 0; i < included.size(); ++i) {
+        unsigned char flag = included[i];
+        hashBytes(hash, &flag, 1);
+    }
+    hashBytes(hash, neighbourOffsets.data(), neighbourOffsets.size() * sizeof(unsigned int));
+    hashBytes(hash, neighbours.data(), neighbours.size() * sizeof(unsigned int));
+    return hash;
+}
+
+
+bool readShortestPaths(const std::string& filename, uint64_t key, unsigned int size, ShortestPaths& paths) {
+    std::ifstream ifs(filename, std::ifstream::binary);
+    Header header;
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(Header))
+            || std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 || header.key != key
+            || header.size != size) {
+        return false;
+    }
+    size_t count = size_t(header.size) * header.size;
+    ShortestPaths cached;
+    cached.size = header.size;
+    cached.distances.resize(count);
+    cached.nextHops.resize(count);
+    if (!ifs.read(reinterpret_cast<char*>(cached.distances.data()), count * sizeof(float))
+            || !ifs.read(reinterpret_cast<char*>(cached.nextHops.data()), count * sizeof(unsigned int))) {
+        return false;
+    }
+    // Next hops are used as indices without checks, so a corrupt file must not get through
+    for (unsigned int next : cached.nextHops) {
+        if (next >= size && next != noNextHop) {
+            return false;
+        }
+    }
+    std::swap(paths, cached);
+    return true;
+}
+
+
+void writeShortestPaths(const std::string& filename, uint64_t key, const ShortestPaths& paths) {
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+    header.key = key;
+    header.size = paths.size;
+    // Other processes may be writing the same file, so each writes its own temporary file
+    auto tempFile = filename + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream ofs(tempFile, std::ofstream::binary | std::ofstream::trunc);
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        ofs.write(reinterpret_cast<const char*>(paths.distances.data()), paths.distances.size() * sizeof(float));
+        ofs.write(reinterpret_cast<const char*>(paths.nextHops.data()), paths.nextHops.size() * sizeof(unsigned int));
+        if (ofs.fail()) {
+            ofs.close();
+            std::remove(tempFile.c_str());
+            return;
+        }
+    }
+    if (std::rename(tempFile.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFile.c_str());
+    }
+}
+
+}
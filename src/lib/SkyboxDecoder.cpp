@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <csetjmp>
+#include <stdexcept>
+
+#ifdef LIBJPEG_TURBO
+#include <jpeglib.h>
+#endif
+
+#include "SkyboxDecoder.hpp"
+#include "FileReader.hpp"
+
+namespace mattersim {
+
+#ifdef LIBJPEG_TURBO
+namespace {
+
+    struct JpegErrorManager {
+        jpeg_error_mgr pub;
+        jmp_buf jumpBuffer;
+    };
+
+    void jpegErrorExit(j_common_ptr cinfo) {
+        JpegErrorManager* err = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+        longjmp(err->jumpBuffer, 1);
+    }
+
+    unsigned char decodeSkyboxJpeg(const std::vector<unsigned char>& data, const std::string& filename,
+                          unsigned int minFaceSize, unsigned char faceMask, std::vector<cv::Mat>& faces) {
+        // All objects with destructors are declared before setjmp
+        jpeg_decompress_struct cinfo;
+        JpegErrorManager jerr;
+        std::vector<unsigned char> row;
+        char message[JMSG_LENGTH_MAX] = "";
+        cinfo.err = jpeg_std_error(&jerr.pub);
+        jerr.pub.error_exit = jpegErrorExit;
+        if (setjmp(jerr.jumpBuffer)) {
+            (*cinfo.err->format_message)(reinterpret_cast<j_common_ptr>(&cinfo), message);
+            jpeg_destroy_decompress(&cinfo);
+            throw std::invalid_argument( "MatterSim: Could not decode skybox RGB file at: " +
+                    filename + " (" + message + ")" );
+        }
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data.data()), data.size());
+        jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+        cinfo.out_color_space = JCS_EXT_BGR;
+#else
+        cinfo.out_color_space = JCS_RGB;
+#endif
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = skyboxScaleDenom(cinfo.image_width / 6, minFaceSize);
+        jpeg_start_decompress(&cinfo);
+
+        unsigned int w = cinfo.output_width / 6;
+        unsigned int h = cinfo.output_height;
+
+        // Only decode the span of the strip between the first and last required face
+        if (faceMask == 0) {
+            faceMask = allCubemapFaces;
+        }
+        unsigned int first = 5;
+        unsigned int last = 0;
+        for (unsigned int i = 0; i < 6; ++i) {
+            if (faceMask & (1 << i)) {
+                first = std::min(first, skyboxStripIndex[i]);
+                last = std::max(last, skyboxStripIndex[i]);
+            }
+        }
+        JDIMENSION xoffset = first * w;
+        JDIMENSION width = (last + 1 - first) * w;
+        if (width < cinfo.output_width) {
+            // xoffset may be moved left to an iMCU boundary
+            jpeg_crop_scanline(&cinfo, &xoffset, &width);
+        }
+        unsigned char decoded = 0;
+        faces.resize(6);
+        for (unsigned int i = 0; i < 6; ++i) {
+            if (skyboxStripIndex[i] >= first && skyboxStripIndex[i] <= last) {
+                faces[i].create(h, w, CV_8UC3);
+                decoded |= 1 << i;
+            }
+        }
+
+        // Each scanline of the strip is split directly across the faces
+        row.resize(cinfo.output_width * cinfo.output_components);
+        JSAMPROW rowPtr = row.data();
+        while (cinfo.output_scanline < cinfo.output_height) {
+            unsigned int y = cinfo.output_scanline;
+            jpeg_read_scanlines(&cinfo, &rowPtr, 1);
+            for (unsigned int i = 0; i < 6; ++i) {
+                if (!(decoded & (1 << i))) {
+                    continue;
+                }
+                unsigned char* dst = faces[i].ptr(y);
+                std::memcpy(dst, rowPtr + (skyboxStripIndex[i] * w - xoffset) * 3, w * 3);
+#ifndef JCS_EXTENSIONS
+                for (unsigned int x = 0; x < w; ++x) {
+                    std::swap(dst[3*x], dst[3*x+2]);
+                }
+#endif
+            }
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return decoded;
+    }
+
+}
+#endif
+
+
+unsigned int requiredFaceSize(int height, double vfov) {
+    // A cube face spans [-1, 1] in tangent space, the camera spans [-tan(vfov/2), tan(vfov/2)]
+    return static_cast<unsigned int>(std::ceil(height / std::tan(vfov / 2.0)));
+}
+
+
+unsigned int skyboxScaleDenom(unsigned int faceSize, unsigned int minFaceSize) {
+    unsigned int denom = 1;
+    if (minFaceSize == 0) {
+        return denom;
+    }
+    while (denom < 8 && faceSize / (denom * 2) >= minFaceSize) {
+        denom *= 2;
+    }
+    return denom;
+}
+
+
+unsigned char decodeSkybox(const std::string& filename, unsigned int minFaceSize, 
+        unsigned char faceMask, std::vector<cv::Mat>& faces) {
+    std::vector<unsigned char> data;
+    readFile(filename, data);
+    return decodeSkybox(data, filename, minFaceSize, faceMask, faces);
+}
+
+
+unsigned char decodeSkybox(const std::vector<unsigned char>& data, const std::string& filename, 
+        unsigned int minFaceSize, unsigned char faceMask, std::vector<cv::Mat>& faces) {
+#ifdef LIBJPEG_TURBO
+    return decodeSkyboxJpeg(data, filename, minFaceSize, faceMask, faces);
+#else
+    cv::Mat rgb = cv::imdecode(data, CV_LOAD_IMAGE_COLOR);
+    if (rgb.empty()) {
+        throw std::invalid_argument( "MatterSim: Could not decode skybox RGB file at: " + filename );
+    }
+    int w = rgb.cols/6;
+    int h = rgb.rows;
+    faces.resize(6);
+    for (unsigned int i = 0; i < 6; ++i) {
+        faces[i] = rgb(cv::Rect(skyboxStripIndex[i]*w, 0, w, h));
+    }
+    return allCubemapFaces;
+#endif
+}
+
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "SpatialIndex.hpp"
+
+namespace mattersim {
+
+namespace {
+
+    double squaredDistance(const glm::vec3& a, const glm::vec3& b) {
+        double dx = double(a.x) - b.x;
+        double dy = double(a.y) - b.y;
+        double dz = double(a.z) - b.z;
+        return dx*dx + dy*dy + dz*dz;
+    }
+
+    void buildNode(const std::vector<glm::vec3>& points, std::vector<unsigned char>& axes,
+            std::vector<unsigned int>& order, unsigned int lo, unsigned int hi) {
+        if (hi - lo <= 1) {
+            return;
+        }
+        // Split along the axis with the largest extent
+        glm::vec3 lower = points[order[lo]], upper = points[order[lo]];
+        for (unsigned int i = lo + 1; i < hi; ++i) {
+            const glm::vec3& p = points[order[i]];
+            for (int a = 0; a < 3; ++a) {
+                lower[a] = std::min(lower[a], p[a]);
+                upper[a] = std::max(upper[a], p[a]);
+            }
+        }
+        glm::vec3 extent = upper - lower;
+        unsigned char axis = 0;
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+        unsigned int mid = (lo + hi) / 2;
+        std::nth_element(order.begin() + lo, order.begin() + mid, order.begin() + hi,
+                [&](unsigned int l, unsigned int r) {
+            return points[l][axis] < points[r][axis] || (points[l][axis] == points[r][axis] && l < r);
+        });
+        axes[mid] = axis;
+        buildNode(points, axes, order, lo, mid);
+        buildNode(points, axes, order, mid + 1, hi);
+    }
+
+    void nearestNode(const SpatialIndex& index, const glm::vec3& point, unsigned int lo, unsigned int hi,
+            unsigned int& best, double& bestDistance) {
+        if (lo >= hi) {
+            return;
+        }
+        unsigned int mid = (lo + hi) / 2;
+        double d = squaredDistance(point, index.points[mid]);
+        if (d < bestDistance || (d == bestDistance && index.viewpoints[mid] < index.viewpoints[best])) {
+            best = mid;
+            bestDistance = d;
+        }
+        unsigned char axis = index.axes[mid];
+        double diff = double(point[axis]) - index.points[mid][axis];
+        if (diff < 0) {
+            nearestNode(index, point, lo, mid, best, bestDistance);
+            if (diff*diff <= bestDistance) {
+                nearestNode(index, point, mid + 1, hi, best, bestDistance);
+            }
+        } else {
+            nearestNode(index, point, mid + 1, hi, best, bestDistance);
+            if (diff*diff <= bestDistance) {
+                nearestNode(index, point, lo, mid, best, bestDistance);
+            }
+        }
+    }
+
+    void withinNode(const SpatialIndex& index, const glm::vec3& point, double radius2, unsigned int lo,
+            unsigned int hi, std::vector<std::pair<double, unsigned int> >& found) {
+        if (lo >= hi) {
+            return;
+        }
+        unsigned int mid = (lo + hi) / 2;
+        double d = squaredDistance(point, index.points[mid]);
+        if (d <= radius2) {
+            found.emplace_back(d, index.viewpoints[mid]);
+        }
+        unsigned char axis = index.axes[mid];
+        double diff = double(point[axis]) - index.points[mid][axis];
+        if (diff <= 0 || diff*diff <= radius2) {
+            withinNode(index, point, radius2, lo, mid, found);
+        }
+        if (diff >= 0 || diff*diff <= radius2) {
+            withinNode(index, point, radius2, mid + 1, hi, found);
+        }
+    }
+
+}
+
+
+void buildSpatialIndex(const std::vector<glm::vec3>& positions, const std::vector<bool>& included,
+        SpatialIndex& index) {
+    std::vector<unsigned int> order;
+    for (unsigned int ix = 0; ix < positions.size(); ++ix) {
+        if (included[ix]) {
+            order.push_back(ix);
+        }
+    }
+    index.axes.assign(order.size(), 0);
+    buildNode(positions, index.axes, order, 0, order.size());
+    index.viewpoints = order;
+    index.points.resize(order.size());
+    for (unsigned int i = 0; i < order.size(); ++i) {
+        index.points[i] = positions[order[i]];
+    }
+}
+
+
+bool SpatialIndex::nearest(const glm::vec3& point, unsigned int& viewpoint, double& distance) const {
+    if (points.empty()) {
+        return false;
+    }
+    unsigned int best = 0;
+    double bestDistance = std::numeric_limits<double>::infinity();
+    nearestNode(*this, point, 0, points.size(), best, bestDistance);
+    viewpoint = viewpoints[best];
+    distance = std::sqrt(bestDistance);
+    return true;
+}
+
+
+void SpatialIndex::within(const glm::vec3& point, double radius, std::vector<unsigned int>& result) const {
+    if (radius < 0) {
+        return;
+    }
+    std::vector<std::pair<double, unsigned int> > found;
+    withinNode(*this, point, radius*radius, 0, points.size(), found);
+    std::sort(found.begin(), found.end());
+    for (auto& f : found) {
+        result.push_back(f.second);
+    }
+}
+
+}
@@ -0,0 +1,156 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "TextureUploader.hpp"
+
+namespace mattersim {
+
+
+void uploadCubemapFaces(const std::vector<cv::Mat>& faces, unsigned char faceMask, GLenum format, GLenum type) {
+    // Pack the faces tightly into a single buffer
+    size_t offsets[6];
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < 6; ++i) {
+        if (faceMask & (1 << i)) {
+            offsets[i] = bytes;
+            bytes += faces[i].rows * faces[i].cols * faces[i].elemSize();
+        }
+    }
+    if (bytes == 0) {
+        return;
+    }
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    unsigned char* staging = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (!staging) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        throw std::runtime_error( "MatterSim: glMapBufferRange failed" );
+    }
+    for (unsigned int i = 0; i < 6; ++i) {
+        if (faceMask & (1 << i)) {
+            const cv::Mat& face = faces[i];
+            size_t rowBytes = face.cols * face.elemSize();
+            for (int y = 0; y < face.rows; ++y) {
+                std::memcpy(staging + offsets[i] + y * rowBytes, face.ptr(y), rowBytes);
+            }
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    for (unsigned int i = 0; i < 6; ++i) {
+        if (faceMask & (1 << i)) {
+            // with a pixel unpack buffer bound, the data pointer is an offset into the buffer
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, faces[i].cols, faces[i].rows,
+                    format, type, reinterpret_cast<const GLvoid*>(offsets[i]));
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    // the buffer storage is only released once the transfer has completed
+    glDeleteBuffers(1, &pbo);
+}
+
+
+TextureUploader::TextureUploader() : threaded(false), stopping(false) {
+}
+
+
+#ifdef EGL_RENDERING
+TextureUploader::TextureUploader(EGLDisplay display, EGLConfig config, EGLContext shareContext) :
+        threaded(true), display(display), stopping(false) {
+    context = eglCreateContext(display, config, shareContext, NULL);
+    if (context == EGL_NO_CONTEXT) {
+        throw std::runtime_error( "MatterSim: Could not create a shared EGL context for texture uploads" );
+    }
+    loader = std::thread(&TextureUploader::run, this);
+}
+#endif
+
+
+TextureUploader::~TextureUploader() {
+    if (threaded) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_one();
+        loader.join();
+#ifdef EGL_RENDERING
+        eglDestroyContext(display, context);
+#endif
+    }
+}
+
+
+std::shared_future<void> TextureUploader::submit(const std::function<void()>& task) {
+    std::promise<void> promise;
+    std::shared_future<void> future = promise.get_future().share();
+    if (!threaded) {
+        try {
+            task();
+            promise.set_value();
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+        return future;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace(task, std::move(promise));
+    }
+    condition.notify_one();
+    return future;
+}
+
+
+void TextureUploader::run() {
+    std::exception_ptr contextError;
+#ifdef EGL_RENDERING
+    // The API binding is per thread
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        contextError = std::make_exception_ptr(std::runtime_error(
+                "MatterSim: Could not make the texture upload context current" ));
+    }
+#endif
+    while (true) {
+        std::pair<std::function<void()>, std::promise<void> > task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                break;
+            }
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        try {
+            if (contextError) {
+                std::rethrow_exception(contextError);
+            }
+            task.first();
+            // Only report completion once the uploads have finished, so the rendering
+            // context sees the new texture contents
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            GLenum status;
+            do {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            if (status == GL_WAIT_FAILED) {
+                throw std::runtime_error( "MatterSim: glClientWaitSync failed" );
+            }
+            task.second.set_value();
+        } catch (...) {
+            task.second.set_exception(std::current_exception());
+        }
+    }
+#ifdef EGL_RENDERING
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
+}
+
+}
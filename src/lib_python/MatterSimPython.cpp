@@ -1,6 +1,9 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 #include "MatterSim.hpp"
+#include "NavEngine.hpp"
+#include "PathSampler.hpp"
 #include "cbf.h"
 
 namespace py = pybind11;
@@ -22,12 +25,43 @@ namespace mattersim {
             3, &spaceSigmas[0], &rangeSigmas[0]);
     }
 
+    /**
+     * Read-only numpy view of a NavBatchState array, which keeps the state (and its engine) alive
+     * @param columns - 0 for one entry per environment, otherwise the number of entries per environment
+     */
+    template <typename T>
+    py::array_t<T> batchArray(py::object base, const std::vector<T>& values, unsigned int columns) {
+        std::vector<ssize_t> shape(1, columns == 0 ? values.size() : values.size() / columns);
+        if (columns > 0) {
+            shape.push_back(columns);
+        }
+        py::array_t<T> array(shape, values.data(), base);
+        array.attr("setflags")(py::arg("write") = false);
+        return array;
+    }
+
+    /**
+     * Run executeSequence or executePath, and return a new TrajectoryLog of the steps if requested.
+     * A log is never refilled, so numpy views of the logs of earlier calls stay valid.
+     */
+    template <typename Execute>
+    py::object executeLogged(bool log, const Execute& execute) {
+        if (!log) {
+            execute(NULL);
+            return py::none();
+        }
+        std::shared_ptr<TrajectoryLog> result = std::make_shared<TrajectoryLog>();
+        execute(result.get());
+        return py::cast(result);
+    }
+
 }
 
 using namespace mattersim;
 
 PYBIND11_MODULE(MatterSim, m) {
     m.def("cbf", &mattersim::cbf, "Cross Bilateral Filter");
+    m.attr("noNextHop") = noNextHop;
     py::class_<Viewpoint, ViewpointPtr>(m, "ViewPoint")
         .def_readonly("viewpointId", &Viewpoint::viewpointId)
         .def_readonly("ix", &Viewpoint::ix)
@@ -57,8 +91,40 @@ PYBIND11_MODULE(MatterSim, m) {
                 }
             );
         });
+    py::class_<Actions>(m, "Actions")
+        .def_readonly("index", &Actions::index)
+        .def_readonly("heading", &Actions::heading)
+        .def_readonly("elevation", &Actions::elevation);
+    py::class_<TrajectoryLog, std::shared_ptr<TrajectoryLog> >(m, "TrajectoryLog")
+        .def_property_readonly("offsets", [](py::object l) {
+            return batchArray(l, l.cast<const TrajectoryLog&>().offsets, 0); })
+        .def_property_readonly("viewpointIx", [](py::object l) {
+            return batchArray(l, l.cast<const TrajectoryLog&>().viewpointIx, 0); })
+        .def_property_readonly("heading", [](py::object l) {
+            return batchArray(l, l.cast<const TrajectoryLog&>().heading, 0); })
+        .def_property_readonly("elevation", [](py::object l) {
+            return batchArray(l, l.cast<const TrajectoryLog&>().elevation, 0); })
+        .def_property_readonly("viewIndex", [](py::object l) {
+            return batchArray(l, l.cast<const TrajectoryLog&>().viewIndex, 0); })
+        .def_readonly("width", &TrajectoryLog::width)
+        .def_readonly("height", &TrajectoryLog::height)
+        .def_property_readonly("rgb", [](py::object l) { // steps x height x width x 3
+            const TrajectoryLog& log = l.cast<const TrajectoryLog&>();
+            ssize_t frameSize = ssize_t(log.height) * log.width * 3;
+            py::array_t<unsigned char> array({frameSize == 0 ? 0 : ssize_t(log.rgb.size()) / frameSize,
+                    ssize_t(log.height), ssize_t(log.width), ssize_t(3)}, log.rgb.data(), l);
+            array.attr("setflags")(py::arg("write") = false);
+            return array; })
+        .def_property_readonly("depth", [](py::object l) { // steps x height x width
+            const TrajectoryLog& log = l.cast<const TrajectoryLog&>();
+            ssize_t frameSize = ssize_t(log.height) * log.width;
+            py::array_t<unsigned short> array({frameSize == 0 ? 0 : ssize_t(log.depth.size()) / frameSize,
+                    ssize_t(log.height), ssize_t(log.width)}, log.depth.data(), l);
+            array.attr("setflags")(py::arg("write") = false);
+            return array; });
     py::class_<SimState, SimStatePtr>(m, "SimState")
         .def_readonly("scanId", &SimState::scanId)
+        .def_readonly("scanHandle", &SimState::scanHandle)
         .def_readonly("step", &SimState::step)
         .def_readonly("rgb", &SimState::rgb)
         .def_readonly("depth", &SimState::depth)
@@ -66,7 +132,21 @@ PYBIND11_MODULE(MatterSim, m) {
         .def_readonly("heading", &SimState::heading)
         .def_readonly("elevation", &SimState::elevation)
         .def_readonly("viewIndex", &SimState::viewIndex)
+        .def_readonly("lowResolution", &SimState::lowResolution)
+        .def_readonly("placeholder", &SimState::placeholder)
         .def_readonly("navigableLocations", &SimState::navigableLocations);
+    py::enum_<CachePolicy>(m, "CachePolicy")
+        .value("LRU", CachePolicy::LRU)
+        .value("TwoQueue", CachePolicy::TwoQueue)
+        .value("ScanAffinity", CachePolicy::ScanAffinity);
+    py::class_<CacheStats>(m, "CacheStats")
+        .def_readonly("hits", &CacheStats::hits)
+        .def_readonly("misses", &CacheStats::misses)
+        .def_readonly("evictions", &CacheStats::evictions)
+        .def_readonly("evictedBytes", &CacheStats::evictedBytes)
+        .def_readonly("entries", &CacheStats::entries)
+        .def_readonly("bytes", &CacheStats::bytes)
+        .def_readonly("capacity", &CacheStats::capacity);
     py::class_<Simulator>(m, "Simulator")
         .def(py::init<>())
         .def("setDatasetPath", &Simulator::setDatasetPath)
@@ -79,15 +159,162 @@ PYBIND11_MODULE(MatterSim, m) {
         .def("setRestrictedNavigation", &Simulator::setRestrictedNavigation)
         .def("setPreloadingEnabled", &Simulator::setPreloadingEnabled)
         .def("setDepthEnabled", &Simulator::setDepthEnabled)
+        .def("setLazyLoadingEnabled", &Simulator::setLazyLoadingEnabled)
+        .def("setLowResolutionFaceSize", &Simulator::setLowResolutionFaceSize)
+        .def("setDeadlineModeEnabled", &Simulator::setDeadlineModeEnabled)
+        .def("setBackgroundUploadEnabled", &Simulator::setBackgroundUploadEnabled)
+        .def("setCandidateTablesEnabled", &Simulator::setCandidateTablesEnabled)
         .def("setBatchSize", &Simulator::setBatchSize)
         .def("setCacheSize", &Simulator::setCacheSize)
+        .def("setCachePolicy", &Simulator::setCachePolicy)
+        .def("setCacheCapacity", &Simulator::setCacheCapacity)
         .def("setSeed", &Simulator::setSeed)
         .def("initialize", &Simulator::initialize)
-        .def("newEpisode", &Simulator::newEpisode)
+        .def("warmCache", &Simulator::warmCache)
+        .def("warmCacheFromFile", &Simulator::warmCacheFromFile)
+        .def("newEpisode", static_cast<void (Simulator::*)(const std::vector<std::string>&,
+                const std::vector<std::string>&, const std::vector<double>&, const std::vector<double>&)>(
+                &Simulator::newEpisode))
+        .def("newEpisode", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<unsigned int>&, const std::vector<double>&, const std::vector<double>&)>(
+                &Simulator::newEpisode))
+        .def("resetEnvs", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<std::string>&, const std::vector<std::string>&, const std::vector<double>&,
+                const std::vector<double>&)>(&Simulator::resetEnvs))
+        .def("resetEnvs", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<unsigned int>&, const std::vector<unsigned int>&, const std::vector<double>&,
+                const std::vector<double>&)>(&Simulator::resetEnvs))
+        .def("scanHandle", &Simulator::scanHandle)
+        .def("viewpointIndex", &Simulator::viewpointIndex)
+        .def("viewpointIndices", &Simulator::viewpointIndices)
+        .def("shortestPathDistances", static_cast<std::vector<float> (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<unsigned int>&, const std::vector<unsigned int>&)>(
+                &Simulator::shortestPathDistances))
+        .def("shortestPathDistances", static_cast<std::vector<float> (Simulator::*)(const std::vector<std::string>&,
+                const std::vector<std::string>&, const std::vector<std::string>&)>(
+                &Simulator::shortestPathDistances))
+        .def("shortestPathNextHops", static_cast<std::vector<unsigned int> (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<unsigned int>&, const std::vector<unsigned int>&)>(
+                &Simulator::shortestPathNextHops))
+        .def("shortestPathNextHops", static_cast<std::vector<std::string> (Simulator::*)(const std::vector<std::string>&,
+                const std::vector<std::string>&, const std::vector<std::string>&)>(
+                &Simulator::shortestPathNextHops))
+        .def("shortestPath", &Simulator::shortestPath)
+        .def("shortestPathActions", static_cast<Actions (Simulator::*)(const std::vector<unsigned int>&)>(
+                &Simulator::shortestPathActions))
+        .def("shortestPathActions", static_cast<Actions (Simulator::*)(const std::vector<std::string>&)>(
+                &Simulator::shortestPathActions))
+        .def("nearestViewpoints", &Simulator::nearestViewpoints)
+        .def("viewpointsWithin", &Simulator::viewpointsWithin)
         .def("newRandomEpisode", &Simulator::newRandomEpisode)
-        .def("getState", &Simulator::getState, py::return_value_policy::take_ownership)
-        .def("makeAction", &Simulator::makeAction)
+        .def("getState", static_cast<const std::vector<SimStatePtr>& (Simulator::*)()>(&Simulator::getState),
+                py::return_value_policy::take_ownership)
+        .def("getState", static_cast<std::vector<SimStatePtr> (Simulator::*)(const std::vector<bool>&)>(
+                &Simulator::getState))
+        .def("makeAction", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<double>&, const std::vector<double>&)>(&Simulator::makeAction))
+        .def("makeAction", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<double>&, const std::vector<double>&, const std::vector<bool>&)>(
+                &Simulator::makeAction))
+        .def("peek", &Simulator::peek)
+        .def("executeSequence", [](Simulator& sim, const std::vector<std::vector<unsigned int> >& index,
+                const std::vector<std::vector<double> >& heading, const std::vector<std::vector<double> >& elevation,
+                bool log) {
+            return executeLogged(log, [&](TrajectoryLog* l) {
+                if (l) {
+                    sim.executeSequence(index, heading, elevation, *l);
+                } else {
+                    sim.executeSequence(index, heading, elevation);
+                }
+            }); }, py::arg("index"), py::arg("heading"), py::arg("elevation"), py::arg("log") = false)
+        .def("executePath", [](Simulator& sim, const std::vector<std::vector<unsigned int> >& viewpointIx, bool log) {
+            return executeLogged(log, [&](TrajectoryLog* l) {
+                if (l) {
+                    sim.executePath(viewpointIx, *l);
+                } else {
+                    sim.executePath(viewpointIx);
+                }
+            }); }, py::arg("viewpointIx"), py::arg("log") = false)
+        .def("executePath", [](Simulator& sim, const std::vector<std::vector<std::string> >& viewpointId, bool log) {
+            return executeLogged(log, [&](TrajectoryLog* l) {
+                if (l) {
+                    sim.executePath(viewpointId, *l);
+                } else {
+                    sim.executePath(viewpointId);
+                }
+            }); }, py::arg("viewpointId"), py::arg("log") = false)
+        .def("snapshot", static_cast<std::vector<SimStatePtr> (Simulator::*)()>(&Simulator::snapshot))
+        .def("snapshot", static_cast<std::vector<SimStatePtr> (Simulator::*)(const std::vector<unsigned int>&)>(
+                &Simulator::snapshot))
+        .def("restore", static_cast<void (Simulator::*)(const std::vector<SimStatePtr>&)>(&Simulator::restore))
+        .def("restore", static_cast<void (Simulator::*)(const std::vector<unsigned int>&,
+                const std::vector<SimStatePtr>&)>(&Simulator::restore))
+        .def("fork", &Simulator::fork)
         .def("close", &Simulator::close)
         .def("resetTimers", &Simulator::resetTimers)
-        .def("timingInfo", &Simulator::timingInfo);
+        .def("timingInfo", &Simulator::timingInfo)
+        .def("cacheStats", &Simulator::cacheStats);
+    m.attr("noCandidate") = noCandidate;
+    py::class_<NavBatchState>(m, "NavBatchState")
+        .def_property_readonly("scanHandle", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().scanHandle, 0); })
+        .def_property_readonly("ix", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().ix, 0); })
+        .def_property_readonly("heading", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().heading, 0); })
+        .def_property_readonly("elevation", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().elevation, 0); })
+        .def_property_readonly("viewIndex", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().viewIndex, 0); })
+        .def_property_readonly("step", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().step, 0); })
+        .def_readonly("maxCandidates", &NavBatchState::maxCandidates)
+        .def_property_readonly("candidateCount", [](py::object s) {
+            return batchArray(s, s.cast<const NavBatchState&>().candidateCount, 0); })
+        .def_property_readonly("candidateIx", [](py::object s) {
+            const NavBatchState& state = s.cast<const NavBatchState&>();
+            return batchArray(s, state.candidateIx, state.maxCandidates); })
+        .def_property_readonly("candidateDistance", [](py::object s) {
+            const NavBatchState& state = s.cast<const NavBatchState&>();
+            return batchArray(s, state.candidateDistance, state.maxCandidates); })
+        .def_property_readonly("candidateHeading", [](py::object s) {
+            const NavBatchState& state = s.cast<const NavBatchState&>();
+            return batchArray(s, state.candidateHeading, state.maxCandidates); })
+        .def_property_readonly("candidateElevation", [](py::object s) {
+            const NavBatchState& state = s.cast<const NavBatchState&>();
+            return batchArray(s, state.candidateElevation, state.maxCandidates); });
+    py::class_<NavEngine>(m, "NavEngine")
+        .def(py::init<>())
+        .def("setNavGraphPath", &NavEngine::setNavGraphPath)
+        .def("setCameraResolution", &NavEngine::setCameraResolution)
+        .def("setCameraVFOV", &NavEngine::setCameraVFOV)
+        .def("setElevationLimits", &NavEngine::setElevationLimits)
+        .def("setDiscretizedViewingAngles", &NavEngine::setDiscretizedViewingAngles)
+        .def("setRestrictedNavigation", &NavEngine::setRestrictedNavigation)
+        .def("setCandidateTablesEnabled", &NavEngine::setCandidateTablesEnabled)
+        .def("setBatchSize", &NavEngine::setBatchSize)
+        .def("setMaxCandidates", &NavEngine::setMaxCandidates)
+        .def("initialize", &NavEngine::initialize)
+        .def("scanHandle", &NavEngine::scanHandle)
+        .def("viewpointIndex", &NavEngine::viewpointIndex)
+        .def("reset", &NavEngine::reset)
+        .def("step", &NavEngine::step)
+        .def("getState", &NavEngine::getState, py::return_value_policy::reference_internal);
+    py::class_<SampledPath>(m, "SampledPath")
+        .def_readonly("scanHandle", &SampledPath::scanHandle)
+        .def_readonly("path", &SampledPath::path)
+        .def_readonly("distance", &SampledPath::distance)
+        .def_readonly("heading", &SampledPath::heading);
+    py::class_<PathSampler>(m, "PathSampler")
+        .def(py::init<>())
+        .def("setNavGraphPath", &PathSampler::setNavGraphPath)
+        .def("setScans", &PathSampler::setScans)
+        .def("setDistanceRange", &PathSampler::setDistanceRange)
+        .def("setHopRange", &PathSampler::setHopRange)
+        .def("setSeed", &PathSampler::setSeed)
+        .def("setRandomWalks", &PathSampler::setRandomWalks)
+        .def("initialize", &PathSampler::initialize)
+        .def("pairCount", &PathSampler::pairCount)
+        .def("sample", &PathSampler::sample)
+        .def("writeJsonLines", &PathSampler::writeJsonLines);
 }
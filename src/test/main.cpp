@@ -3,17 +3,29 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <set>
 #include <cmath>
 #include <algorithm>
 #include <string>
 #include <cstdlib>
 #include <ctime>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <random>
 
 #include <json/json.h>
 #include <opencv2/opencv.hpp>
 
 #include "Catch.hpp"
 #include "MatterSim.hpp"
+#include "NavEngine.hpp"
+#include "PathSampler.hpp"
+#include "SkyboxDecoder.hpp"
+#include "FileReader.hpp"
+#include "TextureCache.hpp"
+#include "NavGraphFile.hpp"
+#include "ShortestPaths.hpp"
 
 
 using namespace mattersim;
@@ -35,6 +47,17 @@ double degrees(double rad) {
     return (rad * 180.0) / M_PI;
 }
 
+// Scan ids listed in scans.txt, or only the first maxScans of them
+std::vector<std::string> loadScanIds(size_t maxScans = 0) {
+    std::vector<std::string> scanIds;
+    std::ifstream infile ("./connectivity/scans.txt", std::ios_base::in);
+    std::string scanId;
+    while ((maxScans == 0 || scanIds.size() < maxScans) && infile >> scanId) {
+        scanIds.push_back(scanId);
+    }
+    return scanIds;
+}
+
 float heading[10] =           {  10,  350, 350,   1,  90, 180,   90,  270,   90, 270 };
 float heading_chg[10] =       { -20, -360, 371,  89,  90, -90, -180, -180, -180,   0 };
 float discreteHeading[10] =   {   0,  330, 300, 330,   0,  30,    0,  330,  300, 270 };
@@ -195,12 +218,7 @@ TEST_CASE( "Robot Relative Coords", "[Actions]" ) {
 
 TEST_CASE( "Navigable Locations", "[Actions]" ) {
 
-    std::vector<std::string> scanIds;
-    std::ifstream infile ("./connectivity/scans.txt", std::ios_base::in);
-    std::string scanId;
-    while (infile >> scanId) {
-        scanIds.push_back (scanId);
-    }
+    std::vector<std::string> scanIds = loadScanIds();
     Simulator sim;
     sim.setCameraResolution(20,20); // don't really care about the image
     sim.setCameraVFOV(radians(90)); // 90deg vfov, 90deg hfov
@@ -339,6 +357,1427 @@ TEST_CASE( "Navigable Locations", "[Actions]" ) {
 }
 
 
+TEST_CASE( "Batched Navigable Locations", "[Actions]" ) {
+
+    // A large batch is updated in parallel, but must match environments simulated one at a time
+    std::vector<std::string> scanIds = loadScanIds(128);
+    Simulator batched, single;
+    for (Simulator* sim : {&batched, &single}) {
+        sim->setCameraResolution(640,480);
+        sim->setCameraVFOV(radians(60));
+        sim->setRenderingEnabled(false);
+        sim->setDiscretizedViewingAngles(true);
+    }
+    batched.setBatchSize(scanIds.size());
+    single.setBatchSize(1);
+    REQUIRE_NOTHROW(batched.initialize());
+    REQUIRE_NOTHROW(single.initialize());
+    REQUIRE_NOTHROW(batched.newRandomEpisode(scanIds));
+    for (int t = 0; t < 5; ++t) {
+        std::vector<unsigned int> ix;
+        std::vector<double> headings, elevations;
+        for (unsigned int i = 0; i < scanIds.size(); ++i) {
+            INFO("i=" << i << ", t=" << t);
+            SimStatePtr state = batched.getState().at(i);
+            single.newEpisode(std::vector<unsigned int>(1, state->scanHandle), std::vector<unsigned int>(1, state->location->ix),
+                    {state->heading}, {state->elevation});
+            SimStatePtr expected = single.getState().at(0);
+            REQUIRE( state->navigableLocations.size() == expected->navigableLocations.size() );
+            for (unsigned int n = 0; n < state->navigableLocations.size(); ++n) {
+                CHECK( state->navigableLocations[n]->ix == expected->navigableLocations[n]->ix );
+                CHECK( state->navigableLocations[n]->rel_heading == expected->navigableLocations[n]->rel_heading );
+                CHECK( state->navigableLocations[n]->rel_elevation == expected->navigableLocations[n]->rel_elevation );
+                CHECK( state->navigableLocations[n]->rel_distance == expected->navigableLocations[n]->rel_distance );
+            }
+            ix.push_back((t + i) % state->navigableLocations.size());
+            headings.push_back(radians(heading_chg[t]));
+            elevations.push_back(radians(elevation_chg[t]));
+        }
+        batched.makeAction(ix, headings, elevations);
+    }
+    REQUIRE_NOTHROW(batched.close());
+    REQUIRE_NOTHROW(single.close());
+}
+
+
+TEST_CASE( "Candidate Tables", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(16);
+    for (bool restricted : {true, false}) {
+        INFO("restricted=" << restricted);
+        Simulator computed, tabulated;
+        for (Simulator* sim : {&computed, &tabulated}) {
+            sim->setCameraResolution(640,480);
+            sim->setCameraVFOV(radians(60));
+            sim->setRenderingEnabled(false);
+            sim->setDiscretizedViewingAngles(true);
+            sim->setRestrictedNavigation(restricted);
+            sim->setBatchSize(scanIds.size());
+        }
+        tabulated.setCandidateTablesEnabled(true);
+        REQUIRE_NOTHROW(computed.initialize());
+        REQUIRE_NOTHROW(tabulated.initialize());
+        REQUIRE_NOTHROW(computed.newRandomEpisode(scanIds));
+        std::vector<unsigned int> scans, ixs;
+        std::vector<double> headings, elevations;
+        for (auto state : computed.getState()) {
+            scans.push_back(state->scanHandle);
+            ixs.push_back(state->location->ix);
+            headings.push_back(state->heading);
+            elevations.push_back(state->elevation);
+        }
+        REQUIRE_NOTHROW(tabulated.newEpisode(scans, ixs, headings, elevations));
+        for (int t = 0; t < 10; ++t) {
+            std::vector<unsigned int> ix;
+            headings.clear();
+            elevations.clear();
+            for (unsigned int i = 0; i < scanIds.size(); ++i) {
+                INFO("i=" << i << ", t=" << t);
+                SimStatePtr expected = computed.getState().at(i);
+                SimStatePtr state = tabulated.getState().at(i);
+                REQUIRE( state->location->ix == expected->location->ix );
+                REQUIRE( state->viewIndex == expected->viewIndex );
+                REQUIRE( state->navigableLocations.size() == expected->navigableLocations.size() );
+                for (unsigned int n = 0; n < state->navigableLocations.size(); ++n) {
+                    CHECK( state->navigableLocations[n]->viewpointId == expected->navigableLocations[n]->viewpointId );
+                    CHECK( state->navigableLocations[n]->rel_heading == expected->navigableLocations[n]->rel_heading );
+                    CHECK( state->navigableLocations[n]->rel_elevation == expected->navigableLocations[n]->rel_elevation );
+                    CHECK( state->navigableLocations[n]->rel_distance == expected->navigableLocations[n]->rel_distance );
+                    CHECK( state->navigableLocations[n]->x == expected->navigableLocations[n]->x );
+                }
+                CHECK( state->location == state->navigableLocations[0] );
+                ix.push_back((t + i) % state->navigableLocations.size());
+                headings.push_back(radians(heading_chg[t]));
+                elevations.push_back(radians(elevation_chg[t]));
+            }
+            computed.makeAction(ix, headings, elevations);
+            tabulated.makeAction(ix, headings, elevations);
+        }
+        REQUIRE_NOTHROW(computed.close());
+        REQUIRE_NOTHROW(tabulated.close());
+    }
+}
+
+
+TEST_CASE( "Navigable Location Storage", "[Actions]" ) {
+
+    Simulator sim;
+    sim.setCameraResolution(640,480);
+    sim.setCameraVFOV(radians(60));
+    sim.setRenderingEnabled(false);
+    sim.setRestrictedNavigation(false);
+    REQUIRE_NOTHROW(sim.initialize());
+    REQUIRE_NOTHROW(sim.newEpisode({"2t7WUuJeko7"}, {"cc34e9176bfe47ebb23c58c165203134"}, {0}, {0}));
+    SimStatePtr state = sim.getState().at(0);
+    REQUIRE(state->candidates);
+    REQUIRE(state->candidates->size() == state->navigableLocations.size());
+    REQUIRE(state->navigableLocations.size() > 1);
+    for (unsigned int n = 0; n < state->navigableLocations.size(); ++n) {
+        CHECK(state->navigableLocations[n].get() == &state->candidates->at(n));
+    }
+    CHECK(state->location == state->navigableLocations[0]);
+
+    // Unreferenced candidates are overwritten in place
+    const std::vector<Viewpoint>* storage = state->candidates.get();
+    sim.makeAction({0}, {radians(30)}, {0});
+    CHECK(state->candidates.get() == storage);
+
+    // Referenced candidates are left unchanged
+    ViewpointPtr held = state->navigableLocations.back();
+    std::string viewpointId = held->viewpointId;
+    double rel_heading = held->rel_heading;
+    sim.makeAction({1}, {radians(30)}, {0});
+    CHECK(state->candidates.get() != storage);
+    CHECK(held->viewpointId == viewpointId);
+    CHECK(held->rel_heading == rel_heading);
+    CHECK(state->location->ix == state->candidates->at(0).ix);
+
+    // Viewpoints are values that can be copied and assigned
+    Viewpoint copy = *held;
+    copy = *state->location;
+    CHECK(copy.viewpointId == state->location->viewpointId);
+    CHECK(copy.ix == state->location->ix);
+    REQUIRE_NOTHROW(sim.close());
+}
+
+
+TEST_CASE( "Snapshot and Restore", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(8);
+    unsigned int batchSize = scanIds.size();
+    Simulator sim, replayed;
+    for (Simulator* s : {&sim, &replayed}) {
+        s->setCameraResolution(640,480);
+        s->setCameraVFOV(radians(60));
+        s->setRenderingEnabled(false);
+        s->setDiscretizedViewingAngles(true);
+        s->setBatchSize(batchSize);
+    }
+    REQUIRE_NOTHROW(sim.initialize());
+    REQUIRE_NOTHROW(replayed.initialize());
+    CHECK_THROWS_AS(sim.snapshot(), std::runtime_error);
+    REQUIRE_NOTHROW(sim.newRandomEpisode(scanIds));
+    auto navigable = [](const SimStatePtr& state) {
+        std::vector<unsigned int> ix;
+        for (auto& location : state->navigableLocations) {
+            ix.push_back(location->ix);
+        }
+        return ix;
+    };
+    auto actions = [&](Simulator& s, int t) {
+        std::vector<unsigned int> ix;
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            ix.push_back((t + i) % s.getState().at(i)->navigableLocations.size());
+        }
+        s.makeAction(ix, std::vector<double>(batchSize, radians(heading_chg[t])),
+                std::vector<double>(batchSize, radians(elevation_chg[t])));
+    };
+
+    // Copies share images and navigable locations with the simulator
+    std::vector<SimStatePtr> saved = sim.snapshot();
+    REQUIRE(saved.size() == batchSize);
+    std::vector<std::vector<unsigned int> > savedNavigable;
+    std::vector<double> savedRelHeading;
+    std::vector<unsigned int> scans, ixs;
+    std::vector<double> headings, elevations;
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        SimStatePtr state = sim.getState().at(i);
+        CHECK(saved[i] != state);
+        CHECK(saved[i]->rgb.data == state->rgb.data);
+        CHECK(saved[i]->candidates == state->candidates);
+        savedNavigable.push_back(navigable(saved[i]));
+        savedRelHeading.push_back(saved[i]->navigableLocations.back()->rel_heading);
+        scans.push_back(state->scanHandle);
+        ixs.push_back(state->location->ix);
+        headings.push_back(state->heading);
+        elevations.push_back(state->elevation);
+    }
+
+    // Acting leaves the copies unchanged
+    for (int t = 0; t < 3; ++t) {
+        actions(sim, t);
+    }
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        INFO("i=" << i);
+        CHECK(saved[i]->step == 0);
+        CHECK(saved[i]->location->ix == ixs[i]);
+        CHECK(navigable(saved[i]) == savedNavigable[i]);
+        CHECK(saved[i]->navigableLocations.back()->rel_heading == savedRelHeading[i]);
+    }
+
+    // Restored states are updated in place and continue like the original episode
+    const SimState* live = sim.getState().at(0).get();
+    REQUIRE_NOTHROW(sim.restore(saved));
+    CHECK(sim.getState().at(0).get() == live);
+    REQUIRE_NOTHROW(replayed.newEpisode(scans, ixs, headings, elevations));
+    for (int t = 0; t < 5; ++t) {
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            INFO("i=" << i << ", t=" << t);
+            SimStatePtr state = sim.getState().at(i);
+            SimStatePtr expected = replayed.getState().at(i);
+            CHECK(state->step == expected->step);
+            CHECK(state->location->ix == expected->location->ix);
+            CHECK(state->heading == expected->heading);
+            CHECK(state->elevation == expected->elevation);
+            CHECK(state->viewIndex == expected->viewIndex);
+            CHECK(navigable(state) == navigable(expected));
+        }
+        actions(sim, t);
+        actions(replayed, t);
+    }
+
+    // Selected environments, including swapping two environments in the batch
+    SimStatePtr first = sim.snapshot({0}).at(0);
+    SimStatePtr second = sim.snapshot({1}).at(0);
+    REQUIRE_NOTHROW(sim.restore({0, 1, 2}, {sim.getState().at(1), sim.getState().at(0), saved[2]}));
+    CHECK(sim.getState().at(0)->location->ix == second->location->ix);
+    CHECK(navigable(sim.getState().at(0)) == navigable(second));
+    CHECK(sim.getState().at(1)->location->ix == first->location->ix);
+    CHECK(navigable(sim.getState().at(1)) == navigable(first));
+    CHECK(navigable(sim.getState().at(2)) == savedNavigable[2]);
+
+    // Forked environments change independently
+    REQUIRE_NOTHROW(sim.fork(4, 3));
+    SimStatePtr source = sim.getState().at(4);
+    for (unsigned int i = 5; i < 8; ++i) {
+        CHECK(sim.getState().at(i)->location->ix == source->location->ix);
+        CHECK(sim.getState().at(i)->heading == source->heading);
+        CHECK(navigable(sim.getState().at(i)) == navigable(source));
+    }
+    std::vector<unsigned int> forkedNavigable = navigable(source);
+    std::vector<unsigned int> index(batchSize, 0);
+    index[4] = source->navigableLocations.size() - 1;
+    std::vector<double> turn(batchSize, 0);
+    turn[4] = radians(30);
+    REQUIRE_NOTHROW(sim.makeAction(index, turn, std::vector<double>(batchSize, 0)));
+    CHECK(sim.getState().at(5)->candidates != source->candidates);
+    CHECK(navigable(sim.getState().at(5)) == forkedNavigable);
+
+    CHECK_THROWS_AS(sim.fork(5, 3), std::out_of_range);
+    CHECK_THROWS_AS(sim.snapshot({batchSize}), std::out_of_range);
+    CHECK_THROWS_AS(sim.restore({batchSize}, {saved[0]}), std::out_of_range);
+    CHECK_THROWS_AS(sim.restore({0, 1}, {saved[0]}), std::invalid_argument);
+    CHECK_THROWS_AS(sim.restore({0}, {std::make_shared<SimState>()}), std::invalid_argument);
+    REQUIRE_NOTHROW(sim.close());
+    REQUIRE_NOTHROW(replayed.close());
+}
+
+
+TEST_CASE( "Lookahead", "[Actions]" ) {
+
+    // Peeking at every navigable location must match moving there, without changing the batch
+    std::vector<std::string> scanIds = loadScanIds(8);
+    Simulator sim, single;
+    for (Simulator* s : {&sim, &single}) {
+        s->setCameraResolution(640,480);
+        s->setCameraVFOV(radians(60));
+        s->setRenderingEnabled(false);
+        s->setDiscretizedViewingAngles(true);
+    }
+    sim.setBatchSize(scanIds.size());
+    REQUIRE_NOTHROW(sim.initialize());
+    REQUIRE_NOTHROW(single.initialize());
+    CHECK_THROWS_AS(sim.peek({0}, {0}, {0}, {0}), std::runtime_error);
+    REQUIRE_NOTHROW(sim.newRandomEpisode(scanIds));
+    REQUIRE_NOTHROW(sim.makeAction(std::vector<unsigned int>(scanIds.size(), 0),
+            std::vector<double>(scanIds.size(), radians(30)), std::vector<double>(scanIds.size(), 0)));
+    std::vector<unsigned int> envIndex, index;
+    std::vector<double> headings, elevations;
+    for (unsigned int i = 0; i < scanIds.size(); ++i) {
+        for (unsigned int n = 0; n < sim.getState().at(i)->navigableLocations.size(); ++n) {
+            envIndex.push_back(i);
+            index.push_back(n);
+            headings.push_back(radians(heading_chg[n % 10]));
+            elevations.push_back(radians(elevation_chg[n % 10]));
+        }
+    }
+    std::vector<SimStatePtr> before = sim.snapshot();
+    std::vector<SimStatePtr> observations;
+    REQUIRE_NOTHROW(observations = sim.peek(envIndex, index, headings, elevations));
+    REQUIRE(observations.size() == envIndex.size());
+    for (unsigned int k = 0; k < envIndex.size(); ++k) {
+        INFO("env=" << envIndex[k] << ", index=" << index[k]);
+        SimStatePtr state = sim.getState().at(envIndex[k]);
+        single.newEpisode(std::vector<unsigned int>(1, state->scanHandle), std::vector<unsigned int>(1, state->location->ix),
+                {state->heading}, {state->elevation});
+        single.makeAction({index[k]}, {headings[k]}, {elevations[k]});
+        SimStatePtr expected = single.getState().at(0);
+        SimStatePtr observation = observations[k];
+        CHECK(observation->step == state->step + 1);
+        CHECK(observation->scanId == state->scanId);
+        CHECK(observation->location->ix == expected->location->ix);
+        CHECK(observation->heading == expected->heading);
+        CHECK(observation->elevation == expected->elevation);
+        CHECK(observation->viewIndex == expected->viewIndex);
+        REQUIRE(observation->navigableLocations.size() == expected->navigableLocations.size());
+        for (unsigned int n = 0; n < expected->navigableLocations.size(); ++n) {
+            CHECK(observation->navigableLocations[n]->ix == expected->navigableLocations[n]->ix);
+            CHECK(observation->navigableLocations[n]->rel_heading == expected->navigableLocations[n]->rel_heading);
+        }
+    }
+    for (unsigned int i = 0; i < scanIds.size(); ++i) {
+        SimStatePtr state = sim.getState().at(i);
+        CHECK(state->step == before[i]->step);
+        CHECK(state->location == before[i]->location);
+        CHECK(state->heading == before[i]->heading);
+        CHECK(state->candidates == before[i]->candidates);
+        CHECK(state->navigableLocations == before[i]->navigableLocations);
+    }
+
+    CHECK_THROWS_AS(sim.peek({0}, {0, 1}, {0}, {0}), std::invalid_argument);
+    CHECK_THROWS_AS(sim.peek({unsigned(scanIds.size())}, {0}, {0}, {0}), std::out_of_range);
+    CHECK_THROWS_AS(sim.peek({0}, {unsigned(sim.getState().at(0)->navigableLocations.size())}, {0}, {0}),
+            std::domain_error);
+    REQUIRE_NOTHROW(sim.close());
+    REQUIRE_NOTHROW(single.close());
+}
+
+
+TEST_CASE( "Partial Reset", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(8);
+    unsigned int batchSize = scanIds.size();
+    Simulator sim, single;
+    for (Simulator* s : {&sim, &single}) {
+        s->setCameraResolution(640,480);
+        s->setCameraVFOV(radians(60));
+        s->setRenderingEnabled(false);
+        s->setDiscretizedViewingAngles(true);
+    }
+    sim.setBatchSize(batchSize);
+    REQUIRE_NOTHROW(sim.initialize());
+    REQUIRE_NOTHROW(single.initialize());
+    CHECK_THROWS_AS(sim.resetEnvs({0}, {scanIds[0]}, {"cc34e9176bfe47ebb23c58c165203134"}, {0}, {0}), std::runtime_error);
+    REQUIRE_NOTHROW(sim.newRandomEpisode(scanIds));
+    for (int t = 0; t < 3; ++t) {
+        REQUIRE_NOTHROW(sim.makeAction(std::vector<unsigned int>(batchSize, 0),
+                std::vector<double>(batchSize, radians(heading_chg[t])), std::vector<double>(batchSize, 0)));
+    }
+    std::vector<SimStatePtr> before = sim.snapshot();
+
+    // Reset two environments, one of them into another scan
+    std::vector<unsigned int> envIndex = {2, 5};
+    std::vector<std::string> resetScans = {"2t7WUuJeko7", scanIds[5]};
+    std::vector<std::string> resetViewpoints = {"cc34e9176bfe47ebb23c58c165203134",
+            before[5]->navigableLocations.back()->viewpointId};
+    std::vector<double> resetHeadings = {radians(30), radians(-60)};
+    std::vector<double> resetElevations = {0, radians(30)};
+    REQUIRE_NOTHROW(sim.resetEnvs(envIndex, resetScans, resetViewpoints, resetHeadings, resetElevations));
+    for (unsigned int k = 0; k < envIndex.size(); ++k) {
+        INFO("env=" << envIndex[k]);
+        single.newEpisode({resetScans[k]}, {resetViewpoints[k]}, {resetHeadings[k]}, {resetElevations[k]});
+        SimStatePtr state = sim.getState().at(envIndex[k]);
+        SimStatePtr expected = single.getState().at(0);
+        CHECK(state->step == 0);
+        CHECK(state->scanId == resetScans[k]);
+        CHECK(state->scanHandle == expected->scanHandle);
+        CHECK(state->location->viewpointId == resetViewpoints[k]);
+        CHECK(state->heading == expected->heading);
+        CHECK(state->elevation == expected->elevation);
+        CHECK(state->viewIndex == expected->viewIndex);
+        REQUIRE(state->navigableLocations.size() == expected->navigableLocations.size());
+        for (unsigned int n = 0; n < expected->navigableLocations.size(); ++n) {
+            CHECK(state->navigableLocations[n]->ix == expected->navigableLocations[n]->ix);
+            CHECK(state->navigableLocations[n]->rel_heading == expected->navigableLocations[n]->rel_heading);
+        }
+    }
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        if (i == 2 || i == 5) {
+            continue;
+        }
+        INFO("env=" << i);
+        SimStatePtr state = sim.getState().at(i);
+        CHECK(state->step == 3);
+        CHECK(state->location == before[i]->location);
+        CHECK(state->heading == before[i]->heading);
+        CHECK(state->navigableLocations == before[i]->navigableLocations);
+    }
+
+    // Integer handles
+    unsigned int scan = sim.scanHandle("2t7WUuJeko7");
+    unsigned int ix = sim.viewpointIndex(scan, "cc34e9176bfe47ebb23c58c165203134");
+    REQUIRE_NOTHROW(sim.resetEnvs({7}, std::vector<unsigned int>{scan}, {ix}, {0}, {0}));
+    CHECK(sim.getState().at(7)->scanHandle == scan);
+    CHECK(sim.getState().at(7)->location->ix == ix);
+    CHECK(sim.getState().at(6)->step == 3);
+
+    CHECK_THROWS_AS(sim.resetEnvs({batchSize}, std::vector<unsigned int>{scan}, {ix}, {0}, {0}), std::out_of_range);
+    CHECK_THROWS_AS(sim.resetEnvs({0, 1}, std::vector<unsigned int>{scan}, {ix}, {0}, {0}), std::invalid_argument);
+    CHECK_THROWS_AS(sim.resetEnvs({0}, {"2t7WUuJeko7"}, {"unknown"}, {0}, {0}), std::invalid_argument);
+    REQUIRE_NOTHROW(sim.close());
+    REQUIRE_NOTHROW(single.close());
+}
+
+
+TEST_CASE( "Active Mask", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(8);
+    unsigned int batchSize = scanIds.size();
+    Simulator masked, full;
+    for (Simulator* s : {&masked, &full}) {
+        s->setCameraResolution(640,480);
+        s->setCameraVFOV(radians(60));
+        s->setRenderingEnabled(false);
+        s->setDiscretizedViewingAngles(true);
+        s->setBatchSize(batchSize);
+    }
+    REQUIRE_NOTHROW(masked.initialize());
+    REQUIRE_NOTHROW(full.initialize());
+    REQUIRE_NOTHROW(masked.newRandomEpisode(scanIds));
+    std::vector<unsigned int> scans, ixs;
+    std::vector<double> headings, elevations;
+    for (auto state : masked.getState()) {
+        scans.push_back(state->scanHandle);
+        ixs.push_back(state->location->ix);
+        headings.push_back(state->heading);
+        elevations.push_back(state->elevation);
+    }
+    REQUIRE_NOTHROW(full.newEpisode(scans, ixs, headings, elevations));
+
+    // Environments finish one after another. Active environments must match the full batch, and
+    // finished ones must not change even though their actions are invalid.
+    std::vector<bool> active(batchSize, true);
+    for (unsigned int t = 0; t < batchSize; ++t) {
+        active[t] = false;
+        std::vector<SimStatePtr> finished = masked.snapshot();
+        std::vector<unsigned int> ix(batchSize, 1000);
+        std::vector<double> h(batchSize, radians(heading_chg[t]));
+        std::vector<double> e(batchSize, radians(elevation_chg[t]));
+        std::vector<unsigned int> fullIx(batchSize, 0);
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            if (active[i]) {
+                ix[i] = (t + i) % masked.getState().at(i)->navigableLocations.size();
+                fullIx[i] = ix[i];
+            }
+        }
+        REQUIRE_NOTHROW(masked.makeAction(ix, h, e, active));
+        REQUIRE_NOTHROW(full.makeAction(fullIx, h, e));
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            INFO("i=" << i << ", t=" << t);
+            SimStatePtr state = masked.getState().at(i);
+            if (active[i]) {
+                SimStatePtr expected = full.getState().at(i);
+                CHECK(state->step == t + 1);
+                CHECK(state->location->ix == expected->location->ix);
+                CHECK(state->heading == expected->heading);
+                CHECK(state->viewIndex == expected->viewIndex);
+                CHECK(state->navigableLocations.size() == expected->navigableLocations.size());
+            } else {
+                CHECK(state->step == finished[i]->step);
+                CHECK(state->location == finished[i]->location);
+                CHECK(state->heading == finished[i]->heading);
+                CHECK(state->navigableLocations == finished[i]->navigableLocations);
+            }
+        }
+        std::vector<SimStatePtr> activeStates = masked.getState(active);
+        REQUIRE(activeStates.size() == batchSize - t - 1);
+        for (unsigned int k = 0; k < activeStates.size(); ++k) {
+            CHECK(activeStates[k] == masked.getState().at(t + 1 + k));
+        }
+        // Keep the full batch in step with the finished environments
+        full.restore({t}, {masked.getState().at(t)});
+    }
+
+    CHECK_THROWS_AS(masked.makeAction(std::vector<unsigned int>(batchSize, 0), std::vector<double>(batchSize, 0),
+            std::vector<double>(batchSize, 0), std::vector<bool>(1, true)), std::invalid_argument);
+    CHECK_THROWS_AS(masked.getState(std::vector<bool>(batchSize + 1, true)), std::invalid_argument);
+    REQUIRE_NOTHROW(masked.close());
+    REQUIRE_NOTHROW(full.close());
+}
+
+
+TEST_CASE( "Action Sequences", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(8);
+    unsigned int batchSize = scanIds.size();
+    Simulator sim, stepped;
+    for (Simulator* s : {&sim, &stepped}) {
+        s->setCameraResolution(640,480);
+        s->setCameraVFOV(radians(60));
+        s->setRenderingEnabled(false);
+        s->setDiscretizedViewingAngles(true);
+        s->setBatchSize(batchSize);
+    }
+    REQUIRE_NOTHROW(sim.initialize());
+    REQUIRE_NOTHROW(stepped.initialize());
+    REQUIRE_NOTHROW(stepped.newRandomEpisode(scanIds));
+    std::vector<SimStatePtr> start = stepped.snapshot();
+    std::vector<unsigned int> scans, ixs;
+    std::vector<double> headings, elevations;
+    for (auto state : start) {
+        scans.push_back(state->scanHandle);
+        ixs.push_back(state->location->ix);
+        headings.push_back(state->heading);
+        elevations.push_back(state->elevation);
+    }
+
+    // Sequences of different lengths, recorded one step at a time
+    std::vector<std::vector<unsigned int> > index(batchSize);
+    std::vector<std::vector<double> > heading(batchSize), elevation(batchSize);
+    std::vector<std::vector<SimStatePtr> > expected(batchSize);
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        expected[i].push_back(stepped.snapshot({i}).at(0));
+    }
+    for (unsigned int t = 0; t < batchSize + 2; ++t) {
+        std::vector<bool> active(batchSize);
+        std::vector<unsigned int> ix(batchSize, 0);
+        std::vector<double> h(batchSize, 0), e(batchSize, 0);
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            active[i] = t < i + 3;
+            if (active[i]) {
+                ix[i] = (t + i) % stepped.getState().at(i)->navigableLocations.size();
+                h[i] = radians(heading_chg[t % 10]);
+                e[i] = radians(elevation_chg[t % 10]);
+                index[i].push_back(ix[i]);
+                heading[i].push_back(h[i]);
+                elevation[i].push_back(e[i]);
+            }
+        }
+        stepped.makeAction(ix, h, e, active);
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            if (active[i]) {
+                expected[i].push_back(stepped.snapshot({i}).at(0));
+            }
+        }
+    }
+    TrajectoryLog log;
+    REQUIRE_NOTHROW(sim.newEpisode(scans, ixs, headings, elevations));
+    REQUIRE_NOTHROW(sim.executeSequence(index, heading, elevation, log));
+    REQUIRE(log.offsets.size() == batchSize + 1);
+    CHECK(log.offsets.back() == log.viewpointIx.size());
+    CHECK(log.rgb.empty());
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        INFO("i=" << i);
+        REQUIRE(log.offsets[i + 1] - log.offsets[i] == expected[i].size());
+        for (unsigned int t = 0; t < expected[i].size(); ++t) {
+            size_t k = log.offsets[i] + t;
+            CHECK(log.viewpointIx[k] == expected[i][t]->location->ix);
+            CHECK(log.heading[k] == expected[i][t]->heading);
+            CHECK(log.elevation[k] == expected[i][t]->elevation);
+            CHECK(log.viewIndex[k] == expected[i][t]->viewIndex);
+        }
+        SimStatePtr state = sim.getState().at(i);
+        CHECK(state->step == expected[i].size() - 1);
+        CHECK(state->location->ix == expected[i].back()->location->ix);
+        CHECK(state->heading == expected[i].back()->heading);
+    }
+
+    // Following shortest paths matches taking teacher actions one step at a time
+    REQUIRE_NOTHROW(sim.newEpisode(scans, ixs, headings, elevations));
+    REQUIRE_NOTHROW(stepped.newEpisode(scans, ixs, headings, elevations));
+    std::vector<std::vector<std::string> > paths(batchSize);
+    std::vector<std::string> goals;
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        // Return to where the sequence ended
+        SimStatePtr state = sim.getState().at(i);
+        goals.push_back(expected[i].back()->location->viewpointId);
+        paths[i] = sim.shortestPath(state->scanId, state->location->viewpointId, goals.back());
+    }
+    REQUIRE_NOTHROW(sim.executePath(paths, log));
+    CHECK(log.offsets.back() > batchSize);
+    std::vector<std::vector<unsigned int> > teacherViewpoints(batchSize);
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        teacherViewpoints[i].push_back(stepped.getState().at(i)->location->ix);
+    }
+    for (int t = 0; t < 100; ++t) {
+        std::vector<bool> active(batchSize);
+        bool any = false;
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            active[i] = stepped.getState().at(i)->location->viewpointId != goals[i];
+            any = any || active[i];
+        }
+        if (!any) {
+            break;
+        }
+        Actions actions = stepped.shortestPathActions(goals);
+        stepped.makeAction(actions.index, actions.heading, actions.elevation, active);
+        for (unsigned int i = 0; i < batchSize; ++i) {
+            if (active[i]) {
+                teacherViewpoints[i].push_back(stepped.getState().at(i)->location->ix);
+            }
+        }
+    }
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        INFO("i=" << i);
+        CHECK(sim.getState().at(i)->location->viewpointId == goals[i]);
+        CHECK(sim.getState().at(i)->step == stepped.getState().at(i)->step);
+        CHECK(sim.getState().at(i)->heading == stepped.getState().at(i)->heading);
+        std::vector<unsigned int> logged(log.viewpointIx.begin() + log.offsets[i],
+                log.viewpointIx.begin() + log.offsets[i + 1]);
+        CHECK(logged == teacherViewpoints[i]);
+    }
+
+    std::vector<std::vector<unsigned int> > empty(batchSize);
+    CHECK_THROWS_AS(sim.executeSequence(empty, heading, elevation), std::invalid_argument);
+    CHECK_THROWS_AS(sim.executeSequence(empty, std::vector<std::vector<double> >(1), elevation), std::invalid_argument);
+    std::vector<std::vector<unsigned int> > invalid(batchSize);
+    invalid[0].push_back(1000000);
+    CHECK_THROWS_AS(sim.executePath(invalid), std::invalid_argument);
+    CHECK(sim.getState().at(0)->location->viewpointId == goals[0]);
+    REQUIRE_NOTHROW(sim.close());
+    REQUIRE_NOTHROW(stepped.close());
+
+    // Paths end with continuous viewing angles, even where narrow elevation limits stop the camera tilting
+    // towards the next viewpoint, and a field of view too narrow to find it fails instead of turning forever
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity");
+    std::vector<std::vector<unsigned int> > far(batchSize);
+    for (unsigned int i = 0; i < batchSize; ++i) {
+        unsigned int count = navGraph.viewpointCount(scans[i]);
+        for (unsigned int k = 1; k < count && far[i].empty(); ++k) {
+            unsigned int goal = (ixs[i] + k * 7) % count;
+            if (navGraph.shortestPath(scans[i], ixs[i], goal).size() > 4) {
+                far[i].push_back(goal);
+            }
+        }
+        REQUIRE(far[i].size() == 1);
+    }
+    for (double vfov : {60.0, 1.0}) {
+        INFO("vfov=" << vfov);
+        Simulator continuous;
+        continuous.setCameraResolution(640,480);
+        continuous.setCameraVFOV(radians(vfov));
+        continuous.setRenderingEnabled(false);
+        continuous.setDiscretizedViewingAngles(false);
+        continuous.setElevationLimits(-0.2, 0.2);
+        continuous.setBatchSize(batchSize);
+        REQUIRE_NOTHROW(continuous.newEpisode(scans, ixs, headings, std::vector<double>(batchSize, 0.0)));
+        if (vfov > 30.0) {
+            REQUIRE_NOTHROW(continuous.executePath(far));
+            for (unsigned int i = 0; i < batchSize; ++i) {
+                CHECK(continuous.getState().at(i)->location->ix == far[i].back());
+            }
+        } else {
+            CHECK_THROWS_AS(continuous.executePath(far), std::runtime_error);
+        }
+        REQUIRE_NOTHROW(continuous.close());
+    }
+}
+
+
+TEST_CASE( "Navigation Engine", "[Actions]" ) {
+
+    std::vector<std::string> scanIds = loadScanIds(16);
+    for (bool discretized : {true, false}) {
+        INFO("discretized=" << discretized);
+        Simulator sim;
+        NavEngine engine;
+        sim.setCameraResolution(640,480);
+        sim.setCameraVFOV(radians(60));
+        sim.setRenderingEnabled(false);
+        sim.setDiscretizedViewingAngles(discretized);
+        sim.setBatchSize(scanIds.size());
+        engine.setCameraResolution(640,480);
+        engine.setCameraVFOV(radians(60));
+        engine.setDiscretizedViewingAngles(discretized);
+        engine.setCandidateTablesEnabled(discretized);
+        engine.setBatchSize(scanIds.size());
+        REQUIRE_NOTHROW(sim.initialize());
+        REQUIRE_NOTHROW(engine.initialize());
+        const NavBatchState& state = engine.getState();
+        REQUIRE(state.maxCandidates > 1);
+        REQUIRE(state.candidateIx.size() == scanIds.size() * state.maxCandidates);
+        REQUIRE_NOTHROW(sim.newRandomEpisode(scanIds));
+        std::vector<unsigned int> scans, ixs;
+        std::vector<double> headings, elevations;
+        for (auto simState : sim.getState()) {
+            scans.push_back(simState->scanHandle);
+            ixs.push_back(simState->location->ix);
+            headings.push_back(simState->heading);
+            elevations.push_back(simState->elevation);
+        }
+        REQUIRE_NOTHROW(engine.reset(scans, ixs, headings, elevations));
+        for (int t = 0; t < 10; ++t) {
+            std::vector<unsigned int> ix;
+            headings.clear();
+            elevations.clear();
+            for (unsigned int i = 0; i < scanIds.size(); ++i) {
+                INFO("i=" << i << ", t=" << t);
+                SimStatePtr expected = sim.getState().at(i);
+                REQUIRE( state.scanHandle[i] == expected->scanHandle );
+                REQUIRE( state.ix[i] == expected->location->ix );
+                REQUIRE( state.heading[i] == expected->heading );
+                REQUIRE( state.elevation[i] == expected->elevation );
+                REQUIRE( state.viewIndex[i] == expected->viewIndex );
+                REQUIRE( state.step[i] == expected->step );
+                REQUIRE( state.candidateCount[i] == expected->navigableLocations.size() );
+                for (unsigned int n = 0; n < state.maxCandidates; ++n) {
+                    unsigned int k = i * state.maxCandidates + n;
+                    if (n >= state.candidateCount[i]) {
+                        CHECK( state.candidateIx[k] == noCandidate );
+                        continue;
+                    }
+                    const ViewpointPtr& loc = expected->navigableLocations[n];
+                    CHECK( state.candidateIx[k] == loc->ix );
+                    CHECK( state.candidateHeading[k] == loc->rel_heading );
+                    CHECK( state.candidateElevation[k] == loc->rel_elevation );
+                    CHECK( state.candidateDistance[k] == loc->rel_distance );
+                }
+                ix.push_back((t + i) % state.candidateCount[i]);
+                headings.push_back(radians(heading_chg[t]));
+                elevations.push_back(radians(elevation_chg[t]));
+            }
+            sim.makeAction(ix, headings, elevations);
+            engine.step(ix, headings, elevations);
+        }
+        // Invalid actions don't move any environment
+        std::vector<unsigned int> before = state.ix;
+        std::vector<unsigned int> invalid(scanIds.size(), 0);
+        invalid.back() = state.candidateCount.back();
+        std::vector<double> zeros(scanIds.size(), 0.0);
+        REQUIRE_THROWS_AS(engine.step(invalid, zeros, zeros), std::domain_error);
+        CHECK(state.ix == before);
+        REQUIRE_NOTHROW(sim.close());
+    }
+    // All users of the navigation graph must load it from the same directory
+    NavEngine same;
+    same.setNavGraphPath("./connectivity/");
+    REQUIRE_NOTHROW(same.initialize());
+    NavEngine other;
+    other.setNavGraphPath("./other_connectivity");
+    REQUIRE_THROWS_AS(other.initialize(), std::invalid_argument);
+}
+
+
+TEST_CASE( "Scan and Viewpoint Handles", "[Actions]" ) {
+
+    std::vector<std::string> scanIds {"2t7WUuJeko7", "17DRP5sb8fy"};
+    std::vector<std::string> viewpointIds {"cc34e9176bfe47ebb23c58c165203134", "5b9b2794954e4694a45fc424a8643081"};
+    Simulator byId, byHandle;
+    for (Simulator* sim : {&byId, &byHandle}) {
+        sim->setCameraResolution(200,100);
+        sim->setCameraVFOV(radians(45));
+        sim->setRenderingEnabled(false);
+        sim->setBatchSize(scanIds.size());
+        REQUIRE_NOTHROW(sim->initialize());
+    }
+    std::vector<unsigned int> scans, ixs;
+    for (int i = 0; i < scanIds.size(); ++i) {
+        scans.push_back(byHandle.scanHandle(scanIds[i]));
+        ixs.push_back(byHandle.viewpointIndex(scans[i], viewpointIds[i]));
+    }
+    CHECK(scans[0] != scans[1]);
+    CHECK(byHandle.scanHandle(scanIds[0]) == scans[0]);
+    REQUIRE_THROWS_AS(byHandle.scanHandle("missing"), std::invalid_argument);
+    REQUIRE_THROWS_AS(byHandle.viewpointIndex(scans[0], "missing"), std::invalid_argument);
+    CHECK(byHandle.viewpointIndices(scanIds, viewpointIds) == ixs);
+    REQUIRE_THROWS_AS(byHandle.viewpointIndices(scanIds, {viewpointIds[0], viewpointIds[0]}), std::invalid_argument);
+    REQUIRE_THROWS_AS(byHandle.viewpointIndices(scanIds, {viewpointIds[0]}), std::invalid_argument);
+
+    std::vector<double> headings(scanIds.size(), radians(heading[0]));
+    std::vector<double> elevations(scanIds.size(), radians(elevation[0]));
+    REQUIRE_NOTHROW(byId.newEpisode(scanIds, viewpointIds, headings, elevations));
+    REQUIRE_NOTHROW(byHandle.newEpisode(scans, ixs, headings, elevations));
+    for (int t = 0; t < 10; ++t ) {
+        std::vector<unsigned int> ix;
+        headings.clear();
+        elevations.clear();
+        for (int i = 0; i < scanIds.size(); ++i) {
+            INFO("i=" << i << ", t=" << t);
+            SimStatePtr expected = byId.getState().at(i);
+            SimStatePtr state = byHandle.getState().at(i);
+            CHECK( state->scanId == expected->scanId );
+            CHECK( state->scanHandle == scans[i] );
+            CHECK( state->location->viewpointId == expected->location->viewpointId );
+            CHECK( state->location->ix == expected->location->ix );
+            REQUIRE( state->navigableLocations.size() == expected->navigableLocations.size() );
+            for (int n = 0; n < state->navigableLocations.size(); ++n) {
+                CHECK( state->navigableLocations[n]->viewpointId == expected->navigableLocations[n]->viewpointId );
+            }
+            ix.push_back(t % state->navigableLocations.size());
+            headings.push_back(radians(heading_chg[t]));
+            elevations.push_back(radians(elevation_chg[t]));
+        }
+        byId.makeAction(ix, headings, elevations);
+        byHandle.makeAction(ix, headings, elevations);
+    }
+    REQUIRE_NOTHROW(byId.close());
+    REQUIRE_NOTHROW(byHandle.close());
+}
+
+
+TEST_CASE( "Shortest Path Actions", "[Actions]" ) {
+
+    std::vector<std::string> scanIds {"2t7WUuJeko7", "17DRP5sb8fy", "2t7WUuJeko7", "17DRP5sb8fy"};
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    std::mt19937 rng(7);
+    for (bool discretized : {true, false}) {
+        INFO("discretized=" << discretized);
+        Simulator sim;
+        sim.setCameraResolution(200,100);
+        sim.setCameraVFOV(radians(45));
+        sim.setRenderingEnabled(false);
+        sim.setDiscretizedViewingAngles(discretized);
+        sim.setBatchSize(scanIds.size());
+        REQUIRE_NOTHROW(sim.initialize());
+        REQUIRE_THROWS_AS(sim.shortestPathActions(std::vector<unsigned int>(scanIds.size(), 0)), std::runtime_error);
+
+        // Random start and goal viewpoints, with the camera looking down so it must level out
+        std::vector<unsigned int> scans, starts, goals;
+        std::vector<std::string> goalIds;
+        for (auto& scanId : scanIds) {
+            unsigned int scan = navGraph.scanHandle(scanId);
+            std::uniform_int_distribution<unsigned int> random(0, navGraph.viewpointCount(scan) - 1);
+            unsigned int start, goal;
+            do {
+                start = random(rng);
+                goal = random(rng);
+            } while (!navGraph.included(scan, start) || !navGraph.included(scan, goal) 
+                    || navGraph.distance(scan, start, goal) == std::numeric_limits<float>::infinity());
+            scans.push_back(scan);
+            starts.push_back(start);
+            goals.push_back(goal);
+            goalIds.push_back(navGraph.viewpoint(scan, goal));
+        }
+        std::vector<double> headings {0.0, 1.0, 3.0, 5.0};
+        std::vector<double> elevations(scanIds.size(), radians(-30));
+        REQUIRE_NOTHROW(sim.newEpisode(scans, starts, headings, elevations));
+
+        std::vector<bool> done(scanIds.size(), false);
+        for (int t = 0; t < 100 && std::find(done.begin(), done.end(), false) != done.end(); ++t) {
+            Actions actions = sim.shortestPathActions(goals);
+            Actions byId = sim.shortestPathActions(goalIds);
+            REQUIRE(actions.index.size() == scanIds.size());
+            for (unsigned int i = 0; i < scanIds.size(); ++i) {
+                INFO("i=" << i << ", t=" << t);
+                SimStatePtr state = sim.getState().at(i);
+                CHECK(byId.index[i] == actions.index[i]);
+                CHECK(byId.heading[i] == actions.heading[i]);
+                CHECK(byId.elevation[i] == actions.elevation[i]);
+                bool atGoal = state->location->ix == goals[i];
+                CHECK(atGoal == (actions.index[i] == 0 && actions.heading[i] == 0 && actions.elevation[i] == 0));
+                done[i] = atGoal;
+                if (actions.index[i] > 0) {
+                    // Moves along a shortest path
+                    CHECK(state->navigableLocations[actions.index[i]]->ix 
+                            == navGraph.nextHop(scans[i], state->location->ix, goals[i]));
+                }
+                if (discretized && !atGoal) {
+                    // Python reference, R2RBatch._shortest_path_action
+                    std::string nextViewpointId = sim.shortestPath(state->scanId, state->location->viewpointId, 
+                            goalIds[i])[1];
+                    int index = -1, heading = 0, elevation = 0;
+                    for (unsigned int n = 0; n < state->navigableLocations.size(); ++n) {
+                        ViewpointPtr loc = state->navigableLocations[n];
+                        if (loc->viewpointId == nextViewpointId) {
+                            if (loc->rel_heading > M_PI/6.0) heading = 1;
+                            else if (loc->rel_heading < -M_PI/6.0) heading = -1;
+                            else if (loc->rel_elevation > M_PI/6.0 && state->viewIndex/12 < 2) elevation = 1;
+                            else if (loc->rel_elevation < -M_PI/6.0 && state->viewIndex/12 > 0) elevation = -1;
+                            else index = n;
+                            break;
+                        }
+                    }
+                    if (index == -1 && heading == 0 && elevation == 0) {
+                        index = 0;
+                        if (state->viewIndex/12 == 0) elevation = 1;
+                        else if (state->viewIndex/12 == 2) elevation = -1;
+                        else {
+                            const glm::vec3& target = navGraph.cameraPosition(scans[i], navGraph.index(scans[i], nextViewpointId));
+                            double targetHeading = M_PI/2.0 - atan2(target.y - state->location->y, target.x - state->location->x);
+                            if (targetHeading < 0) targetHeading += 2.0*M_PI;
+                            heading = 1;
+                            if (state->heading > targetHeading && state->heading - targetHeading < M_PI) heading = -1;
+                            if (targetHeading > state->heading && targetHeading - state->heading > M_PI) heading = -1;
+                        }
+                    } else if (index == -1) {
+                        index = 0;
+                    }
+                    CHECK(actions.index[i] == index);
+                    CHECK((actions.heading[i] > 0) - (actions.heading[i] < 0) == heading);
+                    CHECK((actions.elevation[i] > 0) - (actions.elevation[i] < 0) == elevation);
+                }
+            }
+            sim.makeAction(actions.index, actions.heading, actions.elevation);
+        }
+        // Every agent reaches its goal and stays there
+        CHECK(std::find(done.begin(), done.end(), false) == done.end());
+        REQUIRE_THROWS_AS(sim.shortestPathActions(std::vector<unsigned int>(1, goals[0])), std::invalid_argument);
+        REQUIRE_NOTHROW(sim.close());
+    }
+}
+
+
+TEST_CASE( "Skybox Decoding", "[Images]" ) {
+
+    // Synthetic skybox strip with a different colour on each face
+    int faceSize = 512;
+    cv::Mat strip(faceSize, 6*faceSize, CV_8UC3, cv::Scalar(0, 0, 0));
+    for (int k = 0; k < 6; ++k) {
+        strip(cv::Rect(k*faceSize, 0, faceSize, faceSize)).setTo(cv::Scalar(40*k, 250-40*k, 20*k));
+    }
+    std::string filename{"sim_imgs/skybox_decoding_test.jpg"};
+    REQUIRE(cv::imwrite(filename, strip));
+
+    CHECK(requiredFaceSize(64, 0.8) == 152);
+    CHECK(skyboxScaleDenom(512, 0) == 1);
+    CHECK(skyboxScaleDenom(512, 600) == 1);
+    CHECK(skyboxScaleDenom(512, 256) == 2);
+    CHECK(skyboxScaleDenom(512, 152) == 2);
+    CHECK(skyboxScaleDenom(512, 10) == 8);
+
+    std::vector<cv::Mat> faces;
+    REQUIRE_NOTHROW(decodeSkybox(filename, 100, allCubemapFaces, faces));
+    REQUIRE(faces.size() == 6);
+    for (unsigned int i = 0; i < 6; ++i) {
+        INFO("face=" << i);
+#ifdef LIBJPEG_TURBO
+        CHECK(faces[i].rows == 128);
+        CHECK(faces[i].cols == 128);
+#else
+        CHECK(faces[i].rows == faceSize);
+        CHECK(faces[i].cols == faceSize);
+#endif
+        int k = skyboxStripIndex[i];
+        cv::Vec3b centre = faces[i].at<cv::Vec3b>(faces[i].rows/2, faces[i].cols/2);
+        CHECK(std::abs(centre[0] - 40*k) <= 4);
+        CHECK(std::abs(centre[1] - (250-40*k)) <= 4);
+        CHECK(std::abs(centre[2] - 20*k) <= 4);
+    }
+
+    // Partial decoding of the span of the strip containing the requested faces
+    std::vector<cv::Mat> partial;
+#ifdef LIBJPEG_TURBO
+    CHECK(decodeSkybox(filename, 0, 1, partial) == 1); // +x only
+    CHECK(decodeSkybox(filename, 0, 1 | 4, partial) == (1 | 4 | 16)); // +x, +y, and +z in between
+#else
+    CHECK(decodeSkybox(filename, 0, 1, partial) == allCubemapFaces);
+#endif
+    REQUIRE(partial.size() == 6);
+    CHECK(partial[0].rows == faceSize);
+    int k = skyboxStripIndex[0];
+    cv::Vec3b centre = partial[0].at<cv::Vec3b>(faceSize/2, faceSize/2);
+    CHECK(std::abs(centre[0] - 40*k) <= 4);
+
+    REQUIRE_THROWS(decodeSkybox("sim_imgs/missing_skybox.jpg", 0, allCubemapFaces, faces));
+}
+
+
+TEST_CASE( "Batched File Reading", "[Images]" ) {
+
+    std::vector<std::string> filenames;
+    for (auto& scanId : loadScanIds()) {
+        filenames.push_back("./connectivity/" + scanId + "_connectivity.json");
+    }
+    std::vector<std::vector<unsigned char> > data;
+    std::vector<int> calls(filenames.size(), 0);
+    REQUIRE_NOTHROW(readFiles(filenames, data, [&](size_t i) { calls[i]++; }));
+    REQUIRE(data.size() == filenames.size());
+    for (unsigned int i = 0; i < filenames.size(); ++i) {
+        INFO(filenames[i]);
+        CHECK(calls[i] == 1);
+        std::vector<unsigned char> expected;
+        readFile(filenames[i], expected);
+        CHECK(data[i] == expected);
+    }
+    filenames.push_back("./connectivity/missing_connectivity.json");
+    REQUIRE_THROWS_AS(readFiles(filenames, data, [](size_t i) {}), std::invalid_argument);
+}
+
+
+TEST_CASE( "Navigation Graph Index", "[NavGraph]" ) {
+
+    const std::string indexFile = "./navgraph_test.bin";
+    REQUIRE_NOTHROW(NavGraphFile::compile("./connectivity", indexFile));
+    {
+        NavGraphFile index(indexFile);
+        std::vector<std::string> scanIds = loadScanIds();
+        REQUIRE(index.size() == scanIds.size());
+        for (auto& scanId : scanIds) {
+            INFO(scanId);
+            auto sourceFile = "./connectivity/" + scanId + "_connectivity.json";
+            ScanGraph expected, graph;
+            readConnectivityJson(sourceFile, expected);
+            REQUIRE(index.read(scanId, sourceFile, graph));
+            CHECK(graph.viewpointIds == expected.viewpointIds);
+            CHECK(graph.included == expected.included);
+            CHECK(graph.poses == expected.poses);
+            CHECK(graph.unobstructed == expected.unobstructed);
+        }
+        ScanGraph graph;
+        CHECK_FALSE(index.read("missing", "./connectivity/missing_connectivity.json", graph));
+        // A changed json file takes precedence, a missing one doesn't
+        CHECK_FALSE(index.read(scanIds[0], "./connectivity/" + scanIds[1] + "_connectivity.json", graph));
+        CHECK(index.read(scanIds[0], "./connectivity/missing_connectivity.json", graph));
+    }
+    std::remove(indexFile.c_str());
+    REQUIRE_THROWS_AS(NavGraphFile("./connectivity/scans.txt"), std::runtime_error);
+}
+
+
+TEST_CASE( "Navigation Graph Adjacency", "[NavGraph]" ) {
+
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    for (auto& scanId : loadScanIds()) {
+        INFO(scanId);
+        ScanGraph expected;
+        readConnectivityJson("./connectivity/" + scanId + "_connectivity.json", expected);
+        unsigned int scan = navGraph.scanHandle(scanId);
+        REQUIRE(navGraph.scanId(scan) == scanId);
+        REQUIRE(navGraph.viewpointCount(scan) == expected.viewpointIds.size());
+        Span<glm::vec3> positions = navGraph.cameraPositions(scan);
+        REQUIRE(positions.size() == expected.viewpointIds.size());
+        for (unsigned int ix = 0; ix < expected.viewpointIds.size(); ++ix) {
+            CHECK(navGraph.viewpoint(scan, ix) == expected.viewpointIds[ix]);
+            CHECK(navGraph.included(scan, ix) == expected.included[ix]);
+            if (expected.included[ix]) {
+                CHECK(navGraph.index(scan, expected.viewpointIds[ix]) == ix);
+            } else {
+                CHECK_THROWS_AS(navGraph.index(scan, expected.viewpointIds[ix]), std::invalid_argument);
+            }
+            CHECK(positions[ix].x == expected.poses[16*ix + 3]);
+            CHECK(positions[ix].y == expected.poses[16*ix + 7]);
+            CHECK(positions[ix].z == expected.poses[16*ix + 11]);
+            std::vector<unsigned int> reachable;
+            for (unsigned int i = 0; i < expected.viewpointIds.size(); ++i) {
+                if (i != ix && expected.unobstructed[ix][i] && expected.included[i]) {
+                    reachable.push_back(i);
+                }
+            }
+            Span<unsigned int> adjacent = navGraph.adjacentViewpoints(scan, ix);
+            CHECK(std::vector<unsigned int>(adjacent.begin(), adjacent.end()) == reachable);
+            CHECK(navGraph.adjacentViewpointIndices(scanId, ix) == reachable);
+            // Bearings are sorted, and agree with the positions
+            NavGraph::NeighbourBearings bearings = navGraph.neighbourBearings(scan, ix);
+            REQUIRE(bearings.viewpoints.size() == reachable.size());
+            std::vector<unsigned int> sorted(bearings.viewpoints.begin(), bearings.viewpoints.end());
+            std::sort(sorted.begin(), sorted.end());
+            CHECK(sorted == reachable);
+            for (unsigned int k = 0; k < bearings.viewpoints.size(); ++k) {
+                glm::vec3 offset = positions[bearings.viewpoints[k]] - positions[ix];
+                double bearing = M_PI/2 - atan2(offset.y, offset.x);
+                CHECK(std::fmod(bearing + 2*M_PI, 2*M_PI) == Approx(bearings.bearings[k]).margin(1e-6));
+                CHECK(bearings.bearings[k] >= 0);
+                CHECK(bearings.bearings[k] < 2*M_PI);
+                CHECK(bearings.distances[k] == Approx(glm::length(offset)));
+                if (k > 0) {
+                    CHECK(bearings.bearings[k-1] <= bearings.bearings[k]);
+                }
+            }
+        }
+        REQUIRE_THROWS(navGraph.adjacentViewpoints(scan, expected.viewpointIds.size()));
+    }
+}
+
+
+TEST_CASE( "Shortest Paths", "[NavGraph]" ) {
+
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    for (auto& scanId : loadScanIds(3)) {
+        INFO(scanId);
+        ScanGraph expected;
+        readConnectivityJson("./connectivity/" + scanId + "_connectivity.json", expected);
+        unsigned int scan = navGraph.scanHandle(scanId);
+        unsigned int n = expected.viewpointIds.size();
+        // Floyd-Warshall reference over the same graph as utils.load_nav_graphs
+        const double inf = std::numeric_limits<double>::infinity();
+        std::vector<double> reference(n*n, inf);
+        for (unsigned int i = 0; i < n; ++i) {
+            if (!expected.included[i]) {
+                continue;
+            }
+            reference[i*n + i] = 0;
+            for (unsigned int j = 0; j < n; ++j) {
+                if (i != j && expected.unobstructed[i][j] && expected.included[j]) {
+                    double dx = expected.poses[16*i + 3] - expected.poses[16*j + 3];
+                    double dy = expected.poses[16*i + 7] - expected.poses[16*j + 7];
+                    double dz = expected.poses[16*i + 11] - expected.poses[16*j + 11];
+                    reference[i*n + j] = std::sqrt(dx*dx + dy*dy + dz*dz);
+                }
+            }
+        }
+        for (unsigned int k = 0; k < n; ++k) {
+            for (unsigned int i = 0; i < n; ++i) {
+                for (unsigned int j = 0; j < n; ++j) {
+                    reference[i*n + j] = std::min(reference[i*n + j], reference[i*n + k] + reference[k*n + j]);
+                }
+            }
+        }
+        std::vector<unsigned int> scanHandles(n*n, scan);
+        std::vector<unsigned int> from(n*n);
+        std::vector<unsigned int> to(n*n);
+        for (unsigned int i = 0; i < n*n; ++i) {
+            from[i] = i / n;
+            to[i] = i % n;
+        }
+        std::vector<float> distances = navGraph.distances(scanHandles, from, to);
+        std::vector<unsigned int> nextHops = navGraph.nextHops(scanHandles, from, to);
+        for (unsigned int i = 0; i < n*n; ++i) {
+            INFO(from[i] << " -> " << to[i]);
+            if (reference[i] == inf) {
+                CHECK(distances[i] == std::numeric_limits<float>::infinity());
+                CHECK(nextHops[i] == noNextHop);
+                continue;
+            }
+            REQUIRE(distances[i] == Approx(reference[i]).margin(1e-4));
+            if (from[i] == to[i]) {
+                CHECK(nextHops[i] == from[i]);
+                continue;
+            }
+            // The next hop is adjacent and on a shortest path
+            Span<unsigned int> adjacent = navGraph.adjacentViewpoints(scan, from[i]);
+            CHECK(std::find(adjacent.begin(), adjacent.end(), nextHops[i]) != adjacent.end());
+            CHECK(reference[from[i]*n + nextHops[i]] + reference[nextHops[i]*n + to[i]] 
+                    == Approx(reference[i]).margin(1e-4));
+        }
+        // Paths follow the next hops
+        std::vector<unsigned int> path = navGraph.shortestPath(scan, from.back(), to[1]);
+        if (reference[from.back()*n + 1] == inf) {
+            CHECK(path.empty());
+        } else {
+            REQUIRE(path.size() >= 2);
+            CHECK(path.front() == from.back());
+            CHECK(path.back() == to[1]);
+            CHECK(path[1] == navGraph.nextHop(scan, from.back(), to[1]));
+        }
+        CHECK_THROWS_AS(navGraph.distance(scan, 0, n), std::out_of_range);
+    }
+
+    // Cached paths are only used for the graph they were computed from
+    ShortestPaths paths;
+    paths.size = 2;
+    paths.distances = {0.0f, 1.5f, 1.5f, 0.0f};
+    paths.nextHops = {0, 1, 0, 1};
+    writeShortestPaths("./paths_test.bin", 42, paths);
+    ShortestPaths cached;
+    CHECK_FALSE(readShortestPaths("./paths_test.bin", 43, 2, cached));
+    CHECK_FALSE(readShortestPaths("./paths_test.bin", 42, 3, cached));
+    REQUIRE(readShortestPaths("./paths_test.bin", 42, 2, cached));
+    CHECK(cached.size == 2);
+    CHECK(cached.distance(0, 1) == 1.5f);
+    CHECK(cached.nextHop(1, 0) == 0);
+    // A corrupt next hop is a cache miss
+    paths.nextHops[1] = 7;
+    writeShortestPaths("./paths_test.bin", 42, paths);
+    CHECK_FALSE(readShortestPaths("./paths_test.bin", 42, 2, cached));
+    CHECK(cached.nextHop(0, 1) == 1);
+    std::remove("./paths_test.bin");
+    CHECK_FALSE(readShortestPaths("./paths_test.bin", 42, 2, cached));
+}
+
+
+TEST_CASE( "Spatial Index", "[NavGraph]" ) {
+
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    std::mt19937 generator(1);
+    for (auto& scanId : loadScanIds(5)) {
+        INFO(scanId);
+        unsigned int scan = navGraph.scanHandle(scanId);
+        Span<glm::vec3> positions = navGraph.cameraPositions(scan);
+        // Brute force reference, with points around and exactly at the viewpoints
+        std::uniform_real_distribution<float> offset(-3.f, 3.f);
+        std::vector<unsigned int> scanHandles;
+        std::vector<glm::vec3> points;
+        for (unsigned int ix = 0; ix < positions.size(); ++ix) {
+            scanHandles.push_back(scan);
+            points.push_back(positions[ix]);
+            scanHandles.push_back(scan);
+            points.push_back(positions[ix] + glm::vec3(offset(generator), offset(generator), offset(generator)));
+        }
+        const double radius = 2.5;
+        std::vector<unsigned int> nearest = navGraph.nearestViewpoints(scanHandles, points);
+        std::vector<std::vector<unsigned int> > within = navGraph.viewpointsWithin(scanHandles, points, radius);
+        REQUIRE(nearest.size() == points.size());
+        REQUIRE(within.size() == points.size());
+        for (unsigned int i = 0; i < points.size(); ++i) {
+            INFO("i=" << i);
+            std::vector<std::pair<double, unsigned int> > expected;
+            for (unsigned int ix = 0; ix < positions.size(); ++ix) {
+                if (navGraph.included(scan, ix)) {
+                    double dx = double(points[i].x) - positions[ix].x;
+                    double dy = double(points[i].y) - positions[ix].y;
+                    double dz = double(points[i].z) - positions[ix].z;
+                    expected.emplace_back(dx*dx + dy*dy + dz*dz, ix);
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            CHECK(nearest[i] == expected.front().second);
+            CHECK(navGraph.nearestViewpoint(scan, points[i]) == nearest[i]);
+            std::vector<unsigned int> expectedWithin;
+            for (auto& e : expected) {
+                if (e.first <= radius*radius) {
+                    expectedWithin.push_back(e.second);
+                }
+            }
+            CHECK(within[i] == expectedWithin);
+        }
+    }
+    REQUIRE_THROWS_AS(navGraph.nearestViewpoints({0, 1}, {glm::vec3(0,0,0)}), std::invalid_argument);
+}
+
+
+TEST_CASE( "Path Sampler", "[NavGraph]" ) {
+
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    std::vector<std::string> scanIds = loadScanIds(3);
+    PathSampler sampler;
+    sampler.setScans(scanIds);
+    sampler.setDistanceRange(5.f, 20.f);
+    sampler.setHopRange(4, 6);
+    sampler.setSeed(7);
+    REQUIRE_NOTHROW(sampler.initialize());
+
+    // Every pair satisfying the constraints can be sampled
+    size_t expectedPairs = 0;
+    for (auto& id : scanIds) {
+        unsigned int scan = navGraph.scanHandle(id);
+        unsigned int n = navGraph.viewpointCount(scan);
+        for (unsigned int from = 0; from < n; ++from) {
+            for (unsigned int to = 0; to < n; ++to) {
+                std::vector<unsigned int> path = navGraph.shortestPath(scan, from, to);
+                float distance = navGraph.distance(scan, from, to);
+                if (!path.empty() && path.size() >= 5 && path.size() <= 7 && distance >= 5.f && distance <= 20.f) {
+                    expectedPairs++;
+                }
+            }
+        }
+    }
+    CHECK(sampler.pairCount() == expectedPairs);
+
+    std::vector<SampledPath> paths = sampler.sample(0, 1000);
+    REQUIRE(paths.size() == 1000);
+    for (auto& sampled : paths) {
+        CHECK(sampled.path.size() >= 5);
+        CHECK(sampled.path.size() <= 7);
+        CHECK(sampled.distance >= 5.f);
+        CHECK(sampled.distance <= 20.f);
+        CHECK(sampled.heading >= 0.0);
+        CHECK(sampled.heading < 2.0*M_PI);
+        CHECK(sampled.path == navGraph.shortestPath(sampled.scanHandle, sampled.path.front(), sampled.path.back()));
+        CHECK(sampled.distance == navGraph.distance(sampled.scanHandle, sampled.path.front(), sampled.path.back()));
+    }
+
+    // Each path only depends on the seed and its position in the corpus
+    std::vector<SampledPath> second = sampler.sample(500, 500);
+    PathSampler other;
+    other.setScans(scanIds);
+    other.setDistanceRange(5.f, 20.f);
+    other.setHopRange(4, 6);
+    other.setSeed(7);
+    std::vector<SampledPath> repeated = other.sample(0, 1000);
+    for (unsigned int i = 0; i < 1000; ++i) {
+        CHECK(repeated[i].path == paths[i].path);
+        CHECK(repeated[i].heading == paths[i].heading);
+        if (i >= 500) {
+            CHECK(second[i-500].path == paths[i].path);
+        }
+    }
+    PathSampler reseeded;
+    reseeded.setScans(scanIds);
+    reseeded.setDistanceRange(5.f, 20.f);
+    reseeded.setHopRange(4, 6);
+    reseeded.setSeed(8);
+    std::vector<SampledPath> different = reseeded.sample(0, 1000);
+    unsigned int same = 0;
+    for (unsigned int i = 0; i < 1000; ++i) {
+        same += different[i].path == paths[i].path;
+    }
+    CHECK(same < 100);
+
+    // The json lines file has the same paths
+    REQUIRE_NOTHROW(sampler.writeJsonLines("./sampled_paths_test.jsonl", 100));
+    std::ifstream jsonLines("./sampled_paths_test.jsonl");
+    std::string line;
+    unsigned int count = 0;
+    while (std::getline(jsonLines, line)) {
+        INFO(line);
+        Json::Value episode;
+        std::istringstream(line) >> episode;
+        REQUIRE(count < 100);
+        const SampledPath& expected = paths[count++];
+        CHECK(episode["scan"].asString() == navGraph.scanId(expected.scanHandle));
+        REQUIRE(episode["path"].size() == expected.path.size());
+        for (unsigned int k = 0; k < expected.path.size(); ++k) {
+            CHECK(episode["path"][k].asString() == navGraph.viewpoint(expected.scanHandle, expected.path[k]));
+        }
+        CHECK(episode["distance"].asDouble() == Approx(expected.distance).epsilon(1e-5));
+        CHECK(episode["heading"].asDouble() == Approx(expected.heading).epsilon(1e-5));
+    }
+    CHECK(count == 100);
+    std::remove("./sampled_paths_test.jsonl");
+
+    // Random walks step between reachable viewpoints without turning straight back
+    PathSampler walker;
+    walker.setScans(scanIds);
+    walker.setHopRange(4, 6);
+    walker.setRandomWalks(true);
+    walker.setSeed(7);
+    std::vector<SampledPath> walks = walker.sample(0, 1000);
+    for (auto& walk : walks) {
+        REQUIRE(walk.path.size() >= 2);
+        CHECK(walk.path.size() <= 7);
+        float distance = 0;
+        for (unsigned int k = 1; k < walk.path.size(); ++k) {
+            INFO("k=" << k);
+            auto neighbours = navGraph.neighbourBearings(walk.scanHandle, walk.path[k-1]);
+            auto it = std::find(neighbours.viewpoints.begin(), neighbours.viewpoints.end(), walk.path[k]);
+            REQUIRE(it != neighbours.viewpoints.end());
+            distance += neighbours.distances[it - neighbours.viewpoints.begin()];
+            if (k > 1 && neighbours.viewpoints.size() > 1) {
+                CHECK(walk.path[k] != walk.path[k-2]);
+            }
+        }
+        CHECK(walk.distance == Approx(distance));
+    }
+    std::vector<SampledPath> repeatedWalks = walker.sample(500, 500);
+    for (unsigned int i = 0; i < 500; ++i) {
+        CHECK(repeatedWalks[i].path == walks[i+500].path);
+    }
+    PathSampler unbounded;
+    unbounded.setScans(scanIds);
+    unbounded.setRandomWalks(true);
+    REQUIRE_THROWS_AS(unbounded.initialize(), std::invalid_argument);
+}
+
+
+TEST_CASE( "Texture Cache Policies", "[Cache]" ) {
+
+    std::vector<int> evicted;
+    auto onEvict = [&](const int& key) { evicted.push_back(key); };
+
+    SECTION("LRU evicts the least recently used entry") {
+        TextureCache<int> cache(CachePolicy::LRU, 0, 300, onEvict);
+        cache.add(1, "a", 100);
+        cache.add(2, "a", 100);
+        cache.add(3, "a", 100);
+        cache.add(1, "a", 100);
+        CHECK(evicted.empty());
+        cache.add(4, "a", 100);
+        REQUIRE(evicted.size() == 1);
+        CHECK(evicted[0] == 2);
+        CHECK(cache.statistics().bytes == 300);
+        CHECK(cache.statistics().entries == 3);
+        CHECK(cache.statistics().evictions == 1);
+        CHECK(cache.statistics().evictedBytes == 100);
+    }
+
+    SECTION("Pinned entries are not evicted") {
+        TextureCache<int> cache(CachePolicy::LRU, 0, 200, onEvict);
+        cache.add(1, "a", 100);
+        cache.pin(1);
+        cache.add(2, "a", 100);
+        cache.add(3, "a", 100);
+        REQUIRE(evicted.size() == 1);
+        CHECK(evicted[0] == 2);
+        cache.unpinAll();
+        cache.add(4, "a", 100);
+        REQUIRE(evicted.size() == 2);
+        CHECK(evicted[1] == 1);
+    }
+
+    SECTION("2Q keeps repeatedly used entries during a sweep") {
+        TextureCache<int> cache(CachePolicy::TwoQueue, 0, 800, onEvict);
+        // 1 and 2 are evicted from the FIFO queue, then promoted when used again
+        for (int key = 1; key <= 12; ++key) {
+            cache.add(key, "a", 100);
+        }
+        cache.add(1, "a", 100);
+        cache.add(2, "a", 100);
+        evicted.clear();
+        for (int key = 100; key < 120; ++key) {
+            cache.add(key, "b", 100);
+        }
+        CHECK(std::find(evicted.begin(), evicted.end(), 1) == evicted.end());
+        CHECK(std::find(evicted.begin(), evicted.end(), 2) == evicted.end());
+        CHECK(cache.statistics().bytes <= 800);
+    }
+
+    SECTION("Scan affinity evicts from the largest scan") {
+        TextureCache<int> cache(CachePolicy::ScanAffinity, 0, 600, onEvict);
+        cache.add(1, "a", 100);
+        cache.add(2, "a", 100);
+        for (int key = 100; key < 110; ++key) {
+            cache.add(key, "b", 100);
+        }
+        CHECK(std::find(evicted.begin(), evicted.end(), 1) == evicted.end());
+        CHECK(std::find(evicted.begin(), evicted.end(), 2) == evicted.end());
+        CHECK(evicted.size() == 6);
+    }
+
+    SECTION("Capacity is sized from the mean entry size") {
+        TextureCache<int> cache(CachePolicy::LRU, 4, 0, onEvict);
+        cache.add(1, "a", 100);
+        cache.add(2, "a", 300);
+        cache.add(3, "a", 200);
+        CHECK(evicted.empty());
+        cache.add(4, "a", 200);
+        CHECK(cache.statistics().capacity == 600);
+        REQUIRE(evicted.size() == 2);
+        CHECK(evicted[0] == 1);
+        CHECK(evicted[1] == 2);
+        cache.count(true);
+        cache.count(false);
+        cache.count(false);
+        CHECK(cache.statistics().hits == 1);
+        CHECK(cache.statistics().misses == 2);
+    }
+}
+
+
 TEST_CASE( "RGB Image", "[Rendering]" ) {
 
     Simulator sim;
@@ -387,6 +1826,162 @@ TEST_CASE( "RGB Image", "[Rendering]" ) {
 }
 
 
+TEST_CASE( "Background Texture Upload", "[Rendering]" ) {
+
+    Simulator sim;
+    sim.setCameraResolution(640,480); // width,height
+    sim.setCameraVFOV(radians(60)); // 60deg vfov, 80deg hfov
+    CHECK(sim.setElevationLimits(radians(-40),radians(50)));
+    unsigned int batchSize = 4;
+    sim.setBatchSize(batchSize);
+    sim.setBackgroundUploadEnabled(true);
+    REQUIRE_NOTHROW(sim.initialize());
+    Json::Value root;
+    std::string testSpecFile{"src/test/rendertest_spec.json"};
+    std::ifstream ifs(testSpecFile, std::ifstream::in);
+    if (ifs.fail()){
+        throw std::invalid_argument( "Could not open test spec file: " + testSpecFile );
+    }
+    ifs >> root;
+
+    std::vector<std::string> scanIds(batchSize);
+    std::vector<std::string> viewpointIds(batchSize);
+    std::vector<double> headings(batchSize);
+    std::vector<double> elevations(batchSize);
+
+    for (auto testbatch : root) {
+        for (unsigned int n=0; n<batchSize; ++n) {
+            auto testcase = testbatch[n];
+            scanIds.at(n) = testcase["scanId"].asString();
+            viewpointIds.at(n) = testcase["viewpointId"].asString();
+            headings.at(n) = testcase["heading"].asFloat();
+            elevations.at(n) = testcase["elevation"].asFloat();
+        }
+        INFO(testbatch);
+        REQUIRE_NOTHROW(sim.newEpisode(scanIds, viewpointIds, headings, elevations));
+        for (unsigned int n=0; n<batchSize; ++n) {
+            auto reference_image = cv::imread("webgl_imgs/"+testbatch[n]["reference_image"].asString());
+            auto state = sim.getState().at(n);
+            double err = cv::norm(reference_image, state->rgb, CV_L2);
+            err /= reference_image.rows * reference_image.cols;
+            CHECK(err < 0.15);
+        }
+    }
+    REQUIRE_NOTHROW(sim.close());
+}
+
+
+TEST_CASE( "Cache Warm-up", "[Rendering]" ) {
+
+    Simulator sim;
+    sim.setCameraResolution(640,480); // width,height
+    sim.setCameraVFOV(radians(60)); // 60deg vfov, 80deg hfov
+    REQUIRE_NOTHROW(sim.initialize());
+    Json::Value root;
+    std::string testSpecFile{"src/test/rendertest_spec.json"};
+    std::ifstream ifs(testSpecFile, std::ifstream::in);
+    if (ifs.fail()){
+        throw std::invalid_argument( "Could not open test spec file: " + testSpecFile );
+    }
+    ifs >> root;
+
+    std::vector<std::string> scanIds;
+    std::vector<std::string> viewpointIds;
+    std::set<std::pair<std::string, std::string> > unique;
+    for (auto testbatch : root) {
+        for (auto testcase : testbatch) {
+            scanIds.push_back(testcase["scanId"].asString());
+            viewpointIds.push_back(testcase["viewpointId"].asString());
+            unique.insert({scanIds.back(), viewpointIds.back()});
+        }
+    }
+    CHECK(sim.warmCache(scanIds, viewpointIds, 0, 0) == 0);
+    // Image size is only known after the first viewpoint has been loaded
+    CHECK(sim.warmCache(scanIds, viewpointIds, 1, 1) <= 1);
+    // Viewpoints already in memory (from earlier calls or tests) are not loaded or counted again
+    CHECK(sim.warmCache(scanIds, viewpointIds, 0, 1ull << 40) <= unique.size());
+    CHECK(sim.warmCache(scanIds, viewpointIds, 0, 1ull << 40) == 0);
+    // Neighbourhoods add the adjacent viewpoints
+    CHECK(sim.warmCache(scanIds, viewpointIds, 1, 1ull << 40) > 0);
+    CHECK(sim.warmCache(scanIds, viewpointIds, 1, 1ull << 40) == 0);
+    viewpointIds.back() = "not_a_viewpoint";
+    REQUIRE_THROWS(sim.warmCache(scanIds, viewpointIds, 0, 1ull << 40));
+    REQUIRE_THROWS_AS(sim.warmCacheFromFile("tasks/R2R/data/missing.json", 1, 1ull << 40), std::invalid_argument);
+    REQUIRE_NOTHROW(sim.close());
+}
+
+
+TEST_CASE( "Low Resolution Tier", "[Rendering]" ) {
+
+    std::vector<std::string> scanIds{"2t7WUuJeko7"};
+    std::vector<std::string> viewpointIds{"cc34e9176bfe47ebb23c58c165203134"};
+    std::vector<double> headings{0};
+    std::vector<double> elevations{0};
+    {
+        // A small camera needs no more detail than the low resolution tier
+        Simulator sim;
+        sim.setCameraResolution(64,48); // width,height
+        sim.setLowResolutionFaceSize(128);
+        REQUIRE_NOTHROW(sim.initialize());
+        REQUIRE_NOTHROW(sim.newEpisode(scanIds, viewpointIds, headings, elevations));
+        CHECK(sim.getState().at(0)->lowResolution);
+        CHECK_FALSE(sim.getState().at(0)->placeholder);
+        REQUIRE_NOTHROW(sim.close());
+    }
+    {
+        // Blank frames until the low resolution tier has loaded, then full resolution images eventually 
+        // replace the low resolution tier
+        Simulator sim;
+        sim.setCameraResolution(640,480); // width,height
+        sim.setDeadlineModeEnabled(true);
+        REQUIRE_NOTHROW(sim.initialize());
+        bool lowResolution = true;
+        for (int i = 0; i < 100 && lowResolution; ++i) {
+            REQUIRE_NOTHROW(sim.newEpisode(scanIds, viewpointIds, headings, elevations));
+            SimStatePtr state = sim.getState().at(0);
+            lowResolution = state->lowResolution;
+            if (state->placeholder) {
+                CHECK(lowResolution);
+                cv::Mat blank(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+                CHECK(cv::norm(state->rgb, blank, CV_L2) == 0);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        CHECK_FALSE(lowResolution);
+        REQUIRE_NOTHROW(sim.close());
+
+        // The full resolution images were decoded at the reduced size the camera needs
+        NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+                CachePolicy::LRU, 0);
+        unsigned int scan = navGraph.scanHandle(scanIds[0]);
+        unsigned int ix = navGraph.index(scan, viewpointIds[0]);
+        unsigned int faceSize = requiredFaceSize(480, 0.8);
+        CHECK(navGraph.cubemapImagesLoaded(scan, ix, 0, faceSize));
+        CHECK_FALSE(navGraph.cubemapImagesLoaded(scan, ix, 0, 0));
+    }
+}
+
+
+TEST_CASE( "Decoded Face Size", "[Rendering]" ) {
+
+    NavGraph& navGraph = NavGraph::getInstance("./connectivity", "./data/v1/scans/", false, false, 1, 200,
+            CachePolicy::LRU, 0);
+    unsigned int scan = navGraph.scanHandle("2t7WUuJeko7");
+    unsigned int ix = navGraph.index(scan, "1e6b606b44df4a6086c0f97e826d4d15");
+    std::vector<unsigned int> scans{scan};
+    std::vector<unsigned int> ixs{ix};
+    std::vector<unsigned char> masks{allCubemapFaces};
+    // Images decoded for a small camera don't satisfy a larger one, which decodes them again
+    REQUIRE_NOTHROW(navGraph.loadCubemapImages(scans, ixs, masks, 100));
+    CHECK(navGraph.cubemapImagesLoaded(scan, ix, allCubemapFaces, 100));
+    CHECK(navGraph.cubemapImagesLoaded(scan, ix, allCubemapFaces, 50));
+    CHECK_FALSE(navGraph.cubemapImagesLoaded(scan, ix, allCubemapFaces, 0));
+    REQUIRE_NOTHROW(navGraph.loadCubemapImages(scans, ixs, masks, 0));
+    CHECK(navGraph.cubemapImagesLoaded(scan, ix, allCubemapFaces, 0));
+    CHECK(navGraph.cubemapImagesLoaded(scan, ix, allCubemapFaces, 100));
+}
+
+
 TEST_CASE( "Timing", "[Rendering]" ) {
 
     // Initialize random generator
@@ -0,0 +1,47 @@
+import sys
+sys.path.append('build')
+
+import MatterSim
+import math
+import numpy as np
+
+
+# Each call that logs its steps returns a new log, so arrays taken from an earlier log
+# stay valid when the simulator replays another trajectory.
+sim = MatterSim.Simulator()
+sim.setCameraResolution(640, 480)
+sim.setCameraVFOV(math.radians(60))
+sim.setRenderingEnabled(False)
+sim.setDiscretizedViewingAngles(True)
+sim.setBatchSize(1)
+sim.initialize()
+
+with open("connectivity/scans.txt") as f:
+    scanId = f.readline().strip()
+sim.newRandomEpisode([scanId])
+
+first = sim.executeSequence([[0]*6], [[0.5]*6], [[0.0]*6], log=True)
+heading = first.heading
+viewpointIx = first.viewpointIx
+savedHeading = heading.copy()
+savedViewpointIx = viewpointIx.copy()
+assert len(heading) == 7
+assert list(first.offsets) == [0, 7]
+
+second = sim.executeSequence([[0]*12], [[-0.5]*12], [[0.0]*12], log=True)
+assert second is not first
+assert len(second.heading) == 13
+assert np.array_equal(heading, savedHeading)
+assert np.array_equal(viewpointIx, savedViewpointIx)
+
+# The arrays keep their log alive
+del first
+third = sim.executePath([[sim.getState()[0].location.ix]], log=True)
+assert list(third.offsets) == [0, 1]
+assert np.array_equal(heading, savedHeading)
+assert np.array_equal(viewpointIx, savedViewpointIx)
+
+# Without log=True nothing is returned
+assert sim.executeSequence([[0]], [[0.5]], [[0.0]]) is None
+assert sim.executePath([[sim.getState()[0].location.viewpointId]]) is None
+print("TrajectoryLog reuse test passed")
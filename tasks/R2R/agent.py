@@ -113,7 +113,7 @@ class ShortestAgent(BaseAgent):
         ended = np.array([False] * len(obs))
         while True:
             actions = [ob['teacher'] for ob in obs]
-            obs = self.env.step(actions)
+            obs = self.env.step(actions, ~ended) # finished episodes are skipped
             for i,a in enumerate(actions):
                 if a == (0, 0, 0):
                     ended[i] = True
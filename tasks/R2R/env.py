@@ -55,10 +55,15 @@ class EnvBatch():
     def newEpisodes(self, scanIds, viewpointIds, headings):
         self.sim.newEpisode(scanIds, viewpointIds, headings, [0]*self.batch_size)
 
-    def getStates(self):
-        ''' Get list of states augmented with precomputed image features. rgb field will be empty. '''
+    def getStates(self, active=None):
+        ''' Get list of states augmented with precomputed image features. rgb field will be empty.
+            If given, only the states of environments whose active flag is set are returned. '''
         feature_states = []
-        for state in self.sim.getState():
+        if active is None:
+            states = self.sim.getState()
+        else:
+            states = self.sim.getState([bool(a) for a in active])
+        for state in states:
             long_id = self._make_id(state.scanId, state.location.viewpointId)
             if self.features:
                 feature = self.features[long_id][state.viewIndex,:]
@@ -67,9 +72,10 @@ class EnvBatch():
                 feature_states.append((None, state))
         return feature_states
 
-    def makeActions(self, actions):
+    def makeActions(self, actions, active=None):
         ''' Take an action using the full state dependent action interface (with batched input).
-            Every action element should be an (index, heading, elevation) tuple. '''
+            Every action element should be an (index, heading, elevation) tuple. If given, only
+            environments whose active flag is set are stepped. '''
         ix = []
         heading = []
         elevation = []
@@ -77,7 +83,10 @@ class EnvBatch():
             ix.append(int(i))
             heading.append(float(h))
             elevation.append(float(e))
-        self.sim.makeAction(ix, heading, elevation)
+        if active is None:
+            self.sim.makeAction(ix, heading, elevation)
+        else:
+            self.sim.makeAction(ix, heading, elevation, [bool(a) for a in active])
 
     def makeSimpleActions(self, simple_indices):
         ''' Take an action using a simple interface: 0-forward, 1-turn left, 2-turn right, 3-look up, 4-look down.
@@ -191,11 +200,17 @@ class R2RBatch():
             return (0,-1, 0) # Turn left
         return (0, 1, 0) # Turn right
 
-    def _get_obs(self):
-        obs = []
-        for i,(feature,state) in enumerate(self.env.getStates()):
+    def _get_obs(self, active=None):
+        ''' If active flags are given, only active environments are observed again, and the others
+            keep their previous observations. '''
+        if active is None:
+            self.obs = [None] * len(self.batch)
+            indices = range(len(self.batch))
+        else:
+            indices = [i for i,a in enumerate(active) if a]
+        for i,(feature,state) in zip(indices, self.env.getStates(active)):
             item = self.batch[i]
-            obs.append({
+            self.obs[i] = {
                 'instr_id' : item['instr_id'],
                 'scan' : state.scanId,
                 'viewpoint' : state.location.viewpointId,
@@ -207,10 +222,10 @@ class R2RBatch():
                 'navigableLocations' : state.navigableLocations,
                 'instructions' : item['instructions'],
                 'teacher' : self._shortest_path_action(state, item['path'][-1]),
-            })
+            }
             if 'instr_encoding' in item:
-                obs[-1]['instr_encoding'] = item['instr_encoding']
-        return obs
+                self.obs[i]['instr_encoding'] = item['instr_encoding']
+        return list(self.obs)
 
     def reset(self):
         ''' Load a new minibatch / episodes. '''
@@ -221,7 +236,8 @@ class R2RBatch():
         self.env.newEpisodes(scanIds, viewpointIds, headings)
         return self._get_obs()
 
-    def step(self, actions):
-        ''' Take action (same interface as makeActions) '''
-        self.env.makeActions(actions)
-        return self._get_obs()
+    def step(self, actions, active=None):
+        ''' Take action (same interface as makeActions). Inactive environments keep their previous
+            observations. '''
+        self.env.makeActions(actions, active)
+        return self._get_obs(active)